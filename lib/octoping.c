@@ -19,83 +19,9 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <inttypes.h>
+#include "octoping.h"
 
-#ifdef _WINDOWS
-#define WIN32_LEAN_AND_MEAN
-#include <WinSock2.h>
-#include <Windows.h>
-#include <WS2tcpip.h>
-
-#ifndef WSA_START
-#define WSA_START(x, y) WSAStartup((x), (y))
-#endif
-
-#ifndef SOCKET_TYPE
-#define SOCKET_TYPE SOCKET
-#endif
-
-#ifndef SOCKET_CLOSE
-#define SOCKET_CLOSE(x) closesocket(x)
-#endif
-
-#ifndef SOCKLEN_T
-#define SOCKLEN_T int
-#endif
-
-#else /* Linux */
-
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
-
-#ifndef __USE_XOPEN2K
-#define __USE_XOPEN2K
-#endif
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <arpa/inet.h>
-#include <errno.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <sys/select.h>
-
-#define SERVER_CERT_FILE "certs/cert.pem"
-#define SERVER_KEY_FILE "certs/key.pem"
-
-#ifndef SOCKET_TYPE
-#define SOCKET_TYPE int
-#endif
-#ifndef INVALID_SOCKET
-#define INVALID_SOCKET -1
-#endif
-#ifndef SOCKET_CLOSE
-#define SOCKET_CLOSE(x) close(x)
-#endif
-#ifndef WSA_LAST_ERROR
-#define WSA_LAST_ERROR(x) ((long)(x))
-#endif
-#ifndef SOCKLEN_T
-#define SOCKLEN_T socklen_t
-#endif
-#endif
-
-/*
-* By default, the server uses the port number 0xc389 (50057).
-* The value 0xc389 corresponds to the first 4 digits of the
-* MD5 hash of the string "octoping", which is:
-* 0xc3896939402e97b40501795bff15584d. The client uses a
-* randomly assigned port number.
-* The listening port value can be set with the command line
-* option [-p port].
-*/
-#define OCTOPING_PORT 0xc389
+uint64_t octoping_nb_syscalls = 0;
 
 /*
  * Provide clock time
@@ -135,455 +61,996 @@ uint64_t current_time()
     return now;
 }
 
-typedef struct st_octoping_options_t {
-    char const* server_name;
-    uint16_t server_port;
-    uint16_t source_port;
-    unsigned int is_server : 1;
-    unsigned int real_time : 1;
-    uint64_t interval_us;
-    uint64_t duration_us;
-    char const* file_name;
-} octoping_options_t;
+/*
+ * Provide clock time in nanoseconds
+ */
+uint64_t current_time_ns()
+{
+    uint64_t now;
+#ifdef WIN32
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    now = ft.dwHighDateTime;
+    now <<= 32;
+    now |= ft.dwLowDateTime;
+    /*
+    * Account for 100ns intervals elapsed between 1601 and 1970,
+    * then convert units from 100ns to 1ns.
+    */
+    now -= 116444736000000000ULL;
+    now *= 100;
+#else
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    now = (ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+#endif
+    return now;
+}
+
 
-static void usage(char const * sample_name)
+uint64_t parse_64(uint8_t* buffer)
 {
-    fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "    %s [-r] [-p port] [-o file_name] <server_name> <server_port> <interval_ms> <duration_seconds>", sample_name);
-    fprintf(stderr, "or :\n");
-    fprintf(stderr, "    %s [-r] [-p port]", sample_name);
-    fprintf(stderr, "use -r to request real time enhancements from the OS.");
-    fprintf(stderr, "use -p to set the local source port number.");
-    fprintf(stderr, "use -o to sdirect output to file instead of stdout.");
-    exit(1);
+    uint64_t x = 0;
+    for (int i = 0; i < 8; i++) {
+        x *= 256;
+        x += buffer[i];
+    }
+    return x;
 }
 
-int parse_options(octoping_options_t * options, int argc, char** argv)
+void marshall_64(uint8_t* buffer, uint64_t x)
+{
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = (uint8_t)((x >> (8 * (7 - i))) & 0xff);
+    }
+}
+
+void network_error()
+{
+    int err = 0;
+#ifdef _WINDOWS
+    err = WSAGetLastError();
+#else
+    err = errno;
+#endif
+    printf("Network error: %d (0x%x)\n", err, err);
+}
+
+#ifdef OCTOPING_HAS_TIMESTAMPING
+/*
+ * Request software timestamps from the kernel. Receive timestamps
+ * are delivered as SCM_TIMESTAMPING control messages. If tx is set,
+ * transmit timestamps are also requested. They are queued on the
+ * error queue of the socket, identified by a key that starts at 0
+ * and is incremented for each packet sent.
+ */
+int octoping_enable_timestamps(SOCKET_TYPE s, int tx)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    int ret;
+
+    if (tx) {
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+    ret = setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+    if (ret != 0) {
+        network_error();
+        printf("Cannot enable SO_TIMESTAMPING\n");
+    }
+    return ret;
+}
+
+/*
+ * Find the software timestamp in the control messages, or
+ * return 0 if there is none.
+ */
+uint64_t octoping_get_timestamp(struct msghdr* msg)
+{
+    uint64_t ts_ns = 0;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct timespec ts[3];
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+            ts_ns = ((uint64_t)ts[0].tv_sec) * 1000000000ull + (uint64_t)ts[0].tv_nsec;
+        }
+    }
+    return ts_ns;
+}
+
+/*
+ * Receive a packet and its kernel timestamp. If the kernel did not
+ * provide a timestamp, *rx_ns is set to 0.
+ */
+int octoping_recv_timestamped(SOCKET_TYPE s, uint8_t* buffer, size_t buffer_size, int flags,
+    struct sockaddr_in* addr_from, uint64_t* rx_ns)
+{
+    struct msghdr msg = { 0 };
+    struct iovec iov;
+    uint8_t control[OCTOPING_CONTROL_MAX];
+    int l;
+
+    iov.iov_base = buffer;
+    iov.iov_len = buffer_size;
+    msg.msg_name = addr_from;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    OCTOPING_COUNT_SYSCALL();
+    l = (int)recvmsg(s, &msg, flags);
+    *rx_ns = (l >= 0) ? octoping_get_timestamp(&msg) : 0;
+    return l;
+}
+#endif
+
+#ifdef OCTOPING_HAS_RXQ_OVFL
+/*
+ * Update the count of kernel drops if the control messages carry it.
+ * The kernel reports the number of drops since the socket was opened.
+ */
+void octoping_get_drops(struct msghdr* msg, uint64_t* drops)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t nb_drops;
+            memcpy(&nb_drops, CMSG_DATA(cmsg), sizeof(nb_drops));
+            OCTOPING_COUNTER_SET(*drops, nb_drops);
+        }
+    }
+}
+#endif
+
+/*
+ * Stamp a probe with the server time, and return the length of the
+ * echo. Probes marked with OCTOPING_NS_MAGIC or OCTOPING_V2_MAGIC are
+ * stamped in nanoseconds, other probes in microseconds. The whole probe
+ * is echoed, extended to 24 bytes if it is shorter.
+ */
+static int octoping_is_v2(uint8_t* buffer, int l)
+{
+    return l >= OCTOPING_V2_HEADER && buffer[32] == 2 && parse_64(buffer + 24) == OCTOPING_V2_MAGIC;
+}
+
+int octoping_server_stamp(uint8_t* buffer, int l, uint64_t rx_ns)
+{
+    if (octoping_is_v2(buffer, l)) {
+        marshall_64(buffer + 16, rx_ns);
+        buffer[33] |= OCTOPING_V2_RX;
+    }
+    else if (l >= 32 && parse_64(buffer + 24) == OCTOPING_NS_MAGIC) {
+        marshall_64(buffer + 16, rx_ns);
+    }
+    else {
+        marshall_64(buffer + 16, rx_ns / 1000);
+    }
+    return (l > 24) ? l : 24;
+}
+
+/*
+ * Stamp a version 2 echo with the server transmit time, read just before
+ * the echo is passed to the kernel. Other echoes are not changed.
+ */
+void octoping_server_stamp_tx(uint8_t* buffer, int l, uint64_t tx_ns)
+{
+    if (octoping_is_v2(buffer, l)) {
+        marshall_64(buffer + 40, tx_ns);
+        buffer[33] |= OCTOPING_V2_TX;
+    }
+}
+
+static volatile sig_atomic_t octoping_server_stop = 0;
+
+static void octoping_server_signal(int sig)
+{
+    (void)sig;
+    octoping_server_stop = 1;
+}
+
+/* Stop a server running in another thread, e.g., in the benchmark */
+void octoping_server_request_stop()
+{
+    octoping_server_stop = 1;
+}
+
+int octoping_server_is_stopping()
+{
+    return octoping_server_stop;
+}
+
+static volatile sig_atomic_t octoping_client_stop = 0;
+
+static void octoping_client_signal(int sig)
+{
+    (void)sig;
+    octoping_client_stop = 1;
+}
+
+void octoping_client_catch_signals()
+{
+    octoping_client_stop = 0;
+    (void)signal(SIGINT, octoping_client_signal);
+    (void)signal(SIGTERM, octoping_client_signal);
+}
+
+/* Once a continuous run is interrupted, stop sending and wait for the last echoes */
+void octoping_client_check_stop(uint64_t current_time, uint64_t* end_send_time, uint64_t* end_recv_time)
+{
+    if (octoping_client_stop && *end_send_time > current_time) {
+        *end_send_time = current_time;
+        *end_recv_time = current_time + OCTOPING_CLIENT_LINGER;
+    }
+}
+
+/*
+ * Socket calls return timeout errors every OCTOPING_SERVER_TIMEOUT_MS,
+ * so that the workers can notice the stop request.
+ */
+int octoping_is_timeout_error()
+{
+#ifdef _WINDOWS
+    int err = WSAGetLastError();
+    return (err == WSAETIMEDOUT || err == WSAEINTR);
+#else
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+#endif
+}
+
+SOCKET_TYPE octoping_server_socket(int server_port, int reuse_port)
+{
+    SOCKET_TYPE s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (s != INVALID_SOCKET) {
+        int ret = 0;
+        struct sockaddr_in addr4 = { 0 };
+#ifdef _WINDOWS
+        DWORD timeout = OCTOPING_SERVER_TIMEOUT_MS;
+#else
+        struct timeval timeout = { 0 };
+        timeout.tv_sec = OCTOPING_SERVER_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (OCTOPING_SERVER_TIMEOUT_MS % 1000) * 1000;
+#endif
+        if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout)) != 0) {
+            network_error();
+            printf("Cannot set the receive timeout\n");
+            ret = -1;
+        }
+#ifdef SO_REUSEPORT
+        if (ret == 0 && reuse_port) {
+            int one = 1;
+            ret = setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (char*)&one, sizeof(one));
+            if (ret != 0) {
+                network_error();
+                printf("Cannot set SO_REUSEPORT\n");
+            }
+        }
+#else
+        (void)reuse_port;
+#endif
+#ifdef OCTOPING_HAS_RXQ_OVFL
+        if (ret == 0) {
+            int one = 1;
+            if (setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, (char*)&one, sizeof(one)) != 0) {
+                /* Not fatal, the drops will not be counted */
+                network_error();
+                printf("Cannot set SO_RXQ_OVFL\n");
+            }
+        }
+#endif
+        if (ret == 0) {
+            addr4.sin_family = AF_INET;
+            addr4.sin_port = htons((unsigned short)server_port);
+            ret = bind(s, (struct sockaddr*)&addr4, sizeof(addr4));
+            if (ret != 0) {
+                printf("Bind returns %d\n", ret);
+            }
+        }
+        if (ret != 0) {
+            SOCKET_CLOSE(s);
+            s = INVALID_SOCKET;
+        }
+    }
+
+    return s;
+}
+
+/*
+ * Count a received packet, and the client that sent it.
+ */
+void octoping_server_count_rx(octoping_server_worker_t* worker, struct sockaddr_in const* addr_from, int l)
+{
+    OCTOPING_COUNTER_ADD(worker->counters.rx_packets, 1);
+    OCTOPING_COUNTER_ADD(worker->counters.rx_bytes, (uint64_t)l);
+    if (l < 16) {
+        OCTOPING_COUNTER_ADD(worker->counters.short_packets, 1);
+    }
+    if (worker->top != NULL) {
+        octoping_top_add(worker->top, addr_from);
+    }
+}
+
+/*
+ * Check the rate of the source, if the server limits it. The probes over
+ * the limit are counted, and not echoed.
+ */
+int octoping_server_admit(octoping_server_worker_t* worker, struct sockaddr_in const* addr_from, uint64_t current_time)
+{
+    if (worker->limit == NULL || octoping_limit_admit(worker->limit, addr_from->sin_addr.s_addr, current_time)) {
+        return 1;
+    }
+    OCTOPING_COUNTER_ADD(worker->counters.limited, 1);
+    return 0;
+}
+
+int octoping_server_loop(octoping_server_worker_t * worker)
 {
     int ret = 0;
-    int option_index = 1;
+    uint8_t buffer[OCTOPING_PACKET_MAX];
+    struct sockaddr_in addr4 = { 0 };
 
-    memset(options, 0, sizeof(octoping_options_t));
+    while (ret == 0 && !octoping_server_stop) {
+        uint64_t rx_ns = 0;
+        int l;
+#if defined(OCTOPING_HAS_TIMESTAMPING) || defined(OCTOPING_HAS_RXQ_OVFL)
+        struct msghdr msg = { 0 };
+        struct iovec iov;
+        uint8_t control[OCTOPING_CONTROL_MAX];
 
-    /* first parse the optional values. */
-    while (option_index < argc && ret == 0) {
-        char const* option_value = argv[option_index];
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer);
+        msg.msg_name = &addr4;
+        msg.msg_namelen = sizeof(addr4);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
 
-        if (strcmp(option_value, "-r") == 0) {
-            options->real_time = 1;
-            option_index++;
+        OCTOPING_COUNT_SYSCALL();
+        l = (int)recvmsg(worker->s, &msg, 0);
+        if (l >= 0) {
+#ifdef OCTOPING_HAS_TIMESTAMPING
+            rx_ns = octoping_get_timestamp(&msg);
+#endif
+#ifdef OCTOPING_HAS_RXQ_OVFL
+            octoping_get_drops(&msg, &worker->counters.rx_drops);
+#endif
         }
-        else if (strcmp(option_value, "-p") == 0) {
-            option_index++;
-            if (option_index >= argc) {
-                fprintf(stderr, "Port value not set");
+#else
+        SOCKLEN_T from_len = (SOCKLEN_T) sizeof(addr4);
+
+        OCTOPING_COUNT_SYSCALL();
+        l = recvfrom(worker->s, (char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&addr4, &from_len);
+#endif
+        if (l < 0) {
+            if (!octoping_is_timeout_error()) {
+                network_error();
+                printf("Recvfrom returns %d\n", l);
                 ret = -1;
             }
-            else {
-                int source_port = atoi(argv[option_index]);
-                if (source_port < 0 || source_port > 0xffff) {
-                    fprintf(stderr, "Invalid source port: %s\n", argv[option_index]);
-                    ret = -1;
+        }
+        else {
+            OCTOPING_COUNTER_ADD(worker->counters.rx_calls, 1);
+            octoping_server_count_rx(worker, &addr4, l);
+            if (l >= 16 && rx_ns == 0) {
+                rx_ns = current_time_ns();
+            }
+            if (l >= 16 && octoping_server_admit(worker, &addr4, rx_ns)) {
+                l = octoping_server_stamp(buffer, l, rx_ns);
+                octoping_server_stamp_tx(buffer, l, current_time_ns());
+                OCTOPING_COUNT_SYSCALL();
+                l = sendto(worker->s, (char*)buffer, l, 0, (const struct sockaddr*)&addr4, sizeof(addr4));
+                /* A failed echo is counted, but does not stop the server */
+                if (l < 0) {
+                    OCTOPING_COUNTER_ADD(worker->counters.send_errors, 1);
                 }
                 else {
-                    options->source_port = (uint16_t)source_port;
-                    option_index++;
+                    OCTOPING_COUNTER_ADD(worker->counters.tx_packets, 1);
+                    OCTOPING_COUNTER_ADD(worker->counters.tx_bytes, (uint64_t)l);
                 }
             }
         }
-        else if (strcmp(option_value, "-f") == 0) {
-            option_index++;
-            if (option_index >= argc) {
-                fprintf(stderr, "Port value not set");
-                ret = -1;
+    }
+
+    return ret;
+}
+
+#ifdef OCTOPING_HAS_MMSG
+/*
+ * Batched echo loop. Each call to recvmmsg returns between 1 and
+ * batch_size packets. All packets in the batch were received before
+ * the call returned, so they are all stamped with the same time, read
+ * once after the call, unless kernel timestamps are available. The
+ * echoes are then sent with a single call to sendmmsg, each to the
+ * address from which the packet came. The kernel drop count is read from
+ * the last packet of the batch.
+ */
+int octoping_server_batch(octoping_server_worker_t * worker)
+{
+    int ret = 0;
+    int batch_size = worker->batch_size;
+    uint8_t* buffers = (uint8_t*)malloc((size_t)batch_size * OCTOPING_PACKET_MAX);
+    struct mmsghdr* rx_msg = (struct mmsghdr*)calloc((size_t)batch_size, sizeof(struct mmsghdr));
+    struct mmsghdr* tx_msg = (struct mmsghdr*)calloc((size_t)batch_size, sizeof(struct mmsghdr));
+    struct iovec* rx_iov = (struct iovec*)calloc((size_t)batch_size, sizeof(struct iovec));
+    struct iovec* tx_iov = (struct iovec*)calloc((size_t)batch_size, sizeof(struct iovec));
+    struct sockaddr_in* addr_from = (struct sockaddr_in*)calloc((size_t)batch_size, sizeof(struct sockaddr_in));
+    size_t control_size = OCTOPING_CONTROL_MAX;
+    uint8_t* controls = (uint8_t*)malloc((size_t)batch_size * control_size);
+
+    if (buffers == NULL || rx_msg == NULL || tx_msg == NULL || rx_iov == NULL || tx_iov == NULL || addr_from == NULL ||
+        controls == NULL) {
+        printf("Cannot allocate buffers for batch size %d\n", batch_size);
+        ret = -1;
+    }
+    else {
+        while (ret == 0 && !octoping_server_stop) {
+            int nb_rx;
+            int nb_tx = 0;
+            int nb_sent = 0;
+            uint64_t tx_bytes = 0;
+            uint64_t now;
+
+            for (int i = 0; i < batch_size; i++) {
+                rx_iov[i].iov_base = buffers + (size_t)i * OCTOPING_PACKET_MAX;
+                rx_iov[i].iov_len = OCTOPING_PACKET_MAX;
+                rx_msg[i].msg_hdr.msg_iov = &rx_iov[i];
+                rx_msg[i].msg_hdr.msg_iovlen = 1;
+                rx_msg[i].msg_hdr.msg_name = &addr_from[i];
+                rx_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                rx_msg[i].msg_hdr.msg_control = controls + (size_t)i * control_size;
+                rx_msg[i].msg_hdr.msg_controllen = control_size;
+                rx_msg[i].msg_hdr.msg_flags = 0;
             }
-            else {
-                options->file_name = argv[option_index];
-                option_index++;
+
+            OCTOPING_COUNT_SYSCALL();
+            nb_rx = recvmmsg(worker->s, rx_msg, (unsigned int)batch_size, MSG_WAITFORONE, NULL);
+            if (nb_rx < 0) {
+                if (!octoping_is_timeout_error()) {
+                    network_error();
+                    printf("Recvmmsg returns %d\n", nb_rx);
+                    ret = -1;
+                }
+                continue;
+            }
+            now = current_time_ns();
+            OCTOPING_COUNTER_ADD(worker->counters.rx_calls, 1);
+#ifdef OCTOPING_HAS_RXQ_OVFL
+            if (nb_rx > 0) {
+                octoping_get_drops(&rx_msg[nb_rx - 1].msg_hdr, &worker->counters.rx_drops);
+            }
+#endif
+
+            for (int i = 0; i < nb_rx; i++) {
+                octoping_server_count_rx(worker, &addr_from[i], (int)rx_msg[i].msg_len);
+                if (rx_msg[i].msg_len >= 16 && octoping_server_admit(worker, &addr_from[i], now)) {
+                    uint8_t* buffer = (uint8_t*)rx_iov[i].iov_base;
+                    uint64_t rx_ns = 0;
+#ifdef OCTOPING_HAS_TIMESTAMPING
+                    rx_ns = octoping_get_timestamp(&rx_msg[i].msg_hdr);
+#endif
+                    tx_iov[nb_tx].iov_base = buffer;
+                    tx_iov[nb_tx].iov_len = octoping_server_stamp(buffer, (int)rx_msg[i].msg_len, (rx_ns == 0) ? now : rx_ns);
+                    memset(&tx_msg[nb_tx].msg_hdr, 0, sizeof(struct msghdr));
+                    tx_msg[nb_tx].msg_hdr.msg_iov = &tx_iov[nb_tx];
+                    tx_msg[nb_tx].msg_hdr.msg_iovlen = 1;
+                    tx_msg[nb_tx].msg_hdr.msg_name = &addr_from[i];
+                    tx_msg[nb_tx].msg_hdr.msg_namelen = rx_msg[i].msg_hdr.msg_namelen;
+                    nb_tx++;
+                }
             }
-        } else {
-            /* end of optional parameters */
-            break;
+
+            if (nb_tx > 0) {
+                uint64_t tx_ns = current_time_ns();
+
+                for (int i = 0; i < nb_tx; i++) {
+                    octoping_server_stamp_tx((uint8_t*)tx_iov[i].iov_base, (int)tx_iov[i].iov_len, tx_ns);
+                }
+            }
+            /* sendmmsg may send fewer messages than requested, so loop until done. */
+            while (nb_sent < nb_tx) {
+                int l;
+
+                OCTOPING_COUNT_SYSCALL();
+                l = sendmmsg(worker->s, tx_msg + nb_sent, (unsigned int)(nb_tx - nb_sent), 0);
+                if (l <= 0) {
+                    /* The message at nb_sent failed, skip it and send the others */
+                    OCTOPING_COUNTER_ADD(worker->counters.send_errors, 1);
+                    nb_sent++;
+                }
+                else {
+                    for (int i = nb_sent; i < nb_sent + l; i++) {
+                        tx_bytes += tx_iov[i].iov_len;
+                    }
+                    OCTOPING_COUNTER_ADD(worker->counters.tx_packets, (uint64_t)l);
+                    nb_sent += l;
+                }
+            }
+            OCTOPING_COUNTER_ADD(worker->counters.tx_bytes, tx_bytes);
         }
     }
-    if (ret == 0) {
-        if (option_index >= argc) {
-            options->is_server = 1;
-        }
-        else if (option_index + 4 != argc) {
-            fprintf(stderr, "Invalid client specification\n");
+
+    free(buffers);
+    free(rx_msg);
+    free(tx_msg);
+    free(rx_iov);
+    free(tx_iov);
+    free(addr_from);
+    free(controls);
+
+    return ret;
+}
+#endif
+
+int octoping_server_worker(octoping_server_worker_t * worker)
+{
+    if (worker->cpu >= 0 && octoping_realtime_pin(worker->cpu) != 0) {
+        printf("Worker %d cannot be pinned to CPU %d\n", worker->worker_id, worker->cpu);
+    }
+#ifdef OCTOPING_HAS_URING
+    if (worker->engine == octoping_engine_uring) {
+        worker->ret = octoping_server_uring(worker);
+    }
+    else
+#endif
+#ifdef OCTOPING_HAS_MMSG
+    if (worker->batch_size > 1) {
+        worker->ret = octoping_server_batch(worker);
+    }
+    else
+#endif
+    {
+        worker->ret = octoping_server_loop(worker);
+    }
+    if (worker->ret != 0) {
+        /* An error in one worker stops the whole server */
+        octoping_server_stop = 1;
+    }
+    return worker->ret;
+}
+
+#ifndef _WINDOWS
+static void* octoping_server_thread(void* arg)
+{
+    (void)octoping_server_worker((octoping_server_worker_t*)arg);
+    return NULL;
+}
+#endif
+
+int octoping_server(octoping_options_t * options)
+{
+    int ret = 0;
+    int server_port = options->source_port;
+    int nb_workers = (options->nb_workers > 1) ? options->nb_workers : 1;
+    int nb_started = 0;
+    uint64_t total_received = 0;
+    octoping_server_worker_t* workers = NULL;
+
+    if (server_port == 0) {
+        server_port = OCTOPING_PORT;
+    }
+
+#ifdef _WINDOWS
+    if (nb_workers > 1) {
+        printf("Multiple workers are not supported on this platform, using a single worker.\n");
+        nb_workers = 1;
+    }
+#endif
+#ifndef OCTOPING_HAS_TIMESTAMPING
+    if (options->timestamps) {
+        printf("Kernel timestamps are not supported on this platform, using the system clock.\n");
+    }
+#endif
+#ifndef OCTOPING_HAS_MMSG
+    if (options->batch_size > 1) {
+        printf("Batched echo is not supported on this platform, using single packet echo.\n");
+    }
+#endif
+#ifndef OCTOPING_HAS_URING
+    if (options->engine == octoping_engine_uring) {
+        printf("The io_uring engine is not supported on this platform, using sockets.\n");
+    }
+#endif
+
+    workers = (octoping_server_worker_t*)calloc((size_t)nb_workers, sizeof(octoping_server_worker_t));
+    if (workers == NULL) {
+        printf("Cannot allocate %d workers\n", nb_workers);
+        return -1;
+    }
+    for (int i = 0; i < nb_workers; i++) {
+        workers[i].s = INVALID_SOCKET;
+    }
+
+    for (int i = 0; ret == 0 && i < nb_workers; i++) {
+        workers[i].worker_id = i;
+        workers[i].cpu = (options->first_cpu >= 0) ? options->first_cpu + i : -1;
+        workers[i].batch_size = options->batch_size;
+        workers[i].engine = options->engine;
+        workers[i].s = octoping_server_socket(server_port, nb_workers > 1);
+        if (workers[i].s == INVALID_SOCKET) {
             ret = -1;
         }
-        else {
-            int server_port = atoi(argv[option_index + 1]);
-            int interval_ms = atoi(argv[option_index + 2]);
-            int seconds = atoi(argv[option_index + 3]);
-            uint64_t interval_us = 0;
-            uint64_t duration = 0;
-
-            if (server_port < 0 || server_port > 0xffff) {
-                fprintf(stderr, "Invalid server port: %s\n", argv[option_index + 1]);
+        else if (options->real_time) {
+            octoping_realtime_socket(workers[i].s);
+        }
+#ifdef OCTOPING_HAS_TIMESTAMPING
+        if (ret == 0 && options->timestamps) {
+            ret = octoping_enable_timestamps(workers[i].s, 0);
+            workers[i].timestamps = (ret == 0);
+        }
+#endif
+        if (ret == 0 && options->limit_interval_ns > 0) {
+            workers[i].limit = octoping_limit_create(options->limit_interval_ns, options->limit_burst);
+            if (workers[i].limit == NULL) {
+                printf("Cannot allocate the rate limits of worker %d\n", i);
                 ret = -1;
             }
-            if (interval_ms <= 0) {
-                printf("Invalid interval in milliseconds: %s\n", argv[option_index + 2]);
+        }
+#ifndef _WINDOWS
+        if (ret == 0) {
+            workers[i].top = (octoping_top_t*)calloc(1, sizeof(octoping_top_t));
+            if (workers[i].top == NULL) {
+                printf("Cannot allocate the client table of worker %d\n", i);
                 ret = -1;
-            } else if (seconds <= 0) {
-                printf("Invalid duration in seconds: %s\n", argv[option_index + 3]);
+            }
+        }
+#endif
+    }
+
+    if (ret == 0) {
+        octoping_server_stop = 0;
+        (void)signal(SIGINT, octoping_server_signal);
+        (void)signal(SIGTERM, octoping_server_signal);
+
+        printf("Octoping waiting for packets on port: %d", server_port);
+        if (nb_workers > 1) {
+            printf(", %d workers", nb_workers);
+        }
+        if (options->engine == octoping_engine_uring) {
+            printf(", io_uring engine");
+        }
+        else if (options->batch_size > 1) {
+            printf(", up to %d packets per system call", options->batch_size);
+        }
+        if (options->limit_interval_ns > 0) {
+            printf(", %.0f pps per source", 1000000000.0 / (double)options->limit_interval_ns);
+        }
+        printf("\n");
+        fflush(stdout);
+
+#ifdef _WINDOWS
+        ret = octoping_server_worker(&workers[0]);
+        nb_started = 1;
+#else
+        /* The workers run in their own threads, the main thread runs the monitor */
+        for (; nb_started < nb_workers; nb_started++) {
+            if (pthread_create(&workers[nb_started].thread, NULL, octoping_server_thread, &workers[nb_started]) != 0) {
+                printf("Cannot start worker %d\n", nb_started);
+                octoping_server_stop = 1;
                 ret = -1;
+                break;
             }
-            else {
-                options->server_name = argv[option_index];
-                options->server_port = (uint16_t)server_port;
-                options->interval_us = ((uint64_t)interval_ms) * 1000;
-                options->duration_us = ((uint64_t)seconds) * 1000000;
+        }
+        if (octoping_server_monitor(options, workers, nb_started) != 0) {
+            octoping_server_stop = 1;
+            ret = -1;
+        }
+        for (int i = 0; i < nb_started; i++) {
+            (void)pthread_join(workers[i].thread, NULL);
+            if (workers[i].ret != 0) {
+                ret = workers[i].ret;
             }
         }
+#endif
+    }
+
+    for (int i = 0; i < nb_started; i++) {
+        total_received += workers[i].counters.rx_packets;
+    }
+    for (int i = 0; i < nb_started; i++) {
+        octoping_server_counters_t const* counters = &workers[i].counters;
+
+        printf("Worker %d", i);
+        if (workers[i].cpu >= 0) {
+            printf(" (cpu %d)", workers[i].cpu);
+        }
+        printf(": %" PRIu64 " packets received, %" PRIu64 " echoed, %.1f%% of total",
+            counters->rx_packets, counters->tx_packets,
+            (total_received > 0) ? (100.0 * (double)counters->rx_packets) / (double)total_received : 0.0);
+        if (counters->short_packets > 0 || counters->send_errors > 0 || counters->rx_drops > 0) {
+            printf(", %" PRIu64 " short, %" PRIu64 " send errors, %" PRIu64 " kernel drops",
+                counters->short_packets, counters->send_errors, counters->rx_drops);
+        }
+        if (counters->limited > 0) {
+            printf(", %" PRIu64 " over the rate limit", counters->limited);
+        }
+        printf("\n");
     }
 
+    for (int i = 0; i < nb_workers; i++) {
+        if (workers[i].s != INVALID_SOCKET) {
+            SOCKET_CLOSE(workers[i].s);
+        }
+        free(workers[i].top);
+        free(workers[i].limit);
+    }
+    free(workers);
+
     return ret;
 }
 
-int get_port(char const* sample_name, char const* port_arg)
+/*
+ * Open the output file, or return stdout if no file name is specified.
+ */
+FILE* octoping_open_file(char const* file_name, char const* mode)
 {
-    int server_port = atoi(port_arg);
-    if (server_port <= 0) {
-        fprintf(stderr, "Invalid port: %s\n", port_arg);
-        usage(sample_name);
+    FILE* F = NULL;
+#ifdef _WINDOWS
+    errno_t err = fopen_s(&F, file_name, mode);
+    if (err != 0) {
+        if (F != NULL) {
+            fclose(F);
+            F = NULL;
+        }
     }
+#else
+    F = fopen(file_name, mode);
+#endif
+    if (F == NULL) {
+        printf("Cannot open %s\n", file_name);
+    }
+    return F;
+}
 
-    return server_port;
+FILE* octoping_open_output(char const* file_name)
+{
+    return (file_name == NULL) ? stdout : octoping_open_file(file_name, "wt");
 }
 
-uint64_t parse_64(uint8_t* buffer)
+/*
+ * Socket I/O of the client loop, with the system clock.
+ */
+static uint64_t octoping_socket_now(void* io_ctx)
 {
-    uint64_t x = 0;
-    for (int i = 0; i < 8; i++) {
-        x *= 256;
-        x += buffer[i];
-    }
-    return x;
+    (void)io_ctx;
+    return current_time_ns();
 }
 
-void marshall_64(uint8_t* buffer, uint64_t x)
+static int octoping_socket_wait(void* io_ctx, uint64_t current_time, uint64_t wake_time)
 {
-    for (int i = 0; i < 8; i++) {
-        buffer[i] = (uint8_t)((x >> (8 * (7 - i))) & 0xff);
-    }
+    octoping_socket_io_t* socket_io = (octoping_socket_io_t*)io_ctx;
+
+    return octoping_wait_readable(socket_io->s, socket_io->tfd, current_time, wake_time);
 }
 
-void network_error()
+static int octoping_socket_send(void* io_ctx, octoping_session_t* session, uint8_t const* buffer, int length)
 {
-    int err = 0;
-#ifdef _WINDOWS
-    err = WSAGetLastError();
-#else
-    err = errno;
-#endif
-    printf("Network error: %d (0x%x)\n", err, err);
+    (void)io_ctx;
+    return octoping_session_transmit(session, buffer, length);
 }
 
-int octoping_server(int server_port)
+static int octoping_socket_recv(void* io_ctx, octoping_session_t* session, uint8_t* buffer, size_t buffer_size,
+    int* length, uint64_t* rx_at)
 {
-    int ret = 0;
-	uint8_t buffer[512];
-    SOCKET_TYPE s = INVALID_SOCKET;
-    struct sockaddr_in addr4 = { 0 };
+    (void)io_ctx;
+    return octoping_session_recv(session, buffer, buffer_size, OCTOPING_DONTWAIT, length, rx_at);
+}
 
-    if (server_port == 0) {
-        server_port = OCTOPING_PORT;
-    }
+void octoping_socket_io_init(octoping_io_t* io, octoping_socket_io_t* socket_io)
+{
+    memset(io, 0, sizeof(octoping_io_t));
+    io->io_ctx = socket_io;
+    io->now = octoping_socket_now;
+    io->wait = octoping_socket_wait;
+    io->send = octoping_socket_send;
+    io->recv = octoping_socket_recv;
+}
 
-    s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (s == INVALID_SOCKET) {
-        ret = -1;
-    }
-    else {
-        addr4.sin_family = AF_INET;
-        addr4.sin_port = htons((unsigned short)server_port);
-        ret = bind(s, (struct sockaddr*)&addr4, sizeof(addr4));
-        if (ret != 0) {
-            printf("Bind returns %d\n", ret);
+/*
+ * Probe loop of a single target. Stops early once all the probes are
+ * echoed or reported lost. In virtual time, the progress is not shown.
+ */
+int octoping_client_loop(octoping_options_t const* options, octoping_session_t* session, octoping_output_t* output,
+    octoping_io_t const* io, uint64_t end_send_time, uint64_t end_recv_time)
+{
+    int ret = 0;
+    uint64_t t = io->now(io->io_ctx);
+    uint64_t r_t = session->start_time + 1000000000ull;
+    int is_sending = 1;
+    uint8_t buffer[OCTOPING_PACKET_MAX];
+
+    while (ret == 0 && t < end_recv_time &&
+        (is_sending || octoping_tracker_nb_pending(&session->tracker) > 0)) {
+        octoping_client_check_stop(t, &end_send_time, &end_recv_time);
+        if (t >= r_t) {
+            if (options->file_name != NULL && options->duration_us > 0 && !io->is_virtual) {
+                printf(".");
+                fflush(stdout);
+            }
+            if (octoping_output_periodic(output, t) != 0) {
+                ret = -1;
+            }
+            r_t += 1000000000ull;
         }
-        if (ret == 0) {
-            printf("Octoping waiting for packets on port: %d\n", server_port);
+        if (is_sending && t >= session->pacer.next_time) {
+            /* Send the whole burst back to back */
+            do {
+                int l = octoping_session_prepare(session, t, buffer, output);
+
+                ret = (l < 0) ? -1 : io->send(io->io_ctx, session, buffer, l);
+                octoping_pacer_on_send(&session->pacer, t);
+                t = io->now(io->io_ctx);
+            } while (ret == 0 && session->pacer.burst_sent != 0);
+            if (session->pacer.next_time > end_send_time) {
+                is_sending = 0;
+            }
         }
-        while (ret == 0) {
-            SOCKLEN_T from_len = (SOCKLEN_T) sizeof(addr4);
-            int l = recvfrom(s, (char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&addr4, &from_len);
-            if (l < 0) {
-                network_error();
-                printf("Recvfrom returns %d\n", l);
-                ret = -1;
+        else {
+            uint64_t wake_time = (is_sending) ? session->pacer.next_time : end_recv_time;
+            int readable = 1;
+
+            if (wake_time > t + options->spin_ns) {
+                readable = io->wait(io->io_ctx, t, wake_time - options->spin_ns);
+                if (readable < 0) {
+                    ret = -1;
+                }
             }
-            else if (l >= 16) {
-                marshall_64(buffer + 16, current_time());
-                l = sendto(s, (char*)buffer, 24, 0,(const struct sockaddr*) &addr4, sizeof(addr4));
-                if (l < 0) {
-                    network_error();
-                    printf("Sendto returns %d\n", l);
+            if (readable > 0) {
+                uint64_t rx_at = 0;
+                int l = 0;
+                int r = io->recv(io->io_ctx, session, buffer, sizeof(buffer), &l, &rx_at);
+
+                if (r < 0 || (r > 0 && octoping_session_process(session, buffer, l, rx_at, io->now(io->io_ctx), output) != 0)) {
+                    printf("Error while processing echo on %s\n",
+                        (options->file_name == NULL) ? "stdout" : options->file_name);
                     ret = -1;
                 }
             }
         }
-        SOCKET_CLOSE(s);
+        t = io->now(io->io_ctx);
     }
-
     return ret;
 }
 
 int octoping_client(octoping_options_t * options)
 {
     int ret = 0;
-    uint8_t buffer[512];
+    char buffer[INET_ADDRSTRLEN];
     SOCKET_TYPE s = INVALID_SOCKET;
     struct sockaddr_in addr_to;
-    struct sockaddr_in addr_from;
-    FILE* F = NULL;
-    int nb_pending = 0;
-#define NUMBER_RANGE 1024
-    uint64_t pending[NUMBER_RANGE];
-    uint64_t basis = 0;
-    uint64_t seqnum = 0;
-    int64_t phase = INT64_MAX;
-
-    memset(pending, 0, sizeof(pending));
+    octoping_output_t output;
+    octoping_session_t* session = NULL;
+
     memset(&addr_to, 0, sizeof(addr_to));
+    memset(&output, 0, sizeof(output));
+#ifndef OCTOPING_HAS_URING
+    if (options->engine == octoping_engine_uring) {
+        printf("The io_uring engine is not supported on this platform, using sockets.\n");
+    }
+#endif
 
     if (inet_pton(AF_INET, options->server_name, &addr_to.sin_addr) != 1){
         printf("%s is not a valid IPv4 address\n", options->server_name);
         ret = -1;
     }
+    else if ((session = (octoping_session_t*)malloc(sizeof(octoping_session_t))) == NULL) {
+        printf("Cannot allocate the session\n");
+        ret = -1;
+    }
     else {
         /* Valid IPv4 address */
-        uint16_t source_port = (options->source_port == 0) ? OCTOPING_PORT : options->source_port;
         addr_to.sin_family = AF_INET;
-        addr_to.sin_port = htons(source_port);
+        addr_to.sin_port = htons((options->server_port == 0) ? OCTOPING_PORT : options->server_port);
 
-        printf("Will send packets to: %s\n", inet_ntop(AF_INET, &addr_to.sin_addr, (char*)buffer, sizeof(buffer)));
+        printf("Will send packets to: %s\n", inet_ntop(AF_INET, &addr_to.sin_addr, buffer, sizeof(buffer)));
 
         s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
         if (s == INVALID_SOCKET) {
             ret = -1;
         }
         else {
-            if (options->file_name == NULL) {
-                F = stdout;
-            }
-            else {
-#ifdef _WINDOWS
-                errno_t err = fopen_s(&F, options->file_name, "wt");
-                if (err != 0) {
-                    if (F != NULL) {
-                        fclose(F);
-                        F = NULL;
-                    }
+            if (options->source_port != 0) {
+                struct sockaddr_in addr_from;
+
+                memset(&addr_from, 0, sizeof(addr_from));
+                addr_from.sin_family = AF_INET;
+                addr_from.sin_port = htons(options->source_port);
+                if (bind(s, (struct sockaddr*)&addr_from, sizeof(addr_from)) != 0) {
+                    network_error();
+                    printf("Cannot bind the client socket to port %d\n", options->source_port);
+                    ret = -1;
                 }
+            }
+            if (options->real_time) {
+                octoping_realtime_socket(s);
+            }
+#ifdef OCTOPING_HAS_TIMESTAMPING
+            if (ret == 0 && options->timestamps && octoping_enable_timestamps(s, 1) != 0) {
+                ret = -1;
+            }
 #else
-                F = fopen(file_name, "wt");
+            if (options->timestamps) {
+                printf("Kernel timestamps are not supported on this platform, using the system clock.\n");
+            }
 #endif
-                if (F == NULL) {
-                    printf("Cannot open %s\n", options->file_name);
-                    ret = -1;
-                }
+            if (ret == 0 && octoping_output_open(&output, options->file_name, options->output_format,
+                options->timestamps, 0, options->nb_sizes > 0, options->summary_interval_ns) != 0) {
+                ret = -1;
             }
+            output.report = options->report;
+            output.flush_interval_ns = options->flush_interval_ns;
+            output.rotate_bytes = options->rotate_bytes;
+            output.rotate_ns = options->rotate_ns;
+            output.with_dwell = (options->wire_version == 2);
             if (ret == 0) {
-                uint64_t start_time = current_time();
-                uint64_t next_send_time = start_time;
-                uint64_t end_send_time = next_send_time + options->duration_us;
-                uint64_t end_recv_time = end_send_time + 3000000;
-                uint64_t t = start_time;
-                uint64_t r_t = t + 1000000;
-                uint64_t min_rtt = UINT64_MAX;
-
-                if (fprintf(F, "number, sent, received, echo, rtt, up_t, down_t, phase\n") <= 0) {
-                    printf("Cannot write first line on %s", options->file_name);
+                uint64_t start_time = current_time_ns();
+                uint64_t end_send_time = (options->duration_us > 0) ? start_time + options->duration_us * 1000 : UINT64_MAX;
+                uint64_t end_recv_time = (options->duration_us > 0) ? end_send_time + OCTOPING_CLIENT_LINGER : UINT64_MAX;
+                octoping_socket_io_t socket_io;
+                octoping_io_t io;
+
+                socket_io.s = s;
+                socket_io.tfd = -1;
+#ifdef __linux__
+                socket_io.tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+#endif
+                octoping_socket_io_init(&io, &socket_io);
+                if (octoping_session_init(session, s, &addr_to, NULL, 0, options->timestamps, start_time) != 0) {
+                    printf("Cannot initialize the session\n");
                     ret = -1;
                 }
-                while (ret == 0 && t < end_recv_time) {
-                    if (t >= r_t) {
-                        if (options->file_name != NULL) {
-                            printf(".");
-                            fflush(stdout);
-                        }
-                        fflush(F);
-                        r_t += 1000000;
-                    }
-                    if (t >= next_send_time) {
-                        int l;
-                        marshall_64(buffer, seqnum);
-                        marshall_64(buffer+8, t);
-                        l = sendto(s, (char*)buffer, 16, 0, (struct sockaddr*)&addr_to, sizeof(addr_to));
-                        if (l <= 0) {
-                            network_error();
-                            printf("Sendto returns %d\n", l);
-
-                            ret = -1;
-                        }
-                        else {
-                            if (seqnum >= basis + NUMBER_RANGE) {
-                                basis = (seqnum / NUMBER_RANGE) * NUMBER_RANGE;
-                            }
-                            if (pending[seqnum - basis] != 0 && seqnum > NUMBER_RANGE) {
-                                uint64_t missing = seqnum - NUMBER_RANGE;
-                                double sent_sec = ((double)(pending[seqnum - basis] - start_time)) / 1000000.0;
-                                (void)fprintf(F, "%"PRIu64",%"PRIi64",0,0,0,0,0,0\n", missing, pending[seqnum - basis] - start_time);
-                            }
-                            pending[seqnum - basis] = t;
-                            seqnum ++;
-
-                            while (next_send_time < t) {
-                                next_send_time += options->interval_us;
-                            }
-                            if (next_send_time > end_send_time) {
-                                next_send_time = end_recv_time;
-                            }
-                        }
-                    }
-                    else {
-                        uint64_t delta_t = next_send_time - t;
-                        fd_set readfds;
-                        struct timeval tv = { 0 };
-                        FD_ZERO(&readfds);
-                        FD_SET(s, &readfds);
-                        int selected;
-
-                        tv.tv_sec = (long)(delta_t / 1000000);
-                        tv.tv_usec = (long)(delta_t % 1000000);
-                        selected = select((int)s + 1, &readfds, NULL, NULL, &tv);
-                        if (selected < 0) {
-                            network_error();
-                            ret = -1;
-                            printf("Error: select returns %d\n", selected);
-                        } else if (selected > 0) {
-                            SOCKLEN_T from_len = (int)sizeof(addr_from);
-                            int l = recvfrom(s, (char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&addr_from, &from_len);
-
-                            if (l < 0) {
-                                network_error();
-                                printf("Error: recvfrom returns %d\n", l);
-                                ret = -1;
-                            } else if (l >= 24){
-                                uint64_t r_seqnum;
-                                uint64_t sent_at;
-                                uint64_t recv_at;
-                                uint64_t middle;
-                                uint64_t echo_at = current_time();
-                                int64_t sent_n = 0;
-                                int64_t recv_n = 0;
-                                int64_t echo_n = 0;
-                                uint64_t rtt = 0;
-                                int64_t up_t = 0;
-                                int64_t down_t = 0;
-
-                                r_seqnum = parse_64(buffer);
-                                sent_at = parse_64(buffer+8);
-                                recv_at = parse_64(buffer+16);
-
-                                if (sent_at < echo_at) {
-                                    rtt = echo_at - sent_at;
-                                    middle = (echo_at + sent_at) / 2;
-                                    if (phase == INT64_MAX) {
-                                        phase = recv_at - middle;
-                                        min_rtt = rtt;
-                                    }
-                                    else {
-                                        if (rtt < min_rtt) {
-                                            min_rtt = rtt;
-                                        }
-                                        if (rtt < (min_rtt + min_rtt / 8)) {
-                                            phase = (7 * phase + recv_at - middle) / 8;
-                                        }
-                                    }
-                                    up_t = (recv_at - phase) - sent_at;
-                                    down_t = rtt - up_t;
-                                    if (up_t < 0 || down_t < 0) {
-                                        phase = recv_at - middle;
-                                        up_t = rtt / 2;
-                                        down_t = rtt - up_t;
-                                    }
-                                }
-                                sent_n = sent_at - start_time;
-                                recv_n = recv_at - start_time;
-                                down_t = echo_at - start_time;
-                                if (r_seqnum >= seqnum) {
-                                    printf("Received number %" PRIu64 " while next number to send is %" PRIu64 "\n",
-                                        r_seqnum, seqnum);
-                                    ret = -1;
-                                }
-                                else if (fprintf(F, "%"PRIu64",%"PRId64",%"PRId64",%"PRId64",%"PRIu64",%"PRId64", %"PRId64", %"PRId64"\n",
-                                    r_seqnum, sent_n, recv_n, echo_n, rtt, up_t, down_t, phase) < 0) {
-                                    printf("write on %s returns error", options->file_name);
-                                    ret = -1;
-                                }
-                                else {
-                                    if (r_seqnum >= basis) {
-                                        pending[r_seqnum - basis] = 0;
-                                    }
-                                    else {
-                                        if (seqnum - r_seqnum <= NUMBER_RANGE) {
-                                            pending[r_seqnum + NUMBER_RANGE - basis] = 0;
-                                        }
-                                    }
-                                }
-                            }
-                        }
+                else {
+                    octoping_session_set_probes(session, options->sizes, options->nb_sizes, options->train_length);
+                    session->wire_v2 = (options->wire_version == 2);
+                    octoping_pacer_init(&session->pacer, start_time, options->interval_ns, options->burst_size);
+                    if (octoping_output_header(&output, options, start_time, session, 1) != 0) {
+                        printf("Cannot write first line on %s", options->file_name);
+                        ret = -1;
                     }
-                    t = current_time();
+                }
+#ifdef OCTOPING_HAS_FEED
+                if (ret == 0 && options->feed_name != NULL &&
+                    (output.feed = octoping_feed_create(options->feed_name, start_time, options->interval_ns, options->timestamps)) == NULL) {
+                    ret = -1;
+                }
+#endif
+                if (options->duration_us == 0) {
+                    octoping_client_catch_signals();
+                }
+#ifdef OCTOPING_HAS_URING
+                if (ret == 0 && options->engine == octoping_engine_uring) {
+                    ret = octoping_client_uring(options, session, &output, end_send_time, end_recv_time);
+                }
+                else
+#endif
+                if (ret == 0) {
+                    ret = octoping_client_loop(options, session, &output, &io, end_send_time, end_recv_time);
                 }
                 printf("\n");
 
-                /* Notice whatever is not yet echoed */
-                for (uint64_t i = 0; ret == 0 && i < NUMBER_RANGE; i++) {
-                    if (pending[i] != 0) {
-                        uint64_t missing = basis + i;
-                        double sent_sec = ((double)(pending[i] - start_time)) / 1000000.0;
-                        if (missing >= seqnum) {
-                            missing -= NUMBER_RANGE;
-                        }
-                        if (fprintf(F, "%"PRIu64",%"PRIi64",0,0,0,0,0, 0\n", missing, pending[i] - start_time) <= 0) {
-                            printf("Cannot report missing packet #%" PRIu64 "\n", missing);
-                            ret = -1;
-                        }
-                    }
+                if (ret == 0) {
+                    ret = octoping_session_report_missing(session, &output);
                 }
+                octoping_session_print_counts(stdout, buffer, &session->tracker);
+                octoping_session_print_clock(stdout, buffer, session);
+                octoping_pacer_print(stdout, buffer, &session->pacer);
+                octoping_session_release(session);
+#ifdef __linux__
+                if (socket_io.tfd >= 0) {
+                    close(socket_io.tfd);
+                }
+#endif
 
-                if (options->file_name != NULL) {
-                    (void)fclose(F);
+                if (octoping_output_close(&output) != 0 && ret == 0) {
+                    printf("Cannot write the results on %s\n",
+                        (options->file_name == NULL) ? "stdout" : options->file_name);
+                    ret = -1;
                 }
             }
+            SOCKET_CLOSE(s);
         }
-        SOCKET_CLOSE(s);
     }
+    free(session);
     return ret;
 }
-
-int main(int argc, char** argv)
-{
-    int exit_code = 0;
-    octoping_options_t options;
-#ifdef _WINDOWS
-    WSADATA wsaData = { 0 };
-    (void)WSA_START(MAKEWORD(2, 2), &wsaData);
-#endif
-
-    if (parse_options(&options, argc, argv) != 0){
-        usage(argv[0]);
-    }
-    else
-    {
-        if (options.real_time) {
-            /* set the real time option */
-        }
-        if (options.is_server) {
-            exit_code = octoping_server(options.source_port);
-        }
-        else {
-            exit_code = octoping_client(&options);
-        }
-    }
-    exit(exit_code);
-}
-
-
-
@@ -0,0 +1,1284 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OCTOPING_H
+#define OCTOPING_H
+
+#ifndef _WINDOWS
+#ifndef _GNU_SOURCE
+/* Required for recvmmsg and sendmmsg */
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
+#include <Windows.h>
+#include <WS2tcpip.h>
+
+#ifndef WSA_START
+#define WSA_START(x, y) WSAStartup((x), (y))
+#endif
+
+#ifndef SOCKET_TYPE
+#define SOCKET_TYPE SOCKET
+#endif
+
+#ifndef SOCKET_CLOSE
+#define SOCKET_CLOSE(x) closesocket(x)
+#endif
+
+#ifndef SOCKLEN_T
+#define SOCKLEN_T int
+#endif
+
+#else /* Linux */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef __USE_XOPEN2K
+#define __USE_XOPEN2K
+#endif
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#endif
+
+#define SERVER_CERT_FILE "certs/cert.pem"
+#define SERVER_KEY_FILE "certs/key.pem"
+
+#ifndef SOCKET_TYPE
+#define SOCKET_TYPE int
+#endif
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET -1
+#endif
+#ifndef SOCKET_CLOSE
+#define SOCKET_CLOSE(x) close(x)
+#endif
+#ifndef WSA_LAST_ERROR
+#define WSA_LAST_ERROR(x) ((long)(x))
+#endif
+#ifndef SOCKLEN_T
+#define SOCKLEN_T socklen_t
+#endif
+#endif
+
+/*
+* By default, the server uses the port number 0xc389 (50057).
+* The value 0xc389 corresponds to the first 4 digits of the
+* MD5 hash of the string "octoping", which is:
+* 0xc3896939402e97b40501795bff15584d. The client uses a
+* randomly assigned port number.
+* The listening port value can be set with the command line
+* option [-p port].
+*/
+#define OCTOPING_PORT 0xc389
+
+/*
+* The batched echo mode of the server reads and echoes up to
+* batch_size packets per system call, using recvmmsg and
+* sendmmsg. The batch size is set with the option [-b batch_size].
+* The mode is only available on Linux.
+*/
+#if defined(__linux__)
+#define OCTOPING_HAS_MMSG
+#endif
+#define OCTOPING_MAX_BATCH 1024
+
+/*
+* The server can run several workers, set with the option [-w workers],
+* each with its own socket bound to the same port with SO_REUSEPORT.
+* Worker i is pinned to CPU first_cpu + i if the option [-c first_cpu]
+* is set.
+*/
+#define OCTOPING_MAX_WORKERS 256
+
+/*
+* With the option [-T], the client and the server use software
+* timestamps provided by the kernel with SO_TIMESTAMPING, instead
+* of reading the clock after the process wakes up. The timestamps
+* are expressed in nanoseconds. The client then sends 32 bytes
+* probes, in which the last 8 bytes are set to OCTOPING_NS_MAGIC.
+* Servers stamp these probes in nanoseconds instead of microseconds,
+* and echo all 32 bytes. Kernel timestamps are only available on Linux.
+*/
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+#define OCTOPING_HAS_TIMESTAMPING
+#endif
+
+/*
+* On Linux, the server sockets set SO_RXQ_OVFL, and the kernel reports
+* with each packet the number of packets dropped so far because the
+* socket receive buffer was full.
+*/
+#if defined(__linux__) && defined(SO_RXQ_OVFL)
+#define OCTOPING_HAS_RXQ_OVFL
+#endif
+
+/*
+* Probe sizes. By default, probes are 16 bytes long, or 32 bytes with
+* the option [-T]. The option [-z size[,size...]] sets the length of
+* the UDP payload, padded with zeroes. With several sizes, the sizes
+* are used in turn for successive trains of probes. The server echoes
+* the whole probe, or 24 bytes for shorter probes. The CSV output then
+* has an additional "size" column.
+*
+* With the option [-t train_length], the client sends trains of
+* train_length back-to-back probes at each interval, and estimates the
+* bottleneck capacity from the dispersion of the echoes of each train.
+* The dispersion of the server receive times gives the capacity of the
+* path to the server, and the dispersion of the echoes the smaller of
+* the capacities of the two directions.
+*/
+#define OCTOPING_MAX_SIZES 16
+#define OCTOPING_NS_MAGIC 0x6f63746f2d6e7331ull
+
+/*
+* Wire format version 2, selected with the option [-v 2]. The probes
+* are at least OCTOPING_V2_HEADER bytes long, and carry four nanosecond
+* timestamps, counting the receive time of the echo by the client:
+*     0  sequence number
+*     8  client send time, echoed unchanged
+*     16 server receive time
+*     24 OCTOPING_V2_MAGIC
+*     32 version, 8 bits, set to 2, flags, 8 bits, then 6 bytes of zeroes
+*     40 server transmit time
+* The server sets the flag OCTOPING_V2_RX when it writes the receive
+* time, and OCTOPING_V2_TX when it writes the transmit time, read just
+* before passing the echo to the kernel. The client removes the time
+* spent in the server, or dwell time, from the rtt and the down_t. A
+* version 1 server echoes the probe without setting the flags, and
+* stamps it in microseconds; version 1 probes are stamped as before.
+*/
+#define OCTOPING_V2_MAGIC 0x6f63746f2d6e7332ull
+#define OCTOPING_V2_HEADER 48
+#define OCTOPING_V2_RX 1
+#define OCTOPING_V2_TX 2
+
+/*
+* The client keeps track of the probes sent during the last
+* OCTOPING_LOSS_TIMEOUT nanoseconds. Probes not echoed by then
+* are reported as lost.
+*/
+#define OCTOPING_LOSS_TIMEOUT 3000000000ull
+#define OCTOPING_CONTROL_MAX 256
+#define OCTOPING_PACKET_MAX 1472
+#define OCTOPING_SERVER_TIMEOUT_MS 250
+
+#ifdef MSG_DONTWAIT
+#define OCTOPING_DONTWAIT MSG_DONTWAIT
+#else
+#define OCTOPING_DONTWAIT 0
+#endif
+
+/*
+* With the option [-l target_file], the client probes all the targets
+* listed in the file from a single process, using one socket per target.
+* Sends are scheduled with a timer wheel and the replies are multiplexed
+* with epoll. The multi-target mode is only available on Linux.
+*
+* With the option [-n flows], the client runs in load mode: it sends
+* probes to a single server from nb_flows sockets, each with its own
+* source port, so that the flows are spread over the ECMP paths and the
+* server receive queues. The interval is then the interval between the
+* probes of all flows, i.e., the aggregate rate. The flows use the ports
+* following the one set with [-p first_port], or ephemeral ports. The
+* client reports the loss rate and rtt of each flow, and the flows that
+* stand out.
+*
+* With the option [-j threads], the sessions are split between several
+* sender threads, each with its own timer wheel, epoll descriptor and
+* output. The results of thread k are then written to "file_name.k",
+* and the summary of all the threads is printed at the end.
+*/
+#if defined(__linux__)
+#define OCTOPING_HAS_EPOLL
+#endif
+#define OCTOPING_MAX_TARGETS 65536
+#define OCTOPING_MAX_THREADS 64
+#define OCTOPING_LABEL_MAX 48
+#define OCTOPING_FLOW_OUTLIERS 5
+
+/*
+* I/O engines. By default, the client and the server use the socket
+* calls. With the option [-e io_uring], they use io_uring instead: a
+* multishot receive stays armed on the socket, with the packets placed in
+* a ring of provided buffers, the sends are submitted in batches, and the
+* client waits for its send deadlines with ring timeouts, so that a
+* single io_uring_enter call submits the pending sends and waits for the
+* next event. The io_uring engine requires Linux 6.0 or later, and is not
+* available in the multi-target mode.
+*/
+typedef enum {
+    octoping_engine_socket = 0,
+    octoping_engine_uring
+} octoping_engine_t;
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define OCTOPING_HAS_URING
+#endif
+#endif
+#endif
+
+#ifdef OCTOPING_HAS_URING
+#define OCTOPING_URING_ENTRIES 256
+#define OCTOPING_URING_BUFFERS 256
+#define OCTOPING_URING_SLOTS 2048
+#define OCTOPING_URING_TAG_RECV 0xffffffff00000001ull
+#define OCTOPING_URING_TAG_TIMEOUT 0xffffffff00000002ull
+
+typedef struct st_octoping_uring_t {
+    int fd;
+    unsigned int sq_entries;
+    unsigned int sq_mask;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int sq_local_tail;
+    unsigned int sq_submitted;
+    struct io_uring_sqe* sqes;
+    unsigned int cq_mask;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    struct io_uring_cqe* cqes;
+    uint8_t* sq_ring;
+    size_t sq_ring_size;
+    uint8_t* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    uint8_t* buffers;
+    unsigned int nb_buffers;
+    unsigned int buffer_size;
+    uint16_t buf_tail;
+    struct msghdr recv_msg;
+    struct __kernel_timespec timeout_ts;
+} octoping_uring_t;
+
+/* Send slot: the message must stay in place until the send completes */
+typedef struct st_octoping_uring_slot_t {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in addr;
+    uint8_t buffer[OCTOPING_PACKET_MAX];
+} octoping_uring_slot_t;
+
+int octoping_uring_init(octoping_uring_t* uring, unsigned int entries, unsigned int nb_buffers, unsigned int buffer_size);
+void octoping_uring_release(octoping_uring_t* uring);
+struct io_uring_sqe* octoping_uring_get_sqe(octoping_uring_t* uring);
+int octoping_uring_submit(octoping_uring_t* uring, unsigned int wait_nr, uint64_t timeout_ns);
+struct io_uring_cqe* octoping_uring_peek(octoping_uring_t* uring);
+void octoping_uring_advance(octoping_uring_t* uring);
+int octoping_uring_arm_recv(octoping_uring_t* uring, SOCKET_TYPE s, size_t control_size);
+uint8_t* octoping_uring_parse_recv(octoping_uring_t* uring, struct io_uring_cqe const* cqe, int* length,
+    struct sockaddr_in* addr_from, uint64_t* rx_ns, uint64_t* drops);
+void octoping_uring_recycle(octoping_uring_t* uring, struct io_uring_cqe const* cqe);
+int octoping_uring_sendmsg(octoping_uring_t* uring, SOCKET_TYPE s, struct msghdr* msg, uint64_t user_data);
+int octoping_uring_timeout(octoping_uring_t* uring, uint64_t wake_time);
+#endif
+
+/*
+* With the option [-r], the process locks its memory, runs with the
+* SCHED_FIFO policy at priority OCTOPING_RT_PRIORITY, and sets SO_BUSY_POLL
+* on its sockets. The client is pinned to its current CPU, or to first_cpu
+* if set with [-c]; server workers, and the sender threads of a client
+* with [-j threads], are pinned from CPU 0 unless [-c] is set.
+* The client spins on its non blocking socket for the last
+* OCTOPING_RT_SPIN_NS before each send unless [-s] is set. The server
+* workers keep blocking receives, so that a real time worker never
+* starves the other processes on its CPU; SO_BUSY_POLL shortens their
+* wake up instead. The wake up jitter is measured before and after the
+* setup.
+*/
+#define OCTOPING_RT_PRIORITY 50
+#define OCTOPING_RT_BUSY_POLL_US 50
+#define OCTOPING_RT_SPIN_NS 200000
+#define OCTOPING_RT_CHECK_COUNT 1000
+#define OCTOPING_RT_CHECK_INTERVAL 100000
+
+typedef struct st_octoping_options_t {
+    char const* server_name;
+    uint16_t server_port;
+    uint16_t source_port;
+    unsigned int is_server : 1;
+    unsigned int real_time : 1;
+    unsigned int timestamps : 1;
+    int wire_version;
+    int batch_size;
+    int nb_workers;
+    int first_cpu;
+    int burst_size;
+    uint64_t spin_ns;
+    uint64_t interval_ns;
+    uint64_t duration_us;
+    char const* file_name;
+    char const* target_file;
+    char const* export_file;
+    int output_format;
+    uint64_t summary_interval_ns;
+    struct st_octoping_stats_t* report;
+    int engine;
+    uint16_t sizes[OCTOPING_MAX_SIZES];
+    int nb_sizes;
+    int train_length;
+    int nb_flows;
+    int nb_threads;
+    char const* query;
+    char const* analyze_file;
+    char const* simulation;
+    uint64_t limit_interval_ns;
+    int limit_burst;
+    uint64_t rotate_bytes;
+    uint64_t rotate_ns;
+    uint64_t flush_interval_ns;
+    char const* feed_name;
+    char const* follow_name;
+} octoping_options_t;
+
+/*
+* Timer wheel, used to schedule the sends of many sessions.
+* Timers are kept in OCTOPING_WHEEL_SLOTS lists, each covering
+* tick_ns nanoseconds. Timers that expire more than one rotation
+* ahead stay in their slot until the rotation in which they expire.
+* A bitmap of non empty slots allows finding the next timer without
+* scanning all the slots.
+*/
+#define OCTOPING_WHEEL_SLOTS 4096
+#define OCTOPING_WHEEL_MIN_TICK 10000
+
+typedef struct st_octoping_timer_t {
+    struct st_octoping_timer_t* next;
+    struct st_octoping_timer_t* previous;
+    uint64_t expire_time;
+    size_t slot;
+    void* app_ctx;
+} octoping_timer_t;
+
+typedef struct st_octoping_wheel_t {
+    uint64_t tick_ns;
+    uint64_t current_tick;
+    size_t nb_timers;
+    octoping_timer_t* slots[OCTOPING_WHEEL_SLOTS];
+    uint64_t busy[OCTOPING_WHEEL_SLOTS / 64];
+} octoping_wheel_t;
+
+void octoping_wheel_init(octoping_wheel_t* wheel, uint64_t tick_ns, uint64_t current_time);
+void octoping_wheel_insert(octoping_wheel_t* wheel, octoping_timer_t* timer, uint64_t expire_time);
+void octoping_wheel_remove(octoping_wheel_t* wheel, octoping_timer_t* timer);
+octoping_timer_t* octoping_wheel_next_expired(octoping_wheel_t* wheel, uint64_t current_time);
+uint64_t octoping_wheel_next_time(octoping_wheel_t* wheel);
+
+/*
+* Pacer. Probes are sent in bursts of burst_size back-to-back packets,
+* scheduled every interval_ns nanoseconds. The pacer keeps statistics
+* of the drift between the actual send times and the schedule. If the
+* sender falls behind by a full interval or more, the missed bursts
+* are skipped and counted.
+* The client waits for the next send with a timerfd, which is not
+* subject to the timer slack applied to select timeouts. With the option
+* [-s spin_us], the client stops waiting spin_us microseconds before the
+* scheduled time, and busy-polls the socket until then.
+*/
+#define OCTOPING_MAX_BURST 1024
+
+typedef struct st_octoping_pacer_t {
+    uint64_t interval_ns;
+    int burst_size;
+    int burst_sent;
+    uint64_t next_time;
+    uint64_t nb_sends;
+    uint64_t nb_skipped;
+    uint64_t drift_max;
+    double drift_sum;
+    double drift_sum_squares;
+} octoping_pacer_t;
+
+void octoping_pacer_init(octoping_pacer_t* pacer, uint64_t start_time, uint64_t interval_ns, int burst_size);
+void octoping_pacer_on_send(octoping_pacer_t* pacer, uint64_t t);
+void octoping_pacer_merge(octoping_pacer_t* total, octoping_pacer_t const* pacer);
+void octoping_pacer_print(FILE* F, char const* label, octoping_pacer_t const* pacer);
+int octoping_parse_interval(char const* arg, uint64_t* interval_ns);
+int octoping_wait_readable(SOCKET_TYPE s, int tfd, uint64_t current_time, uint64_t wake_time);
+
+/*
+* In-flight tracker. The probes are kept in a ring indexed by sequence
+* number, which covers all the probes sent since the oldest probe not
+* yet retired. The capacity doubles when the ring is full, up to
+* OCTOPING_TRACKER_MAX probes. Probes are retired in sequence order
+* once older than the loss timeout, and reported lost if they were not
+* acknowledged. Each echo is classified as on time, reordered (a probe
+* with a higher number was already echoed), duplicate (the probe was
+* already echoed), or late (the probe was already retired).
+*/
+#define OCTOPING_TRACKER_MIN 64
+#define OCTOPING_TRACKER_MAX (1 << 22)
+
+typedef enum {
+    octoping_reply_on_time = 0,
+    octoping_reply_reordered,
+    octoping_reply_duplicate,
+    octoping_reply_late,
+    octoping_reply_invalid
+} octoping_reply_class_t;
+
+typedef struct st_octoping_probe_t {
+    uint64_t sent_at;
+    uint64_t tx_at;
+    int is_acked;
+} octoping_probe_t;
+
+typedef struct st_octoping_tracker_t {
+    octoping_probe_t* probes;
+    uint64_t capacity;
+    uint64_t base;
+    uint64_t next_seq;
+    uint64_t highest_acked;
+    uint64_t nb_sent;
+    uint64_t nb_on_time;
+    uint64_t nb_reordered;
+    uint64_t nb_duplicate;
+    uint64_t nb_late;
+    uint64_t nb_lost;
+} octoping_tracker_t;
+
+int octoping_tracker_init(octoping_tracker_t* tracker);
+void octoping_tracker_release(octoping_tracker_t* tracker);
+int octoping_tracker_insert(octoping_tracker_t* tracker, uint64_t sent_at);
+octoping_probe_t* octoping_tracker_find(octoping_tracker_t* tracker, uint64_t seqnum);
+octoping_reply_class_t octoping_tracker_ack(octoping_tracker_t* tracker, uint64_t seqnum, octoping_probe_t* probe);
+int octoping_tracker_next_lost(octoping_tracker_t* tracker, uint64_t sent_before, uint64_t* seqnum, uint64_t* sent_at);
+uint64_t octoping_tracker_nb_pending(octoping_tracker_t const* tracker);
+
+/*
+* Clock offset and drift. Each echo gives two bounds of the offset of
+* the server clock: the up sample, server receive time minus client send
+* time, is the up delay plus the offset, and the down sample, client
+* receive time minus server transmit time, is the down delay minus the
+* offset. The estimator keeps the minimum of each sample in buckets of
+* OCTOPING_CLOCK_BUCKET, and the lower convex hull of these minima over
+* the last OCTOPING_CLOCK_HORIZON. The line under the hull at the middle
+* of its time range gives, for each direction, the minimum delay and
+* the drift; the phase is half the difference of the two lines, i.e.,
+* the offset plus half the difference of the minimum delays. Each echo
+* costs a constant time, and each bucket a search in the hull, of at
+* most OCTOPING_CLOCK_HULL_MAX points. Until the hulls have two points,
+* the phase is that of the echo with the smallest rtt.
+*/
+#define OCTOPING_CLOCK_BUCKET 1000000000ll
+#define OCTOPING_CLOCK_HORIZON 600000000000ll
+#define OCTOPING_CLOCK_HULL_MAX 128
+
+typedef struct st_octoping_clock_point_t {
+    int64_t t;
+    int64_t d;
+} octoping_clock_point_t;
+
+typedef struct st_octoping_hull_t {
+    octoping_clock_point_t points[OCTOPING_CLOCK_HULL_MAX];
+    int nb_points;
+    int has_min;
+    octoping_clock_point_t min;
+    int64_t bucket_start;
+    int64_t line_t;
+    int64_t line_d;
+    double slope;
+} octoping_hull_t;
+
+typedef struct st_octoping_clock_t {
+    octoping_hull_t up;
+    octoping_hull_t down;
+    uint64_t best_rtt;
+    int64_t best_phase;
+} octoping_clock_t;
+
+void octoping_clock_init(octoping_clock_t* clock);
+void octoping_clock_add(octoping_clock_t* clock, int64_t sent, int64_t received, int64_t transmitted, int64_t echoed);
+int64_t octoping_clock_phase(octoping_clock_t const* clock, int64_t t);
+double octoping_clock_drift(octoping_clock_t const* clock);
+
+/*
+* Probe session, i.e., the state kept by the client for each target.
+* All times are in nanoseconds. The label is printed as the first
+* column of the CSV lines when the client probes several targets.
+*/
+typedef struct st_octoping_train_t {
+    uint64_t index;
+    int nb_received;
+    int length;
+    int first_pos;
+    int last_pos;
+    uint64_t first_server;
+    uint64_t last_server;
+    uint64_t first_rx;
+    uint64_t last_rx;
+} octoping_train_t;
+
+/*
+* Per session counters, printed for each flow in the load mode.
+*/
+typedef struct st_octoping_flow_stats_t {
+    uint64_t nb_echoes;
+    uint64_t nb_lost;
+    uint64_t rtt_min;
+    uint64_t rtt_max;
+    double rtt_sum;
+} octoping_flow_stats_t;
+
+typedef struct st_octoping_session_t {
+    SOCKET_TYPE s;
+    struct sockaddr_in addr_to;
+    char label[OCTOPING_LABEL_MAX];
+    unsigned int timestamps : 1;
+    unsigned int wire_v2 : 1;
+    uint64_t start_time;
+    octoping_pacer_t pacer;
+    octoping_tracker_t tracker;
+    uint32_t target_index;
+    int64_t phase;
+    octoping_clock_t clock;
+    int64_t last_rtt;
+    uint16_t const* sizes;
+    int nb_sizes;
+    int train_length;
+    octoping_train_t train;
+    octoping_flow_stats_t flow;
+    octoping_timer_t timer;
+    void* app_ctx;
+} octoping_session_t;
+
+/*
+* Result of a probe. All times are in nanoseconds, relative to the start
+* of the session, except the phase, which is the estimated offset
+* between the server and client clocks, and the drift is the rate of
+* change of the phase, in parts per billion. The wire times are the kernel
+* timestamps if available, the application times otherwise. The rtt,
+* wire_rtt, up_t and down_t are derived from the other fields. With the
+* wire format version 2, the dwell is the time between the receive and
+* transmit times of the server, and the net_rtt is the wire_rtt minus
+* the dwell.
+*/
+#define OCTOPING_RESULT_LOST 1
+#define OCTOPING_RESULT_REORDERED 2
+#define OCTOPING_RESULT_LATE 4
+#define OCTOPING_RESULT_KERNEL_TS 8
+#define OCTOPING_RESULT_DWELL 16
+
+typedef struct st_octoping_result_t {
+    uint64_t seqnum;
+    int64_t sent;
+    int64_t wire_sent;
+    int64_t received;
+    int64_t wire_echo;
+    int64_t echo;
+    int64_t phase;
+    int64_t rtt;
+    int64_t wire_rtt;
+    int64_t up_t;
+    int64_t down_t;
+    int64_t dwell;
+    int64_t net_rtt;
+    int64_t drift;
+    uint32_t flags;
+    uint32_t target_index;
+    uint32_t length;
+} octoping_result_t;
+
+void octoping_result_derive(octoping_result_t* result);
+
+/*
+* Results are written either as CSV lines, or with the option [-F bin]
+* as a compact binary log: a header describing the run and the targets,
+* followed by fixed size records in little endian order. Writes go
+* through a large buffer, flushed when full, at the periodic report
+* interval in real time mode, and at the end of the run. The option
+* [-x binary_log] converts a binary log to CSV.
+*/
+#define OCTOPING_BINLOG_MAGIC "OCTOPBIN"
+#define OCTOPING_BINLOG_VERSION 2
+#define OCTOPING_BINLOG_V1_RECORD_SIZE 64
+#define OCTOPING_BINLOG_RECORD_SIZE 72
+#define OCTOPING_BINLOG_TIMESTAMPS 1
+#define OCTOPING_BINLOG_LABELS 2
+#define OCTOPING_BINLOG_SIZES 4
+#define OCTOPING_BINLOG_DWELL 8
+#define OCTOPING_BINLOG_DWELL_RECORD_SIZE 80
+#define OCTOPING_BINLOG_FIXED_HEADER 56
+#define OCTOPING_OUTPUT_BUFFER_SIZE (1 << 20)
+
+/*
+* Online statistics. The rtt, up_t, down_t and jitter values are counted
+* in log-linear histograms: values below OCTOPING_HISTOGRAM_SUB are
+* counted exactly, larger values in OCTOPING_HISTOGRAM_SUB buckets per
+* power of 2, i.e., with a relative error below 1/64. Jitter is the
+* absolute difference between the rtt of successive echoes from the same
+* target. With kernel timestamps, the stack_t histogram counts the
+* difference between rtt and wire_rtt. With the wire format version 2,
+* the dwell and net_rtt histograms count the time spent in the server
+* and the rtt without it. The client prints a summary every
+* [-S seconds] if set, and at the end of the run. With [-F summary], it
+* prints only the summaries, on stdout or in the file set with -f, and
+* skips the per probe results.
+*/
+#define OCTOPING_HISTOGRAM_SUB_BITS 6
+#define OCTOPING_HISTOGRAM_SUB (1 << OCTOPING_HISTOGRAM_SUB_BITS)
+#define OCTOPING_HISTOGRAM_BUCKETS ((64 - OCTOPING_HISTOGRAM_SUB_BITS + 1) * OCTOPING_HISTOGRAM_SUB)
+
+typedef struct st_octoping_histogram_t {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t buckets[OCTOPING_HISTOGRAM_BUCKETS];
+} octoping_histogram_t;
+
+typedef struct st_octoping_stats_t {
+    uint64_t nb_echoes;
+    uint64_t nb_lost;
+    uint64_t nb_reordered;
+    uint64_t nb_late;
+    octoping_histogram_t rtt;
+    octoping_histogram_t up_t;
+    octoping_histogram_t down_t;
+    octoping_histogram_t jitter;
+    octoping_histogram_t stack_t;
+    octoping_histogram_t dwell;
+    octoping_histogram_t net_rtt;
+    octoping_histogram_t capacity_up;
+    octoping_histogram_t capacity_rt;
+} octoping_stats_t;
+
+void octoping_histogram_add(octoping_histogram_t* histogram, uint64_t value);
+void octoping_histogram_merge(octoping_histogram_t* total, octoping_histogram_t const* histogram);
+uint64_t octoping_histogram_percentile(octoping_histogram_t const* histogram, double fraction);
+void octoping_stats_reset(octoping_stats_t* stats);
+void octoping_stats_add(octoping_stats_t* stats, octoping_result_t const* result, int64_t* last_rtt);
+void octoping_flow_stats_add(octoping_flow_stats_t* flow, octoping_result_t const* result);
+void octoping_stats_add_train(octoping_stats_t* stats, uint64_t up_bps, uint64_t rt_bps);
+void octoping_stats_merge(octoping_stats_t* total, octoping_stats_t const* stats);
+int octoping_stats_print(FILE* F, char const* label, octoping_stats_t const* stats);
+
+/*
+* Lock-free single producer, single consumer ring of fixed size entries.
+* The head and the tail are kept in separate cache lines.
+*/
+#ifdef _WINDOWS
+#define OCTOPING_LOAD_ACQUIRE(p) ((uint64_t)InterlockedCompareExchange64((LONG64 volatile*)(p), 0, 0))
+#define OCTOPING_STORE_RELEASE(p, v) ((void)InterlockedExchange64((LONG64 volatile*)(p), (LONG64)(v)))
+#else
+#define OCTOPING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define OCTOPING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+#define OCTOPING_CACHE_LINE 64
+
+typedef struct st_octoping_ring_t {
+    uint64_t head;
+    uint64_t producer_tail;
+    uint64_t nb_overflow;
+    uint8_t producer_pad[OCTOPING_CACHE_LINE - 3 * sizeof(uint64_t)];
+    uint64_t tail;
+    uint64_t consumer_head;
+    uint8_t consumer_pad[OCTOPING_CACHE_LINE - 2 * sizeof(uint64_t)];
+    uint8_t* entries;
+    size_t entry_size;
+    uint64_t mask;
+} octoping_ring_t;
+
+int octoping_ring_init(octoping_ring_t* ring, size_t entry_size, uint64_t capacity);
+void octoping_ring_release(octoping_ring_t* ring);
+int octoping_ring_push(octoping_ring_t* ring, void const* entry);
+int octoping_ring_pop(octoping_ring_t* ring, void* entry);
+
+/*
+* Except on Windows, the results are written by a writer thread, so that
+* slow writes and flushes do not delay the sends and receives. The probe
+* loop pushes the results in a ring of OCTOPING_OUTPUT_RING_SIZE entries;
+* the writer drains it, and flushes the output every flush_interval_ns,
+* once per second by default. If the ring is full, the result is dropped
+* from the output and counted; it is still counted in the statistics.
+* The simulator, which runs faster than the writer could follow, sets
+* write_in_loop to write the results from the probe loop.
+*
+* With a rotation size or period, the size and the age of the file are
+* checked after each flush. The full file is closed, renamed with the
+* UTC time at which it was started, as in "file.20261016-143000", and a
+* new file is started under the original name with the same header. The
+* rotation happens in the writer thread, so the probe loop does not
+* pause, and the statistics and the session state carry over.
+*/
+#define OCTOPING_OUTPUT_RING_SIZE (1 << 16)
+#define OCTOPING_OUTPUT_FLUSH_INTERVAL 1000000000ull
+#define OCTOPING_OUTPUT_IDLE_US 1000
+
+typedef struct st_octoping_output_entry_t {
+    octoping_result_t result;
+    char const* label;
+} octoping_output_entry_t;
+
+typedef enum {
+    octoping_format_csv = 0,
+    octoping_format_binary,
+    octoping_format_summary,
+    octoping_format_callback
+} octoping_format_t;
+
+/*
+* With the callback format, used by the agent, each result is passed to
+* the result function, in the thread that processes the session, instead
+* of being written. The function returns 0, or -1 to report an error.
+*/
+typedef int (*octoping_result_fn)(void* callback_ctx, octoping_session_t* session, octoping_result_t const* result);
+
+typedef struct st_octoping_output_t {
+    FILE* F;
+    FILE* F_summary;
+    octoping_format_t format;
+    unsigned int timestamps : 1;
+    unsigned int with_label : 1;
+    unsigned int with_size : 1;
+    unsigned int with_dwell : 1;
+    unsigned int write_in_loop : 1;
+    uint8_t* buffer;
+    size_t buffer_used;
+    size_t buffer_size;
+    octoping_stats_t* window;
+    octoping_stats_t* total;
+    uint64_t start_time;
+    uint64_t window_start;
+    uint64_t summary_interval_ns;
+    octoping_stats_t* report;
+    octoping_result_fn result_fn;
+    void* callback_ctx;
+    octoping_ring_t* ring;
+    uint64_t writer_stop;
+    uint64_t writer_error;
+#ifndef _WINDOWS
+    pthread_t writer;
+#endif
+    char const* file_name;
+    uint64_t flush_interval_ns;
+    uint64_t last_flush;
+    uint64_t rotate_bytes;
+    uint64_t rotate_ns;
+    uint64_t file_start;
+    uint8_t* header;
+    size_t header_size;
+    struct st_octoping_feed_t* feed;
+} octoping_output_t;
+
+/*
+* Number of socket and wait calls made by the probe and echo loops,
+* used by the benchmark to compute the system calls per packet.
+*/
+extern uint64_t octoping_nb_syscalls;
+#ifdef _WINDOWS
+#define OCTOPING_COUNT_SYSCALL() ((void)InterlockedIncrement64((LONG64 volatile*)&octoping_nb_syscalls))
+#else
+#define OCTOPING_COUNT_SYSCALL() ((void)__atomic_fetch_add(&octoping_nb_syscalls, 1, __ATOMIC_RELAXED))
+#endif
+
+uint64_t current_time();
+uint64_t current_time_ns();
+uint64_t parse_64(uint8_t* buffer);
+void marshall_64(uint8_t* buffer, uint64_t x);
+void network_error();
+int octoping_is_timeout_error();
+FILE* octoping_open_file(char const* file_name, char const* mode);
+FILE* octoping_open_output(char const* file_name);
+int octoping_parse_format(char const* arg, int* format);
+int octoping_parse_rotation(char const* arg, uint64_t* rotate_bytes, uint64_t* rotate_ns);
+
+#ifdef OCTOPING_HAS_TIMESTAMPING
+int octoping_enable_timestamps(SOCKET_TYPE s, int tx);
+uint64_t octoping_get_timestamp(struct msghdr* msg);
+int octoping_recv_timestamped(SOCKET_TYPE s, uint8_t* buffer, size_t buffer_size, int flags,
+    struct sockaddr_in* addr_from, uint64_t* rx_ns);
+#endif
+
+int octoping_csv_header(FILE* F, int timestamps, int with_label, int with_size, int with_dwell);
+int octoping_csv_line(FILE* F, int timestamps, int with_size, int with_dwell, char const* label,
+    octoping_result_t const* result);
+int octoping_output_open(octoping_output_t* output, char const* file_name, octoping_format_t format,
+    int timestamps, int with_label, int with_size, uint64_t summary_interval_ns);
+int octoping_output_header(octoping_output_t* output, octoping_options_t const* options, uint64_t start_time,
+    octoping_session_t const* sessions, size_t nb_sessions);
+int octoping_output_result(octoping_output_t* output, octoping_session_t* session, octoping_result_t const* result);
+int octoping_output_flush(octoping_output_t* output);
+int octoping_output_periodic(octoping_output_t* output, uint64_t current_time);
+int octoping_output_close(octoping_output_t* output);
+int octoping_output_close_at(octoping_output_t* output, uint64_t current_time);
+
+/*
+* Shared memory feed. With the option [-m name], the client also
+* publishes each result, and the summary of each window set with -S, in
+* the shared memory object "name", i.e., /dev/shm/name on Linux, so that
+* local programs can follow the results as they arrive. The object
+* holds an octoping_feed_header_t, followed by a ring of
+* OCTOPING_FEED_SLOTS slots. The result number i is written in the slot
+* i modulo OCTOPING_FEED_SLOTS, under a sequence lock: the writer sets
+* the sequence of the slot to 2*i+1, writes the result, then sets the
+* sequence to 2*i+2 with release semantics. A reader that wants the
+* result i reads the sequence, copies the result, and reads the
+* sequence again; the copy is valid if both reads return 2*i+2. The
+* summary of the last window is protected by the same kind of lock, with
+* a sequence that is odd while it is written; a reader that polls less
+* often than the windows only sees the latest. The writer never waits for the readers, so
+* readers that fall more than OCTOPING_FEED_SLOTS results behind lose
+* the oldest results. The write index counts the results published, and
+* is_closed is set at the end of the run. The object is left in place at
+* the end of the run, for the readers that are late. The option
+* [-y name] follows a feed, and prints its results in CSV, and its
+* summaries. The feed is only available on Linux.
+*/
+#ifdef __linux__
+#define OCTOPING_HAS_FEED
+#endif
+#define OCTOPING_FEED_MAGIC "OCTOFEED"
+#define OCTOPING_FEED_VERSION 1
+#define OCTOPING_FEED_SLOTS (1 << 16)
+
+typedef struct st_octoping_feed_percentiles_t {
+    uint64_t min;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+    double mean;
+} octoping_feed_percentiles_t;
+
+typedef struct st_octoping_feed_summary_t {
+    uint64_t window_start;
+    uint64_t window_end;
+    uint64_t nb_echoes;
+    uint64_t nb_lost;
+    uint64_t nb_reordered;
+    uint64_t nb_late;
+    octoping_feed_percentiles_t rtt;
+    octoping_feed_percentiles_t up_t;
+    octoping_feed_percentiles_t down_t;
+    octoping_feed_percentiles_t jitter;
+} octoping_feed_summary_t;
+
+typedef struct st_octoping_feed_slot_t {
+    uint64_t seq;
+    octoping_result_t result;
+} octoping_feed_slot_t;
+
+typedef struct st_octoping_feed_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t slot_size;
+    uint32_t nb_slots;
+    uint64_t start_time;
+    uint64_t interval_ns;
+    uint32_t timestamps;
+    uint32_t is_closed;
+    uint8_t pad[OCTOPING_CACHE_LINE - 48];
+    uint64_t write_index;
+    uint8_t write_pad[OCTOPING_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t summary_seq;
+    octoping_feed_summary_t summary;
+} octoping_feed_header_t;
+
+typedef struct st_octoping_feed_t {
+    octoping_feed_header_t* header;
+    octoping_feed_slot_t* slots;
+    size_t map_size;
+    uint64_t write_index;
+    uint64_t summary_seq;
+} octoping_feed_t;
+
+#ifdef OCTOPING_HAS_FEED
+octoping_feed_t* octoping_feed_create(char const* name, uint64_t start_time, uint64_t interval_ns, int timestamps);
+void octoping_feed_publish(octoping_feed_t* feed, octoping_result_t const* result);
+void octoping_feed_publish_summary(octoping_feed_t* feed, uint64_t window_start, uint64_t window_end,
+    octoping_stats_t const* stats);
+void octoping_feed_close(octoping_feed_t* feed);
+octoping_feed_t* octoping_feed_open(char const* name);
+int octoping_feed_read(octoping_feed_t const* feed, uint64_t* index, octoping_result_t* result);
+int octoping_feed_read_summary(octoping_feed_t const* feed, uint64_t* summary_seq, octoping_feed_summary_t* summary);
+void octoping_feed_release(octoping_feed_t* feed);
+int octoping_feed_follow(octoping_options_t* options);
+#endif
+
+int octoping_binlog_header(octoping_output_t* output, octoping_options_t const* options, uint64_t start_time,
+    octoping_session_t const* sessions, size_t nb_sessions);
+int octoping_binlog_record(octoping_output_t* output, octoping_result_t const* result);
+int octoping_binlog_export(char const* bin_file, char const* csv_file);
+
+/*
+* Offline analysis. With the option [-a csv_file], octoping maps the CSV
+* results of a previous run in memory, and parses it in parallel chunks,
+* one per thread, on all the CPUs or on the number of threads set with
+* [-j threads]. It writes the echoes, losses, rtt percentiles and mean
+* phase of each window of [-S seconds], by default
+* OCTOPING_ANALYZE_WINDOW, as CSV on stdout or in the file set with
+* -f, then prints the statistics of the whole file, the loss bursts, the
+* reordered echoes, and the drift of the phase. Each chunk keeps the
+* first OCTOPING_ANALYZE_PREFIX new highest sequence numbers that it
+* sees, so that the echoes reordered across chunks can be counted
+* without a second pass. The analysis is not available on Windows.
+*/
+#define OCTOPING_ANALYZE_WINDOW 60000000000ull
+#define OCTOPING_ANALYZE_PREFIX 4096
+#define OCTOPING_ANALYZE_MIN_CHUNK (1 << 20)
+
+int octoping_analyze(octoping_options_t* options);
+
+int octoping_session_init(octoping_session_t* session, SOCKET_TYPE s, struct sockaddr_in const* addr_to,
+    char const* label, uint32_t target_index, int timestamps, uint64_t start_time);
+void octoping_session_release(octoping_session_t* session);
+void octoping_session_set_probes(octoping_session_t* session, uint16_t const* sizes, int nb_sizes, int train_length);
+int octoping_session_probe_length(octoping_session_t const* session, uint64_t seqnum);
+int octoping_session_prepare(octoping_session_t* session, uint64_t t, uint8_t* buffer, octoping_output_t* output);
+int octoping_session_transmit(octoping_session_t* session, uint8_t const* buffer, int length);
+int octoping_session_send(octoping_session_t* session, uint64_t t, octoping_output_t* output);
+int octoping_session_process(octoping_session_t* session, uint8_t* buffer, int l, uint64_t rx_at, uint64_t echo_at,
+    octoping_output_t* output);
+#ifdef OCTOPING_HAS_TIMESTAMPING
+void octoping_session_tx_timestamps(octoping_session_t* session);
+#endif
+int octoping_session_recv(octoping_session_t* session, uint8_t* buffer, size_t buffer_size, int flags,
+    int* length, uint64_t* rx_at);
+int octoping_session_receive(octoping_session_t* session, int flags, octoping_output_t* output);
+int octoping_session_report_missing(octoping_session_t* session, octoping_output_t* output);
+void octoping_session_print_counts(FILE* F, char const* label, octoping_tracker_t const* tracker);
+void octoping_session_print_clock(FILE* F, char const* label, octoping_session_t const* session);
+
+int octoping_realtime_setup(octoping_options_t* options);
+int octoping_realtime_check(FILE* F, char const* label);
+int octoping_realtime_pin(int cpu);
+int octoping_realtime_unpin(void);
+void octoping_realtime_socket(SOCKET_TYPE s);
+
+/*
+* Server state. The server runs one or several workers. Each worker
+* owns a socket bound to the server port, and keeps its own counters.
+* With several workers, the sockets are bound with SO_REUSEPORT, and
+* the kernel spreads the client flows between them. The workers stop
+* when the process receives SIGINT or SIGTERM, or if any of them
+* encounters an error. With the option [-e io_uring], the workers use
+* the io_uring engine instead of the socket calls.
+*
+* Each worker counts the packets and bytes received and echoed, the
+* receive calls, the packets too short to be echoed, the echoes that
+* could not be sent, and the kernel drops. The counters are only written
+* by their worker, with relaxed atomic stores, so that the monitor can
+* read them without locks and without slowing down the echo path.
+*/
+typedef struct st_octoping_server_counters_t {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_calls;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t short_packets;
+    uint64_t send_errors;
+    uint64_t rx_drops;
+    uint64_t limited;
+} octoping_server_counters_t;
+
+#ifdef _WINDOWS
+#define OCTOPING_COUNTER_ADD(x, v) ((x) += (v))
+#define OCTOPING_COUNTER_SET(x, v) ((x) = (v))
+#define OCTOPING_COUNTER_READ(x) (x)
+#else
+#define OCTOPING_COUNTER_ADD(x, v) __atomic_store_n(&(x), (x) + (v), __ATOMIC_RELAXED)
+#define OCTOPING_COUNTER_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define OCTOPING_COUNTER_READ(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#endif
+
+/*
+* Top clients. Each worker counts the packets of each client address and
+* port in a direct mapped table of OCTOPING_TOP_SLOTS entries. A packet
+* from a client that does not own the slot decrements the count of the
+* owner, and takes the slot when the count reaches zero, so that heavy
+* clients keep their slot. Each worker has two tables, used in alternate
+* log intervals: the monitor reads and clears the table of the previous
+* interval while the workers fill the other one.
+*/
+#define OCTOPING_TOP_BITS 12
+#define OCTOPING_TOP_SLOTS (1 << OCTOPING_TOP_BITS)
+#define OCTOPING_TOP_CLIENTS 10
+
+typedef struct st_octoping_top_slot_t {
+    uint64_t key;
+    uint64_t count;
+} octoping_top_slot_t;
+
+typedef struct st_octoping_top_t {
+    octoping_top_slot_t slots[2][OCTOPING_TOP_SLOTS];
+} octoping_top_t;
+
+/*
+* Admission control. With [-L interval[,burst]], each worker limits the
+* echoes to each source address to one per interval, with bursts of up to
+* burst probes, OCTOPING_LIMIT_BURST by default. The limit is a token
+* bucket, kept as the time at which the bucket will be full again, in a
+* table of OCTOPING_LIMIT_SETS sets of OCTOPING_LIMIT_WAYS addresses, one
+* cache line per set. A new source replaces the entry of its set whose
+* bucket is the fullest, and inherits its deficit, so that a flood from
+* random addresses cannot reset the buckets. The excess probes are not
+* echoed, and are counted per worker and per source.
+*/
+#define OCTOPING_LIMIT_BITS 12
+#define OCTOPING_LIMIT_SETS (1 << OCTOPING_LIMIT_BITS)
+#define OCTOPING_LIMIT_WAYS 4
+#define OCTOPING_LIMIT_BURST 32
+
+typedef struct st_octoping_limit_set_t {
+    uint32_t addr[OCTOPING_LIMIT_WAYS];
+    uint32_t drops[OCTOPING_LIMIT_WAYS];
+    uint64_t full_time[OCTOPING_LIMIT_WAYS];
+} octoping_limit_set_t;
+
+typedef struct st_octoping_limit_t {
+    uint64_t interval_ns;
+    uint64_t tolerance_ns;
+    octoping_limit_set_t sets[OCTOPING_LIMIT_SETS];
+} octoping_limit_t;
+
+octoping_limit_t* octoping_limit_create(uint64_t interval_ns, int burst);
+int octoping_limit_admit(octoping_limit_t* limit, uint32_t addr, uint64_t current_time);
+int octoping_parse_limit(char const* arg, uint64_t* interval_ns, int* burst);
+
+typedef struct st_octoping_server_worker_t {
+    int worker_id;
+    int cpu;
+    int batch_size;
+    int timestamps;
+    int engine;
+    SOCKET_TYPE s;
+    octoping_server_counters_t counters;
+    octoping_top_t* top;
+    octoping_limit_t* limit;
+    int ret;
+#ifndef _WINDOWS
+    pthread_t thread;
+#endif
+} octoping_server_worker_t;
+
+/*
+* Server monitor. Except on Windows, the main thread of the server
+* prints a log line with the rates, the error counters and the top
+* clients every [-S seconds], by default every
+* OCTOPING_SERVER_LOG_INTERVAL. With the option [-q port|path], it also
+* listens on the local TCP port, or on the Unix socket path, and writes
+* the current counters as text to each connection, in the Prometheus
+* exposition format.
+*/
+#define OCTOPING_SERVER_LOG_INTERVAL 10000000000ull
+
+extern uint64_t octoping_top_epoch;
+void octoping_top_add(octoping_top_t* top, struct sockaddr_in const* addr);
+int octoping_server_monitor(octoping_options_t* options, octoping_server_worker_t* workers, int nb_workers);
+#ifdef OCTOPING_HAS_RXQ_OVFL
+void octoping_get_drops(struct msghdr* msg, uint64_t* drops);
+#endif
+
+int octoping_server_stamp(uint8_t* buffer, int l, uint64_t rx_ns);
+void octoping_server_stamp_tx(uint8_t* buffer, int l, uint64_t tx_ns);
+void octoping_server_count_rx(octoping_server_worker_t* worker, struct sockaddr_in const* addr_from, int l);
+int octoping_server_admit(octoping_server_worker_t* worker, struct sockaddr_in const* addr_from, uint64_t current_time);
+int octoping_server_is_stopping();
+int octoping_server(octoping_options_t* options);
+void octoping_server_request_stop();
+
+/*
+* Continuous mode. With a duration of 0, the client runs until it
+* receives SIGINT or SIGTERM; it then stops sending, and waits
+* OCTOPING_CLIENT_LINGER for the last echoes. The memory does not grow
+* with the duration: the tracker, the output ring and the statistics
+* have a fixed size, and the output files are rotated with -R.
+*/
+#define OCTOPING_CLIENT_LINGER 3000000000ull
+
+void octoping_client_catch_signals();
+void octoping_client_check_stop(uint64_t current_time, uint64_t* end_send_time, uint64_t* end_recv_time);
+
+/*
+* I/O and clock of the single target client loop. The client uses the
+* session socket and the system clock; the simulator replaces them with
+* a simulated network in virtual time. The wait function returns 1 if a
+* packet may be received before the wake time, 0 if the wake time was
+* reached, -1 on error, and the receive function returns 1 and the
+* length of the packet if one was received, 0 if none, -1 on error.
+*/
+typedef struct st_octoping_io_t {
+    void* io_ctx;
+    int is_virtual;
+    uint64_t(*now)(void* io_ctx);
+    int (*wait)(void* io_ctx, uint64_t current_time, uint64_t wake_time);
+    int (*send)(void* io_ctx, octoping_session_t* session, uint8_t const* buffer, int length);
+    int (*recv)(void* io_ctx, octoping_session_t* session, uint8_t* buffer, size_t buffer_size, int* length, uint64_t* rx_at);
+} octoping_io_t;
+
+typedef struct st_octoping_socket_io_t {
+    SOCKET_TYPE s;
+    int tfd;
+} octoping_socket_io_t;
+
+void octoping_socket_io_init(octoping_io_t* io, octoping_socket_io_t* socket_io);
+int octoping_client_loop(octoping_options_t const* options, octoping_session_t* session, octoping_output_t* output,
+    octoping_io_t const* io, uint64_t end_send_time, uint64_t end_recv_time);
+int octoping_client(octoping_options_t* options);
+#ifdef OCTOPING_HAS_URING
+int octoping_server_uring(octoping_server_worker_t* worker);
+int octoping_client_uring(octoping_options_t* options, octoping_session_t* session, octoping_output_t* output,
+    uint64_t end_send_time, uint64_t end_recv_time);
+#endif
+int octoping_multi_client(octoping_options_t* options);
+
+/*
+* Simulator. With [-M model], the single target client loop runs against
+* a simulated network and reflector in virtual time, so that hours of
+* probing replay in seconds, with the same results for the same model.
+* The model is a comma separated list of key=value: the one way delays
+* "up" and "down", or "delay" for both, a random "jitter" added to each
+* delay, with the distribution "dist", exp (default) or uniform, the
+* probability of "loss" in each direction, of "reorder", which delays the
+* echo by "reorder_delay", and of "dup", the clock "offset" of the
+* reflector and its "drift" in ppm, and the random "seed". The echoes
+* are kept in a heap of at most OCTOPING_SIM_QUEUE packets. At the end,
+* the counts of the client are checked against those of the network,
+* and the phase estimate against the true offset.
+*/
+#define OCTOPING_SIM_QUEUE (1 << 18)
+#define OCTOPING_SIM_EPOCH 1600000000000000000ull
+
+typedef enum {
+    octoping_sim_exp = 0,
+    octoping_sim_uniform
+} octoping_sim_distribution_t;
+
+typedef struct st_octoping_sim_model_t {
+    uint64_t up_ns;
+    uint64_t down_ns;
+    uint64_t jitter_ns;
+    octoping_sim_distribution_t distribution;
+    double loss;
+    double reorder;
+    uint64_t reorder_ns;
+    double duplicate;
+    uint64_t dwell_ns;
+    int64_t offset_ns;
+    double drift_ppm;
+    uint64_t seed;
+} octoping_sim_model_t;
+
+int octoping_sim_parse(char const* spec, octoping_sim_model_t* model);
+int octoping_simulate(octoping_options_t* options);
+
+/*
+* Agent, for programs that embed octoping, e.g., a monitoring agent
+* running many probe sessions in one process. The agent owns the
+* sessions, each with its own socket, schedules their sends on a timer
+* wheel, and waits for the echoes and the next send with an epoll
+* descriptor, returned by octoping_agent_fd, that becomes readable when
+* there is work to do. The program integrates it in its own event loop,
+* and calls octoping_agent_step, which never blocks, when the descriptor
+* is readable or at octoping_agent_next_time. Each result is passed to
+* the result function of the agent; when a session ends, after its last
+* probe was echoed or declared lost, the function is called once with a
+* NULL result, and the session is then deleted. The result function may
+* add sessions, but must not remove them. The agent is only available on
+* Linux.
+*/
+#ifdef OCTOPING_HAS_EPOLL
+#define OCTOPING_AGENT_TICK 100000
+#define OCTOPING_AGENT_EVENTS 256
+
+typedef struct st_octoping_session_config_t {
+    struct sockaddr_in addr_to;
+    char const* label;
+    uint16_t source_port;
+    int timestamps;
+    int wire_version;
+    uint64_t interval_ns;
+    uint64_t duration_ns;
+    int burst_size;
+    uint16_t const* sizes;
+    int nb_sizes;
+    int train_length;
+    void* app_ctx;
+} octoping_session_config_t;
+
+typedef struct st_octoping_agent_entry_t {
+    octoping_session_t session;
+    struct st_octoping_agent_entry_t* next;
+    struct st_octoping_agent_entry_t* previous;
+    uint64_t end_send_time;
+    uint64_t end_time;
+    int is_scheduled;
+} octoping_agent_entry_t;
+
+typedef struct st_octoping_agent_t {
+    octoping_wheel_t wheel;
+    int epfd;
+    int tfd;
+    uint64_t timer_time;
+    octoping_output_t output;
+    octoping_agent_entry_t* first;
+    int nb_sessions;
+    int nb_ending;
+} octoping_agent_t;
+
+octoping_agent_t* octoping_agent_create(octoping_result_fn result_fn, void* callback_ctx);
+void octoping_agent_delete(octoping_agent_t* agent);
+octoping_session_t* octoping_agent_add(octoping_agent_t* agent, octoping_session_config_t const* config);
+void octoping_agent_remove(octoping_agent_t* agent, octoping_session_t* session);
+int octoping_agent_fd(octoping_agent_t const* agent);
+uint64_t octoping_agent_next_time(octoping_agent_t* agent);
+int octoping_agent_step(octoping_agent_t* agent, uint64_t current_time);
+#endif
+
+#endif /* OCTOPING_H */
@@ -0,0 +1,380 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Agent. The sessions are kept in a list of entries, each holding the
+ * session and its scheduling state. A session is scheduled on the wheel
+ * until its last send, then ends when all its probes are echoed, or
+ * after the loss timeout.
+ */
+
+#ifdef OCTOPING_HAS_EPOLL
+static int octoping_agent_arm_timer(octoping_agent_t* agent, uint64_t next_time)
+{
+    int ret = 0;
+
+    if (next_time != agent->timer_time) {
+        struct itimerspec its = { 0 };
+
+        /* A zero value would disarm the timer */
+        if (next_time == 0) {
+            next_time = 1;
+        }
+        if (next_time != UINT64_MAX) {
+            its.it_value.tv_sec = (time_t)(next_time / 1000000000ull);
+            its.it_value.tv_nsec = (long)(next_time % 1000000000ull);
+        }
+        OCTOPING_COUNT_SYSCALL();
+        ret = timerfd_settime(agent->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+        agent->timer_time = next_time;
+    }
+    return ret;
+}
+
+octoping_agent_t* octoping_agent_create(octoping_result_fn result_fn, void* callback_ctx)
+{
+    int ret = 0;
+    octoping_agent_t* agent = (octoping_agent_t*)calloc(1, sizeof(octoping_agent_t));
+
+    if (agent == NULL) {
+        printf("Cannot allocate the agent\n");
+        return NULL;
+    }
+    agent->epfd = -1;
+    agent->tfd = -1;
+    agent->timer_time = UINT64_MAX;
+    octoping_wheel_init(&agent->wheel, OCTOPING_AGENT_TICK, current_time_ns());
+
+    if ((agent->epfd = epoll_create1(0)) < 0 || (agent->tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) < 0) {
+        network_error();
+        printf("Cannot create the epoll and timer descriptors\n");
+        ret = -1;
+    }
+    else {
+        struct epoll_event ev = { 0 };
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(agent->epfd, EPOLL_CTL_ADD, agent->tfd, &ev) != 0) {
+            network_error();
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        if (octoping_output_open(&agent->output, NULL, octoping_format_callback, 0, 1, 0, 0) != 0) {
+            ret = -1;
+        }
+        agent->output.result_fn = result_fn;
+        agent->output.callback_ctx = callback_ctx;
+        agent->output.start_time = current_time_ns();
+        agent->output.window_start = agent->output.start_time;
+    }
+
+    if (ret != 0) {
+        octoping_agent_delete(agent);
+        agent = NULL;
+    }
+    return agent;
+}
+
+/* Delete all the sessions without reporting their results */
+void octoping_agent_delete(octoping_agent_t* agent)
+{
+    if (agent != NULL) {
+        while (agent->first != NULL) {
+            octoping_agent_remove(agent, &agent->first->session);
+        }
+        if (agent->output.window != NULL) {
+            (void)octoping_output_close(&agent->output);
+        }
+        if (agent->tfd >= 0) {
+            close(agent->tfd);
+        }
+        if (agent->epfd >= 0) {
+            close(agent->epfd);
+        }
+        free(agent);
+    }
+}
+
+/* Check the configuration of a session, which comes from the program */
+static int octoping_agent_check_config(octoping_session_config_t const* config)
+{
+    int ret = 0;
+    char const* label = (config->label == NULL) ? "" : config->label;
+
+    if (config->interval_ns == 0) {
+        printf("Invalid interval for %s, must be more than 0\n", label);
+        ret = -1;
+    }
+    else if (config->addr_to.sin_family != AF_INET || config->addr_to.sin_port == 0) {
+        printf("Invalid server address for %s\n", label);
+        ret = -1;
+    }
+    else if (config->nb_sizes < 0 || config->nb_sizes > OCTOPING_MAX_SIZES || (config->nb_sizes > 0 && config->sizes == NULL)) {
+        printf("Invalid probe sizes for %s, at most %d sizes\n", label, OCTOPING_MAX_SIZES);
+        ret = -1;
+    }
+    else {
+        for (int i = 0; ret == 0 && i < config->nb_sizes; i++) {
+            if (config->sizes[i] < 16 || config->sizes[i] > OCTOPING_PACKET_MAX) {
+                printf("Invalid probe size %d for %s, must be 16 to %d bytes\n", config->sizes[i], label,
+                    OCTOPING_PACKET_MAX);
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/*
+ * Add a session, with its own socket bound to the source port, or to an
+ * ephemeral port if it is 0. The first probe is sent at once, and the
+ * agent descriptor becomes readable to signal it. A session with a
+ * duration of 0 runs until it is removed. Returns NULL if the
+ * configuration is not valid.
+ */
+octoping_session_t* octoping_agent_add(octoping_agent_t* agent, octoping_session_config_t const* config)
+{
+    int ret = 0;
+    uint64_t start_time = current_time_ns();
+    octoping_agent_entry_t* entry;
+    SOCKET_TYPE s;
+    struct epoll_event ev = { 0 };
+
+    if (config == NULL || octoping_agent_check_config(config) != 0) {
+        return NULL;
+    }
+    entry = (octoping_agent_entry_t*)malloc(sizeof(octoping_agent_entry_t));
+    s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (entry == NULL || s == INVALID_SOCKET) {
+        network_error();
+        printf("Cannot create the session for %s\n", (config->label == NULL) ? "" : config->label);
+        if (s != INVALID_SOCKET) {
+            SOCKET_CLOSE(s);
+        }
+        free(entry);
+        return NULL;
+    }
+    if (config->source_port != 0) {
+        struct sockaddr_in addr = { 0 };
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config->source_port);
+        if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            network_error();
+            printf("Cannot bind the session socket to port %d\n", config->source_port);
+            ret = -1;
+        }
+    }
+    if (octoping_session_init(&entry->session, s, &config->addr_to, config->label, 0, config->timestamps, start_time) != 0) {
+        printf("Cannot initialize the session\n");
+        ret = -1;
+    }
+    else {
+        octoping_session_t* session = &entry->session;
+
+        session->app_ctx = config->app_ctx;
+        octoping_session_set_probes(session, config->sizes, config->nb_sizes, config->train_length);
+        session->wire_v2 = (config->wire_version == 2);
+        octoping_pacer_init(&session->pacer, start_time, config->interval_ns,
+            (config->train_length > 1) ? config->train_length : config->burst_size);
+        entry->end_send_time = (config->duration_ns > 0) ? start_time + config->duration_ns : UINT64_MAX;
+        entry->end_time = UINT64_MAX;
+        entry->is_scheduled = 1;
+        entry->previous = NULL;
+        entry->next = NULL;
+#ifdef OCTOPING_HAS_TIMESTAMPING
+        if (ret == 0 && config->timestamps && octoping_enable_timestamps(s, 1) != 0) {
+            ret = -1;
+        }
+#endif
+        ev.events = EPOLLIN;
+        ev.data.ptr = session;
+        if (ret == 0 && epoll_ctl(agent->epfd, EPOLL_CTL_ADD, s, &ev) != 0) {
+            network_error();
+            ret = -1;
+        }
+        if (ret != 0) {
+            octoping_session_release(session);
+        }
+    }
+
+    if (ret != 0) {
+        SOCKET_CLOSE(s);
+        free(entry);
+        return NULL;
+    }
+
+    octoping_wheel_insert(&agent->wheel, &entry->session.timer, entry->session.pacer.next_time);
+    entry->next = agent->first;
+    if (agent->first != NULL) {
+        agent->first->previous = entry;
+    }
+    agent->first = entry;
+    agent->nb_sessions++;
+    /* Wake up the event loop for the first send */
+    if (octoping_agent_arm_timer(agent, octoping_agent_next_time(agent)) != 0) {
+        network_error();
+        printf("Cannot arm the timer\n");
+    }
+    return &entry->session;
+}
+
+/* Remove a session, without reporting the probes still in flight */
+void octoping_agent_remove(octoping_agent_t* agent, octoping_session_t* session)
+{
+    octoping_agent_entry_t* entry = (octoping_agent_entry_t*)session;
+
+    if (entry->is_scheduled) {
+        octoping_wheel_remove(&agent->wheel, &session->timer);
+    }
+    else {
+        agent->nb_ending--;
+    }
+    if (entry->previous == NULL) {
+        agent->first = entry->next;
+    }
+    else {
+        entry->previous->next = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->previous = entry->previous;
+    }
+    agent->nb_sessions--;
+    (void)epoll_ctl(agent->epfd, EPOLL_CTL_DEL, session->s, NULL);
+    SOCKET_CLOSE(session->s);
+    octoping_session_release(session);
+    free(entry);
+}
+
+int octoping_agent_fd(octoping_agent_t const* agent)
+{
+    return agent->epfd;
+}
+
+/* Time of the next send or session end, or UINT64_MAX if there is none */
+uint64_t octoping_agent_next_time(octoping_agent_t* agent)
+{
+    uint64_t next_time = octoping_wheel_next_time(&agent->wheel);
+
+    if (agent->nb_ending > 0) {
+        for (octoping_agent_entry_t* entry = agent->first; entry != NULL; entry = entry->next) {
+            if (!entry->is_scheduled && entry->end_time < next_time) {
+                next_time = entry->end_time;
+            }
+        }
+    }
+    return next_time;
+}
+
+/*
+ * Process the echoes received, send the probes that are due by
+ * current_time, and end the sessions that are complete. The probes are
+ * stamped with the time at which they are sent. Returns the number of
+ * sessions still running, or -1 if an error occurred.
+ */
+int octoping_agent_step(octoping_agent_t* agent, uint64_t current_time)
+{
+    int ret = 0;
+    struct epoll_event events[OCTOPING_AGENT_EVENTS];
+    octoping_timer_t* timer;
+    int nb_events;
+
+    OCTOPING_COUNT_SYSCALL();
+    nb_events = epoll_wait(agent->epfd, events, OCTOPING_AGENT_EVENTS, 0);
+    if (nb_events < 0 && errno != EINTR) {
+        network_error();
+        printf("Error: epoll_wait returns %d\n", nb_events);
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < nb_events; i++) {
+        octoping_session_t* session = (octoping_session_t*)events[i].data.ptr;
+
+        if (session == NULL) {
+            uint64_t expirations;
+
+            OCTOPING_COUNT_SYSCALL();
+            (void)read(agent->tfd, &expirations, sizeof(expirations));
+            /* The timer must be armed again even for the same time */
+            agent->timer_time = UINT64_MAX;
+        }
+        else {
+            int r;
+            while ((r = octoping_session_receive(session, MSG_DONTWAIT, &agent->output)) > 0);
+            if (r < 0) {
+                printf("Error while processing echo from %s\n", session->label);
+                ret = -1;
+            }
+        }
+    }
+
+    while (ret == 0 && (timer = octoping_wheel_next_expired(&agent->wheel, current_time)) != NULL) {
+        octoping_agent_entry_t* entry = (octoping_agent_entry_t*)timer->app_ctx;
+        octoping_session_t* session = &entry->session;
+
+        /* Send the whole burst back to back, each probe stamped with its own send time */
+        do {
+            uint64_t send_time = current_time_ns();
+
+            ret = octoping_session_send(session, send_time, &agent->output);
+            octoping_pacer_on_send(&session->pacer, send_time);
+        } while (ret == 0 && session->pacer.burst_sent != 0);
+        if (session->pacer.next_time <= entry->end_send_time) {
+            octoping_wheel_insert(&agent->wheel, &session->timer, session->pacer.next_time);
+        }
+        else {
+            entry->is_scheduled = 0;
+            entry->end_time = current_time + OCTOPING_LOSS_TIMEOUT;
+            agent->nb_ending++;
+        }
+    }
+
+    if (ret == 0 && agent->nb_ending > 0) {
+        octoping_agent_entry_t* entry = agent->first;
+
+        while (ret == 0 && entry != NULL) {
+            octoping_agent_entry_t* next = entry->next;
+
+            if (!entry->is_scheduled &&
+                (current_time >= entry->end_time || octoping_tracker_nb_pending(&entry->session.tracker) == 0)) {
+                if (octoping_session_report_missing(&entry->session, &agent->output) != 0 ||
+                    agent->output.result_fn(agent->output.callback_ctx, &entry->session, NULL) != 0) {
+                    ret = -1;
+                }
+                octoping_agent_remove(agent, &entry->session);
+            }
+            entry = next;
+        }
+    }
+
+    if (ret == 0 && octoping_agent_arm_timer(agent, octoping_agent_next_time(agent)) != 0) {
+        network_error();
+        printf("Cannot arm the timer\n");
+        ret = -1;
+    }
+
+    return (ret == 0) ? agent->nb_sessions : -1;
+}
+#endif
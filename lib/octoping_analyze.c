@@ -0,0 +1,727 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Offline analyzer. The CSV file is mapped in memory and split in
+ * chunks of about the same size, starting at line boundaries. Each
+ * thread parses one chunk, and keeps its own statistics, windows, loss
+ * runs and reordering state. The main thread then merges the chunks in
+ * file order, joining the loss runs and counting the reordered echoes
+ * that span chunk boundaries.
+ */
+
+#ifndef _WINDOWS
+#define OCTOPING_ANALYZE_MAX_FIELDS 16
+#define OCTOPING_ANALYZE_MAX_WINDOWS (1 << 20)
+#define OCTOPING_BURST_BUCKETS 32
+
+typedef struct st_octoping_window_t {
+    uint64_t nb_echoes;
+    uint64_t nb_lost;
+    double phase_sum;
+    octoping_histogram_t rtt;
+} octoping_window_t;
+
+typedef struct st_octoping_bursts_t {
+    uint64_t nb_bursts;
+    uint64_t nb_lost;
+    uint64_t max_length;
+    uint64_t buckets[OCTOPING_BURST_BUCKETS];
+} octoping_bursts_t;
+
+typedef struct st_octoping_chunk_t {
+    char const* start;
+    char const* end;
+    int with_label;
+    int64_t unit;
+    int wire_field;
+    int dwell_field;
+    uint64_t window_ns;
+    uint64_t nb_results;
+    int64_t last_rtt;
+    octoping_stats_t stats;
+    /* Windows, from window_base to window_base + nb_windows - 1 */
+    octoping_window_t* windows;
+    uint64_t window_base;
+    size_t nb_windows;
+    size_t windows_allocated;
+    /* Linear regression of the phase (us) over the send time (s) */
+    double phase_n;
+    double phase_x;
+    double phase_y;
+    double phase_xy;
+    double phase_xx;
+    double first_sent;
+    double last_sent;
+    /* New highest sequence numbers, in order, and where the prefix stopped */
+    int has_echo;
+    uint64_t max_seq;
+    int nb_prefix;
+    char const* prefix_end;
+    uint64_t prefix[OCTOPING_ANALYZE_PREFIX];
+    /* Runs of lost probes with consecutive numbers */
+    uint64_t nb_runs;
+    uint64_t first_start;
+    uint64_t first_length;
+    uint64_t run_start;
+    uint64_t run_length;
+    octoping_bursts_t bursts;
+    int ret;
+    pthread_t thread;
+} octoping_chunk_t;
+
+/*
+ * Parse a decimal integer, then skip to the next field. Anything that
+ * is not part of the number is skipped, so the parser always moves on.
+ */
+static char const* octoping_analyze_int(char const* p, char const* end, int64_t* value)
+{
+    int64_t x = 0;
+    int is_negative = 0;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (p < end && *p == '-') {
+        is_negative = 1;
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        x = 10 * x + (*p - '0');
+        p++;
+    }
+    while (p < end && *p != ',') {
+        p++;
+    }
+    if (p < end) {
+        p++;
+    }
+    *value = (is_negative) ? -x : x;
+    return p;
+}
+
+/* Parse the fields of a result line, or return -1 for other lines */
+static int octoping_analyze_fields(char const* p, char const* end, int with_label, int64_t* fields)
+{
+    int nb_fields = 0;
+
+    if (with_label) {
+        while (p < end && *p != ',') {
+            p++;
+        }
+        p++;
+    }
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    while (p < end && nb_fields < OCTOPING_ANALYZE_MAX_FIELDS) {
+        p = octoping_analyze_int(p, end, &fields[nb_fields++]);
+    }
+    return (nb_fields >= 8) ? nb_fields : -1;
+}
+
+static char const* octoping_analyze_eol(char const* p, char const* end)
+{
+    char const* eol = (char const*)memchr(p, '\n', (size_t)(end - p));
+    return (eol == NULL) ? end : eol;
+}
+
+static octoping_window_t* octoping_analyze_window(octoping_chunk_t* chunk, uint64_t index)
+{
+    if (chunk->nb_windows == 0) {
+        chunk->window_base = index;
+    }
+    if (index < chunk->window_base) {
+        size_t shift = (size_t)(chunk->window_base - index);
+
+        if (chunk->nb_windows + shift > OCTOPING_ANALYZE_MAX_WINDOWS) {
+            return NULL;
+        }
+        if (chunk->nb_windows + shift > chunk->windows_allocated) {
+            octoping_window_t* windows = (octoping_window_t*)realloc(chunk->windows,
+                (chunk->nb_windows + shift) * sizeof(octoping_window_t));
+            if (windows == NULL) {
+                return NULL;
+            }
+            chunk->windows = windows;
+            chunk->windows_allocated = chunk->nb_windows + shift;
+        }
+        memmove(chunk->windows + shift, chunk->windows, chunk->nb_windows * sizeof(octoping_window_t));
+        memset(chunk->windows, 0, shift * sizeof(octoping_window_t));
+        chunk->nb_windows += shift;
+        chunk->window_base = index;
+    }
+    else if (index - chunk->window_base >= chunk->nb_windows) {
+        size_t nb_windows = (size_t)(index - chunk->window_base) + 1;
+
+        if (nb_windows > OCTOPING_ANALYZE_MAX_WINDOWS) {
+            return NULL;
+        }
+        if (nb_windows > chunk->windows_allocated) {
+            size_t allocated = (2 * chunk->windows_allocated > nb_windows) ? 2 * chunk->windows_allocated : nb_windows;
+            octoping_window_t* windows = (octoping_window_t*)realloc(chunk->windows, allocated * sizeof(octoping_window_t));
+            if (windows == NULL) {
+                return NULL;
+            }
+            chunk->windows = windows;
+            chunk->windows_allocated = allocated;
+        }
+        memset(chunk->windows + chunk->nb_windows, 0, (nb_windows - chunk->nb_windows) * sizeof(octoping_window_t));
+        chunk->nb_windows = nb_windows;
+    }
+    return &chunk->windows[index - chunk->window_base];
+}
+
+static void octoping_bursts_add(octoping_bursts_t* bursts, uint64_t length)
+{
+    int bucket = 0;
+
+    while (bucket < OCTOPING_BURST_BUCKETS - 1 && (length >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    bursts->nb_bursts++;
+    bursts->nb_lost += length;
+    bursts->buckets[bucket]++;
+    if (length > bursts->max_length) {
+        bursts->max_length = length;
+    }
+}
+
+/*
+ * Lost probes are reported in sequence order. The first and the last run
+ * of a chunk may continue in the neighboring chunks, so they are only
+ * counted when the chunks are merged.
+ */
+static void octoping_analyze_lost(octoping_chunk_t* chunk, uint64_t seqnum)
+{
+    if (chunk->run_length > 0 && seqnum == chunk->run_start + chunk->run_length) {
+        chunk->run_length++;
+    }
+    else {
+        if (chunk->run_length > 0) {
+            if (chunk->nb_runs == 1) {
+                chunk->first_start = chunk->run_start;
+                chunk->first_length = chunk->run_length;
+            }
+            else {
+                octoping_bursts_add(&chunk->bursts, chunk->run_length);
+            }
+        }
+        chunk->run_start = seqnum;
+        chunk->run_length = 1;
+        chunk->nb_runs++;
+    }
+}
+
+static void octoping_analyze_result(octoping_chunk_t* chunk, int64_t const* fields, int nb_fields, char const* line)
+{
+    octoping_result_t result;
+    octoping_window_t* window;
+
+    memset(&result, 0, sizeof(result));
+    result.seqnum = (uint64_t)fields[0];
+    result.sent = fields[1] * chunk->unit;
+    if (fields[3] == 0 && fields[4] == 0) {
+        result.flags = OCTOPING_RESULT_LOST;
+    }
+    else {
+        result.received = fields[2] * chunk->unit;
+        result.echo = fields[3] * chunk->unit;
+        result.rtt = fields[4] * chunk->unit;
+        result.up_t = fields[5] * chunk->unit;
+        result.down_t = fields[6] * chunk->unit;
+        result.phase = fields[7] * chunk->unit;
+        if (chunk->unit == 1 && nb_fields > chunk->wire_field + 1 && fields[chunk->wire_field] > 0) {
+            result.wire_rtt = fields[chunk->wire_field];
+            result.flags = OCTOPING_RESULT_KERNEL_TS;
+        }
+        if (chunk->dwell_field > 0 && nb_fields > chunk->dwell_field + 1) {
+            result.dwell = fields[chunk->dwell_field] * chunk->unit;
+            result.net_rtt = fields[chunk->dwell_field + 1] * chunk->unit;
+            result.flags |= OCTOPING_RESULT_DWELL;
+        }
+    }
+
+    window = octoping_analyze_window(chunk, (result.sent > 0) ? (uint64_t)result.sent / chunk->window_ns : 0);
+    if (window == NULL) {
+        printf("Cannot allocate the window at %.3f s\n", ((double)result.sent) / 1000000000.0);
+        chunk->ret = -1;
+        return;
+    }
+    chunk->nb_results++;
+    if (chunk->with_label) {
+        /* Successive lines may come from different targets */
+        chunk->last_rtt = -1;
+    }
+    octoping_stats_add(&chunk->stats, &result, &chunk->last_rtt);
+
+    if ((result.flags & OCTOPING_RESULT_LOST) != 0) {
+        window->nb_lost++;
+        if (!chunk->with_label) {
+            octoping_analyze_lost(chunk, result.seqnum);
+        }
+    }
+    else {
+        double x = ((double)result.sent) / 1000000000.0;
+        double y = ((double)result.phase) / 1000.0;
+
+        window->nb_echoes++;
+        window->phase_sum += y;
+        if (result.rtt > 0) {
+            octoping_histogram_add(&window->rtt, (uint64_t)result.rtt);
+        }
+        if (chunk->phase_n == 0 || x < chunk->first_sent) {
+            chunk->first_sent = x;
+        }
+        if (chunk->phase_n == 0 || x > chunk->last_sent) {
+            chunk->last_sent = x;
+        }
+        chunk->phase_n += 1.0;
+        chunk->phase_x += x;
+        chunk->phase_y += y;
+        chunk->phase_xy += x * y;
+        chunk->phase_xx += x * x;
+
+        if (!chunk->with_label) {
+            if (!chunk->has_echo || result.seqnum > chunk->max_seq) {
+                if (chunk->nb_prefix < OCTOPING_ANALYZE_PREFIX) {
+                    chunk->prefix[chunk->nb_prefix++] = result.seqnum;
+                }
+                else if (chunk->prefix_end == NULL) {
+                    chunk->prefix_end = line;
+                }
+                chunk->max_seq = result.seqnum;
+                chunk->has_echo = 1;
+            }
+            else {
+                chunk->stats.nb_reordered++;
+            }
+        }
+    }
+}
+
+static void* octoping_analyze_thread(void* arg)
+{
+    octoping_chunk_t* chunk = (octoping_chunk_t*)arg;
+    char const* p = chunk->start;
+    int64_t fields[OCTOPING_ANALYZE_MAX_FIELDS];
+
+    while (p < chunk->end && chunk->ret == 0) {
+        char const* eol = octoping_analyze_eol(p, chunk->end);
+        int nb_fields = octoping_analyze_fields(p, eol, chunk->with_label, fields);
+
+        if (nb_fields > 0) {
+            octoping_analyze_result(chunk, fields, nb_fields, p);
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Count the echoes of the chunk that are reordered relative to the
+ * previous chunks, i.e., the new highest numbers of the chunk that are
+ * below the highest number seen before. These numbers increase, so they
+ * are found at the start of the prefix, and if the whole prefix is below
+ * the previous highest number, the chunk is scanned again from the end
+ * of the prefix.
+ */
+static uint64_t octoping_analyze_reordered(octoping_chunk_t const* chunk, uint64_t previous_max)
+{
+    uint64_t nb_reordered = 0;
+
+    while (nb_reordered < (uint64_t)chunk->nb_prefix && chunk->prefix[nb_reordered] < previous_max) {
+        nb_reordered++;
+    }
+    if (nb_reordered == OCTOPING_ANALYZE_PREFIX && chunk->prefix_end != NULL) {
+        char const* p = chunk->prefix_end;
+        uint64_t running_max = chunk->prefix[OCTOPING_ANALYZE_PREFIX - 1];
+        int64_t fields[OCTOPING_ANALYZE_MAX_FIELDS];
+
+        while (p < chunk->end) {
+            char const* eol = octoping_analyze_eol(p, chunk->end);
+
+            if (octoping_analyze_fields(p, eol, chunk->with_label, fields) > 0 &&
+                !(fields[3] == 0 && fields[4] == 0) && (uint64_t)fields[0] > running_max) {
+                running_max = (uint64_t)fields[0];
+                if (running_max >= previous_max) {
+                    break;
+                }
+                nb_reordered++;
+            }
+            p = eol + 1;
+        }
+    }
+    return nb_reordered;
+}
+
+static void octoping_bursts_merge(octoping_bursts_t* total, octoping_bursts_t const* bursts)
+{
+    total->nb_bursts += bursts->nb_bursts;
+    total->nb_lost += bursts->nb_lost;
+    if (bursts->max_length > total->max_length) {
+        total->max_length = bursts->max_length;
+    }
+    for (int i = 0; i < OCTOPING_BURST_BUCKETS; i++) {
+        total->buckets[i] += bursts->buckets[i];
+    }
+}
+
+/* Join a run with the open run if they are contiguous, or close the open run */
+static void octoping_bursts_join(octoping_bursts_t* bursts, uint64_t* open_start, uint64_t* open_length,
+    uint64_t start, uint64_t length)
+{
+    if (*open_length > 0 && *open_start + *open_length == start) {
+        *open_length += length;
+    }
+    else {
+        if (*open_length > 0) {
+            octoping_bursts_add(bursts, *open_length);
+        }
+        *open_start = start;
+        *open_length = length;
+    }
+}
+
+static int octoping_bursts_print(FILE* F, octoping_bursts_t const* bursts)
+{
+    int ret = 0;
+
+    if (fprintf(F, "Loss bursts: %" PRIu64 " bursts, mean %.2f, max %" PRIu64 " packets\n", bursts->nb_bursts,
+        (bursts->nb_bursts > 0) ? ((double)bursts->nb_lost) / ((double)bursts->nb_bursts) : 0.0, bursts->max_length) < 0) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < OCTOPING_BURST_BUCKETS; i++) {
+        if (bursts->buckets[i] > 0) {
+            uint64_t low = 1ull << i;
+            uint64_t high = (2ull << i) - 1;
+
+            if ((low == high) ? fprintf(F, "    length %" PRIu64 ": %" PRIu64 "\n", low, bursts->buckets[i]) < 0 :
+                fprintf(F, "    length %" PRIu64 "-%" PRIu64 ": %" PRIu64 "\n", low, high, bursts->buckets[i]) < 0) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/* Write the windows in order, merging the windows of all the chunks */
+static int octoping_analyze_windows(FILE* F, octoping_chunk_t const* chunks, int nb_chunks, uint64_t window_ns)
+{
+    int ret = 0;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    octoping_window_t* window = (octoping_window_t*)malloc(sizeof(octoping_window_t));
+
+    if (window == NULL) {
+        printf("Cannot allocate the windows\n");
+        return -1;
+    }
+    for (int i = 0; i < nb_chunks; i++) {
+        if (chunks[i].nb_windows > 0) {
+            if (chunks[i].window_base < first) {
+                first = chunks[i].window_base;
+            }
+            if (chunks[i].window_base + chunks[i].nb_windows - 1 > last) {
+                last = chunks[i].window_base + chunks[i].nb_windows - 1;
+            }
+        }
+    }
+    if (fprintf(F, "start, echoes, lost, rtt_min, rtt_p50, rtt_p90, rtt_p99, rtt_max, phase\n") < 0) {
+        ret = -1;
+    }
+    for (uint64_t index = first; ret == 0 && first <= last && index <= last; index++) {
+        memset(window, 0, sizeof(octoping_window_t));
+        for (int i = 0; i < nb_chunks; i++) {
+            if (chunks[i].nb_windows > 0 && index >= chunks[i].window_base &&
+                index < chunks[i].window_base + chunks[i].nb_windows) {
+                octoping_window_t const* chunk_window = &chunks[i].windows[index - chunks[i].window_base];
+
+                window->nb_echoes += chunk_window->nb_echoes;
+                window->nb_lost += chunk_window->nb_lost;
+                window->phase_sum += chunk_window->phase_sum;
+                octoping_histogram_merge(&window->rtt, &chunk_window->rtt);
+            }
+        }
+        if (window->nb_echoes + window->nb_lost > 0 &&
+            fprintf(F, "%.3f, %" PRIu64 ", %" PRIu64 ", %.3f, %.3f, %.3f, %.3f, %.3f, %.3f\n",
+                ((double)(index * window_ns)) / 1000000000.0, window->nb_echoes, window->nb_lost,
+                ((double)window->rtt.min) / 1000.0,
+                ((double)octoping_histogram_percentile(&window->rtt, 0.5)) / 1000.0,
+                ((double)octoping_histogram_percentile(&window->rtt, 0.9)) / 1000.0,
+                ((double)octoping_histogram_percentile(&window->rtt, 0.99)) / 1000.0,
+                ((double)window->rtt.max) / 1000.0,
+                (window->nb_echoes > 0) ? window->phase_sum / (double)window->nb_echoes : 0.0) < 0) {
+            ret = -1;
+        }
+    }
+    free(window);
+    return ret;
+}
+
+int octoping_analyze(octoping_options_t* options)
+{
+    int ret = 0;
+    int fd = -1;
+    struct stat st;
+    char const* data = NULL;
+    size_t data_size = 0;
+    char const* body;
+    int with_label = 0;
+    int64_t unit = 1000;
+    int wire_field = 8;
+    int dwell_field = 0;
+    int nb_chunks = (options->nb_threads > 0) ? options->nb_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int nb_started = 0;
+    uint64_t window_ns = (options->summary_interval_ns > 0) ? options->summary_interval_ns : OCTOPING_ANALYZE_WINDOW;
+    uint64_t start_time = current_time_ns();
+    octoping_chunk_t* chunks = NULL;
+    octoping_stats_t* total = NULL;
+    FILE* F = NULL;
+
+    if ((fd = open(options->analyze_file, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        printf("Cannot open %s\n", options->analyze_file);
+        ret = -1;
+    }
+    else if (st.st_size == 0) {
+        printf("%s is empty\n", options->analyze_file);
+        ret = -1;
+    }
+    else {
+        data_size = (size_t)st.st_size;
+        data = (char const*)mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ((void*)data == MAP_FAILED) {
+            printf("Cannot map %s in memory\n", options->analyze_file);
+            data = NULL;
+            ret = -1;
+        }
+        else {
+            (void)madvise((void*)data, data_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    if (ret == 0) {
+        /* The header tells whether there is a target column, and whether times are in nanoseconds */
+        char const* eol = octoping_analyze_eol(data, data + data_size);
+
+        body = data;
+        if (data[0] < '0' || data[0] > '9') {
+            size_t header_length = (size_t)(eol - data);
+
+            with_label = (header_length >= 6 && memcmp(data, "target", 6) == 0);
+            for (size_t i = 0, nb_commas = 0; i + 8 <= header_length; i++) {
+                if (data[i] == ',') {
+                    nb_commas++;
+                }
+                else if (memcmp(data + i, "wire_rtt", 8) == 0) {
+                    unit = 1;
+                }
+                else if (memcmp(data + i, " drift,", 7) == 0) {
+                    /* Files written since the drift was added have it before the wire_rtt */
+                    wire_field = 9;
+                }
+                else if (memcmp(data + i, " dwell,", 7) == 0) {
+                    /* The fields of the result lines do not count the target column */
+                    dwell_field = (int)nb_commas - with_label;
+                }
+            }
+            body = (eol < data + data_size) ? eol + 1 : eol;
+        }
+
+        if (nb_chunks < 1) {
+            nb_chunks = 1;
+        }
+        if (nb_chunks > OCTOPING_MAX_THREADS) {
+            nb_chunks = OCTOPING_MAX_THREADS;
+        }
+        if ((size_t)nb_chunks > data_size / OCTOPING_ANALYZE_MIN_CHUNK) {
+            nb_chunks = (data_size / OCTOPING_ANALYZE_MIN_CHUNK > 0) ? (int)(data_size / OCTOPING_ANALYZE_MIN_CHUNK) : 1;
+        }
+        if ((chunks = (octoping_chunk_t*)calloc((size_t)nb_chunks, sizeof(octoping_chunk_t))) == NULL ||
+            (total = (octoping_stats_t*)calloc(1, sizeof(octoping_stats_t))) == NULL) {
+            printf("Cannot allocate %d chunks\n", nb_chunks);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        char const* end = data + data_size;
+        size_t body_size = (size_t)(end - body);
+
+        for (int i = 0; i < nb_chunks; i++) {
+            chunks[i].with_label = with_label;
+            chunks[i].unit = unit;
+            chunks[i].wire_field = wire_field;
+            chunks[i].dwell_field = dwell_field;
+            chunks[i].window_ns = window_ns;
+            chunks[i].last_rtt = -1;
+            if (i == 0) {
+                chunks[i].start = body;
+            }
+            else {
+                /* Start after the end of the line that crosses the boundary */
+                char const* p = body + (body_size / (size_t)nb_chunks) * (size_t)i;
+                char const* eol = octoping_analyze_eol(p - 1, end);
+
+                chunks[i].start = (eol < end) ? eol + 1 : end;
+                if (chunks[i].start < chunks[i - 1].start) {
+                    chunks[i].start = chunks[i - 1].start;
+                }
+            }
+            if (i > 0) {
+                chunks[i - 1].end = chunks[i].start;
+            }
+        }
+        chunks[nb_chunks - 1].end = end;
+
+        for (; nb_started < nb_chunks; nb_started++) {
+            if (pthread_create(&chunks[nb_started].thread, NULL, octoping_analyze_thread, &chunks[nb_started]) != 0) {
+                printf("Cannot start analysis thread %d\n", nb_started);
+                ret = -1;
+                break;
+            }
+        }
+        for (int i = 0; i < nb_started; i++) {
+            (void)pthread_join(chunks[i].thread, NULL);
+            if (chunks[i].ret != 0) {
+                ret = chunks[i].ret;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        uint64_t nb_results = 0;
+        uint64_t previous_max = 0;
+        int has_previous = 0;
+        uint64_t open_start = 0;
+        uint64_t open_length = 0;
+        octoping_bursts_t bursts;
+        double n = 0, sx = 0, sy = 0, sxy = 0, sxx = 0;
+        double first_sent = 0;
+        double last_sent = 0;
+        double elapsed;
+
+        memset(&bursts, 0, sizeof(bursts));
+        for (int i = 0; i < nb_chunks; i++) {
+            octoping_chunk_t* chunk = &chunks[i];
+
+            if (!with_label) {
+                if (has_previous && chunk->has_echo) {
+                    chunk->stats.nb_reordered += octoping_analyze_reordered(chunk, previous_max);
+                }
+                if (chunk->has_echo && (!has_previous || chunk->max_seq > previous_max)) {
+                    previous_max = chunk->max_seq;
+                    has_previous = 1;
+                }
+                if (chunk->nb_runs > 1) {
+                    octoping_bursts_join(&bursts, &open_start, &open_length, chunk->first_start, chunk->first_length);
+                    octoping_bursts_join(&bursts, &open_start, &open_length, chunk->run_start, chunk->run_length);
+                }
+                else if (chunk->nb_runs == 1) {
+                    octoping_bursts_join(&bursts, &open_start, &open_length, chunk->run_start, chunk->run_length);
+                }
+                octoping_bursts_merge(&bursts, &chunk->bursts);
+            }
+            octoping_stats_merge(total, &chunk->stats);
+            nb_results += chunk->nb_results;
+            if (chunk->phase_n > 0) {
+                if (n == 0 || chunk->first_sent < first_sent) {
+                    first_sent = chunk->first_sent;
+                }
+                if (n == 0 || chunk->last_sent > last_sent) {
+                    last_sent = chunk->last_sent;
+                }
+            }
+            n += chunk->phase_n;
+            sx += chunk->phase_x;
+            sy += chunk->phase_y;
+            sxy += chunk->phase_xy;
+            sxx += chunk->phase_xx;
+        }
+        if (open_length > 0) {
+            octoping_bursts_add(&bursts, open_length);
+        }
+
+        if ((F = octoping_open_output(options->file_name)) == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = octoping_analyze_windows(F, chunks, nb_chunks, window_ns);
+            if (F != stdout) {
+                (void)fclose(F);
+            }
+            else {
+                fflush(stdout);
+            }
+        }
+
+        elapsed = ((double)(current_time_ns() - start_time)) / 1000000000.0;
+        printf("Analyzed %" PRIu64 " results, %.1f MB in %.3f s with %d threads, %.1f MB/s\n", nb_results,
+            ((double)data_size) / 1000000.0, elapsed, nb_chunks, ((double)data_size) / (1000000.0 * elapsed));
+        (void)octoping_stats_print(stdout, "Total", total);
+        if (with_label) {
+            printf("Loss bursts and reordering are not computed for files with several targets.\n");
+        }
+        else {
+            (void)octoping_bursts_print(stdout, &bursts);
+        }
+        if (n >= 2 && n * sxx - sx * sx > 0) {
+            /* The phase is in microseconds and the time in seconds, so the slope is in ppm */
+            double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+            double duration = last_sent - first_sent;
+
+            printf("Phase drift: %.3f ppm, %.3f us over %.1f s\n", slope, slope * duration, duration);
+        }
+    }
+
+    if (chunks != NULL) {
+        for (int i = 0; i < nb_chunks; i++) {
+            free(chunks[i].windows);
+        }
+        free(chunks);
+    }
+    free(total);
+    if (data != NULL) {
+        (void)munmap((void*)data, data_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ret;
+}
+#else
+int octoping_analyze(octoping_options_t* options)
+{
+    (void)options;
+    printf("The analysis of result files is not supported on this platform.\n");
+    return -1;
+}
+#endif
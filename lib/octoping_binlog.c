@@ -0,0 +1,310 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Binary log. All numbers are written in little endian order.
+ *
+ * The header is:
+ *     magic          8 bytes, "OCTOPBIN"
+ *     version        32 bits
+ *     header_size    32 bits, including the target labels
+ *     record_size    32 bits
+ *     flags          32 bits, OCTOPING_BINLOG_TIMESTAMPS, OCTOPING_BINLOG_LABELS,
+ *                    OCTOPING_BINLOG_SIZES, OCTOPING_BINLOG_DWELL
+ *     start_time     64 bits, nanoseconds since the epoch
+ *     interval_ns    64 bits
+ *     duration_us    64 bits
+ *     burst_size     32 bits
+ *     nb_targets     32 bits
+ * followed by nb_targets labels of OCTOPING_LABEL_MAX bytes, "address:port",
+ * or "address:port/source_port" in load mode, padded with zeroes.
+ *
+ * Each record is:
+ *     seqnum, sent, wire_sent, received, wire_echo, echo, phase  64 bits each
+ *     flags          16 bits
+ *     length         16 bits, the probe size
+ *     target_index   32 bits
+ *     drift          64 bits, in ppb, since version 2
+ *     dwell          64 bits, only with OCTOPING_BINLOG_DWELL
+ * The derived values are recomputed when the log is read. Readers skip
+ * the end of records longer than they expect, and still read the logs of
+ * version 1, without the drift.
+ */
+
+static uint8_t* octoping_binlog_put_32(uint8_t* bytes, uint32_t x)
+{
+    for (int i = 0; i < 4; i++) {
+        *bytes++ = (uint8_t)x;
+        x >>= 8;
+    }
+    return bytes;
+}
+
+static uint8_t* octoping_binlog_put_64(uint8_t* bytes, uint64_t x)
+{
+    for (int i = 0; i < 8; i++) {
+        *bytes++ = (uint8_t)x;
+        x >>= 8;
+    }
+    return bytes;
+}
+
+static uint32_t octoping_binlog_get_32(uint8_t const* bytes)
+{
+    uint32_t x = 0;
+    for (int i = 3; i >= 0; i--) {
+        x <<= 8;
+        x |= bytes[i];
+    }
+    return x;
+}
+
+static uint64_t octoping_binlog_get_64(uint8_t const* bytes)
+{
+    uint64_t x = 0;
+    for (int i = 7; i >= 0; i--) {
+        x <<= 8;
+        x |= bytes[i];
+    }
+    return x;
+}
+
+static int octoping_binlog_write(octoping_output_t* output, uint8_t const* bytes, size_t length)
+{
+    int ret = 0;
+
+    if (output->buffer_used + length > output->buffer_size) {
+        ret = octoping_output_flush(output);
+    }
+    if (ret == 0) {
+        memcpy(output->buffer + output->buffer_used, bytes, length);
+        output->buffer_used += length;
+    }
+    return ret;
+}
+
+int octoping_binlog_header(octoping_output_t* output, octoping_options_t const* options, uint64_t start_time,
+    octoping_session_t const* sessions, size_t nb_sessions)
+{
+    int ret = 0;
+    uint8_t header[OCTOPING_BINLOG_FIXED_HEADER];
+    uint8_t* bytes = header;
+    uint32_t flags = 0;
+
+    if (output->timestamps) {
+        flags |= OCTOPING_BINLOG_TIMESTAMPS;
+    }
+    if (output->with_label) {
+        flags |= OCTOPING_BINLOG_LABELS;
+    }
+    if (output->with_size) {
+        flags |= OCTOPING_BINLOG_SIZES;
+    }
+    if (output->with_dwell) {
+        flags |= OCTOPING_BINLOG_DWELL;
+    }
+    memcpy(bytes, OCTOPING_BINLOG_MAGIC, 8);
+    bytes += 8;
+    bytes = octoping_binlog_put_32(bytes, OCTOPING_BINLOG_VERSION);
+    bytes = octoping_binlog_put_32(bytes, (uint32_t)(OCTOPING_BINLOG_FIXED_HEADER + nb_sessions * OCTOPING_LABEL_MAX));
+    bytes = octoping_binlog_put_32(bytes, (output->with_dwell) ? OCTOPING_BINLOG_DWELL_RECORD_SIZE : OCTOPING_BINLOG_RECORD_SIZE);
+    bytes = octoping_binlog_put_32(bytes, flags);
+    bytes = octoping_binlog_put_64(bytes, start_time);
+    bytes = octoping_binlog_put_64(bytes, options->interval_ns);
+    bytes = octoping_binlog_put_64(bytes, options->duration_us);
+    bytes = octoping_binlog_put_32(bytes, (uint32_t)((options->burst_size > 1) ? options->burst_size : 1));
+    (void)octoping_binlog_put_32(bytes, (uint32_t)nb_sessions);
+    ret = octoping_binlog_write(output, header, sizeof(header));
+
+    for (size_t i = 0; ret == 0 && i < nb_sessions; i++) {
+        uint8_t label[OCTOPING_LABEL_MAX];
+        char address[INET_ADDRSTRLEN];
+
+        memset(label, 0, sizeof(label));
+        if (sessions[i].label[0] != 0) {
+            memcpy(label, sessions[i].label, sizeof(sessions[i].label));
+        }
+        else {
+            (void)snprintf((char*)label, sizeof(label), "%s:%d",
+                inet_ntop(AF_INET, &sessions[i].addr_to.sin_addr, address, sizeof(address)),
+                ntohs(sessions[i].addr_to.sin_port));
+        }
+        ret = octoping_binlog_write(output, label, sizeof(label));
+    }
+    return ret;
+}
+
+int octoping_binlog_record(octoping_output_t* output, octoping_result_t const* result)
+{
+    uint8_t record[OCTOPING_BINLOG_DWELL_RECORD_SIZE];
+    uint8_t* bytes = record;
+
+    bytes = octoping_binlog_put_64(bytes, result->seqnum);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->sent);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->wire_sent);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->received);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->wire_echo);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->echo);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->phase);
+    bytes = octoping_binlog_put_32(bytes, (result->flags & 0xffff) | (result->length << 16));
+    bytes = octoping_binlog_put_32(bytes, result->target_index);
+    bytes = octoping_binlog_put_64(bytes, (uint64_t)result->drift);
+    if (output->with_dwell) {
+        (void)octoping_binlog_put_64(bytes, (uint64_t)result->dwell);
+    }
+
+    return octoping_binlog_write(output, record,
+        (output->with_dwell) ? OCTOPING_BINLOG_DWELL_RECORD_SIZE : OCTOPING_BINLOG_RECORD_SIZE);
+}
+
+static void octoping_binlog_parse_record(uint8_t const* bytes, uint32_t version, int with_dwell, octoping_result_t* result)
+{
+    size_t dwell_offset = OCTOPING_BINLOG_V1_RECORD_SIZE;
+
+    memset(result, 0, sizeof(octoping_result_t));
+    result->seqnum = octoping_binlog_get_64(bytes);
+    result->sent = (int64_t)octoping_binlog_get_64(bytes + 8);
+    result->wire_sent = (int64_t)octoping_binlog_get_64(bytes + 16);
+    result->received = (int64_t)octoping_binlog_get_64(bytes + 24);
+    result->wire_echo = (int64_t)octoping_binlog_get_64(bytes + 32);
+    result->echo = (int64_t)octoping_binlog_get_64(bytes + 40);
+    result->phase = (int64_t)octoping_binlog_get_64(bytes + 48);
+    result->flags = octoping_binlog_get_32(bytes + 56);
+    result->length = result->flags >> 16;
+    result->flags &= 0xffff;
+    result->target_index = octoping_binlog_get_32(bytes + 60);
+    if (version >= 2) {
+        result->drift = (int64_t)octoping_binlog_get_64(bytes + 64);
+        dwell_offset = OCTOPING_BINLOG_RECORD_SIZE;
+    }
+    if (with_dwell) {
+        result->dwell = (int64_t)octoping_binlog_get_64(bytes + dwell_offset);
+    }
+    octoping_result_derive(result);
+}
+
+/*
+ * Convert a binary log to the CSV format that the client would have
+ * produced directly.
+ */
+int octoping_binlog_export(char const* bin_file, char const* csv_file)
+{
+    int ret = 0;
+    FILE* F_bin = NULL;
+    FILE* F_csv = NULL;
+    uint8_t header[OCTOPING_BINLOG_FIXED_HEADER];
+    char* labels = NULL;
+    uint8_t* records = NULL;
+    size_t nb_records_max = OCTOPING_OUTPUT_BUFFER_SIZE / OCTOPING_BINLOG_RECORD_SIZE;
+    uint32_t version = 0;
+    uint32_t min_record_size = 0;
+    uint32_t header_size = 0;
+    uint32_t record_size = 0;
+    uint32_t flags = 0;
+    uint32_t nb_targets = 0;
+
+    if ((F_bin = octoping_open_file(bin_file, "rb")) == NULL) {
+        ret = -1;
+    }
+    else if (fread(header, 1, sizeof(header), F_bin) != sizeof(header) ||
+        memcmp(header, OCTOPING_BINLOG_MAGIC, 8) != 0) {
+        printf("%s is not an octoping binary log\n", bin_file);
+        ret = -1;
+    }
+    else {
+        version = octoping_binlog_get_32(header + 8);
+        header_size = octoping_binlog_get_32(header + 12);
+        record_size = octoping_binlog_get_32(header + 16);
+        flags = octoping_binlog_get_32(header + 20);
+        nb_targets = octoping_binlog_get_32(header + 52);
+        min_record_size = (version >= 2) ? OCTOPING_BINLOG_RECORD_SIZE : OCTOPING_BINLOG_V1_RECORD_SIZE;
+        if ((flags & OCTOPING_BINLOG_DWELL) != 0) {
+            min_record_size += 8;
+        }
+
+        if (version < 1 || version > OCTOPING_BINLOG_VERSION || record_size < min_record_size ||
+            nb_targets > OCTOPING_MAX_TARGETS ||
+            header_size < OCTOPING_BINLOG_FIXED_HEADER + nb_targets * OCTOPING_LABEL_MAX) {
+            printf("Unsupported binary log format in %s\n", bin_file);
+            ret = -1;
+        }
+        else if ((labels = (char*)malloc((size_t)nb_targets * OCTOPING_LABEL_MAX + 1)) == NULL ||
+            (records = (uint8_t*)malloc(nb_records_max * record_size)) == NULL) {
+            printf("Cannot allocate memory to read %s\n", bin_file);
+            ret = -1;
+        }
+        else if (fread(labels, OCTOPING_LABEL_MAX, nb_targets, F_bin) != nb_targets ||
+            fseek(F_bin, (long)header_size, SEEK_SET) != 0) {
+            printf("Cannot read the header of %s\n", bin_file);
+            ret = -1;
+        }
+        else {
+            for (uint32_t i = 0; i < nb_targets; i++) {
+                labels[(i + 1) * OCTOPING_LABEL_MAX - 1] = 0;
+            }
+        }
+    }
+
+    if (ret == 0 && (F_csv = octoping_open_output(csv_file)) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0 && octoping_csv_header(F_csv, (flags & OCTOPING_BINLOG_TIMESTAMPS) != 0,
+        (flags & OCTOPING_BINLOG_LABELS) != 0, (flags & OCTOPING_BINLOG_SIZES) != 0,
+        (flags & OCTOPING_BINLOG_DWELL) != 0) != 0) {
+        ret = -1;
+    }
+    while (ret == 0) {
+        size_t nb_read = fread(records, record_size, nb_records_max, F_bin);
+
+        for (size_t i = 0; ret == 0 && i < nb_read; i++) {
+            octoping_result_t result;
+            char const* label = NULL;
+
+            octoping_binlog_parse_record(records + i * record_size, version, (flags & OCTOPING_BINLOG_DWELL) != 0, &result);
+            if ((flags & OCTOPING_BINLOG_LABELS) != 0) {
+                if (result.target_index >= nb_targets) {
+                    printf("Invalid target index %u in %s\n", result.target_index, bin_file);
+                    ret = -1;
+                    break;
+                }
+                label = labels + (size_t)result.target_index * OCTOPING_LABEL_MAX;
+            }
+            ret = octoping_csv_line(F_csv, (flags & OCTOPING_BINLOG_TIMESTAMPS) != 0,
+                (flags & OCTOPING_BINLOG_SIZES) != 0, (flags & OCTOPING_BINLOG_DWELL) != 0, label, &result);
+        }
+        if (nb_read < nb_records_max) {
+            break;
+        }
+    }
+
+    if (F_csv != NULL && F_csv != stdout && fclose(F_csv) != 0) {
+        ret = -1;
+    }
+    if (F_bin != NULL) {
+        (void)fclose(F_bin);
+    }
+    free(records);
+    free(labels);
+    return ret;
+}
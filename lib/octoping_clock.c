@@ -0,0 +1,173 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Estimate of the clock offset and drift of the server, from the lower
+ * convex hulls of the minimum delays in each direction. The points of a
+ * hull arrive in increasing time order, one per bucket, so that the hull
+ * is maintained as in Andrew's monotone chain algorithm: each point is
+ * added once and removed at most once.
+ */
+
+void octoping_clock_init(octoping_clock_t* clock)
+{
+    memset(clock, 0, sizeof(octoping_clock_t));
+    clock->best_rtt = UINT64_MAX;
+}
+
+/* Set the line under the hull, on the edge at the middle of its time range */
+static void octoping_hull_line(octoping_hull_t* hull)
+{
+    octoping_clock_point_t const* points = hull->points;
+    int n = hull->nb_points;
+
+    if (n < 2) {
+        hull->line_t = points[0].t;
+        hull->line_d = points[0].d;
+        hull->slope = 0;
+    }
+    else {
+        int64_t middle = points[0].t + (points[n - 1].t - points[0].t) / 2;
+        int low = 0;
+        int high = n - 1;
+
+        while (high - low > 1) {
+            int m = (low + high) / 2;
+            if (points[m].t <= middle) {
+                low = m;
+            }
+            else {
+                high = m;
+            }
+        }
+        hull->line_t = points[low].t;
+        hull->line_d = points[low].d;
+        hull->slope = ((double)(points[high].d - points[low].d)) / ((double)(points[high].t - points[low].t));
+    }
+}
+
+static void octoping_hull_push(octoping_hull_t* hull, octoping_clock_point_t const* point)
+{
+    octoping_clock_point_t* points = hull->points;
+    int n = hull->nb_points;
+    int first = 0;
+
+    /* Forget the points older than the horizon, or the oldest half of a full hull */
+    while (first < n - 1 && points[first].t < point->t - OCTOPING_CLOCK_HORIZON) {
+        first++;
+    }
+    if (n - first >= OCTOPING_CLOCK_HULL_MAX) {
+        first = n - OCTOPING_CLOCK_HULL_MAX / 2;
+    }
+    if (first > 0) {
+        n -= first;
+        memmove(points, points + first, (size_t)n * sizeof(octoping_clock_point_t));
+    }
+    /* Remove the points that are above the segment to the new point */
+    while (n >= 2) {
+        octoping_clock_point_t const* a = &points[n - 2];
+        octoping_clock_point_t const* b = &points[n - 1];
+
+        if ((double)(b->t - a->t) * (double)(point->d - a->d) > (double)(b->d - a->d) * (double)(point->t - a->t)) {
+            break;
+        }
+        n--;
+    }
+    points[n++] = *point;
+    hull->nb_points = n;
+    octoping_hull_line(hull);
+}
+
+/*
+ * Add a sample to the bucket that contains it, after pushing the minimum
+ * of the previous bucket to the hull. Samples of buckets already pushed,
+ * which only come from reordered echoes, are ignored.
+ */
+static void octoping_hull_add(octoping_hull_t* hull, int64_t t, int64_t d)
+{
+    if (!hull->has_min) {
+        hull->has_min = 1;
+        hull->bucket_start = t - t % OCTOPING_CLOCK_BUCKET;
+        hull->min.t = t;
+        hull->min.d = d;
+    }
+    else if (t < hull->bucket_start) {
+        /* Late sample */
+    }
+    else if (t >= hull->bucket_start + OCTOPING_CLOCK_BUCKET) {
+        octoping_hull_push(hull, &hull->min);
+        hull->bucket_start = t - t % OCTOPING_CLOCK_BUCKET;
+        hull->min.t = t;
+        hull->min.d = d;
+    }
+    else if (d < hull->min.d) {
+        hull->min.t = t;
+        hull->min.d = d;
+    }
+}
+
+static double octoping_hull_value(octoping_hull_t const* hull, int64_t t)
+{
+    return (double)hull->line_d + hull->slope * (double)(t - hull->line_t);
+}
+
+/*
+ * Add the four times of an echo, in nanoseconds: client send, server
+ * receive, server transmit and client receive.
+ */
+void octoping_clock_add(octoping_clock_t* clock, int64_t sent, int64_t received, int64_t transmitted, int64_t echoed)
+{
+    int64_t up = received - sent;
+    int64_t down = echoed - transmitted;
+    uint64_t rtt = (uint64_t)(up + down);
+
+    octoping_hull_add(&clock->up, sent, up);
+    octoping_hull_add(&clock->down, echoed, down);
+    if (rtt < clock->best_rtt) {
+        clock->best_rtt = rtt;
+        clock->best_phase = (up - down) / 2;
+    }
+}
+
+static int octoping_clock_is_estimated(octoping_clock_t const* clock)
+{
+    return clock->up.nb_points >= 2 && clock->down.nb_points >= 2;
+}
+
+int64_t octoping_clock_phase(octoping_clock_t const* clock, int64_t t)
+{
+    if (!octoping_clock_is_estimated(clock)) {
+        return clock->best_phase;
+    }
+    return (int64_t)((octoping_hull_value(&clock->up, t) - octoping_hull_value(&clock->down, t)) / 2.0);
+}
+
+/* Drift of the server clock relative to the client clock, e.g., 1.0e-6 for 1 ppm */
+double octoping_clock_drift(octoping_clock_t const* clock)
+{
+    if (!octoping_clock_is_estimated(clock)) {
+        return 0;
+    }
+    return (clock->up.slope - clock->down.slope) / 2.0;
+}
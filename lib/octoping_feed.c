@@ -0,0 +1,321 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+#ifdef OCTOPING_HAS_FEED
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * Shared memory feed. The writer is the thread that processes the
+ * results, and only uses stores and fences: it never reads what the
+ * readers write, because they write nothing. The readers map the object
+ * read only.
+ */
+
+static size_t octoping_feed_header_size()
+{
+    return (sizeof(octoping_feed_header_t) + OCTOPING_CACHE_LINE - 1) & ~((size_t)OCTOPING_CACHE_LINE - 1);
+}
+
+octoping_feed_t* octoping_feed_create(char const* name, uint64_t start_time, uint64_t interval_ns, int timestamps)
+{
+    octoping_feed_t* feed = (octoping_feed_t*)calloc(1, sizeof(octoping_feed_t));
+    size_t header_size = octoping_feed_header_size();
+    size_t map_size = header_size + (size_t)OCTOPING_FEED_SLOTS * sizeof(octoping_feed_slot_t);
+    void* map = MAP_FAILED;
+    int fd = -1;
+
+    if (feed == NULL) {
+        printf("Cannot allocate the feed\n");
+    }
+    else if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("shm_open");
+        printf("Cannot create the feed %s\n", name);
+    }
+    else if (ftruncate(fd, (off_t)map_size) != 0 ||
+        (map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror("mmap");
+        printf("Cannot map the feed %s\n", name);
+    }
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+    if (map == MAP_FAILED) {
+        free(feed);
+        return NULL;
+    }
+
+    /* The object was truncated, so the slots and sequences are zero */
+    feed->header = (octoping_feed_header_t*)map;
+    feed->slots = (octoping_feed_slot_t*)((uint8_t*)map + header_size);
+    feed->map_size = map_size;
+    feed->header->version = OCTOPING_FEED_VERSION;
+    feed->header->header_size = (uint32_t)header_size;
+    feed->header->slot_size = (uint32_t)sizeof(octoping_feed_slot_t);
+    feed->header->nb_slots = OCTOPING_FEED_SLOTS;
+    feed->header->start_time = start_time;
+    feed->header->interval_ns = interval_ns;
+    feed->header->timestamps = (timestamps) ? 1 : 0;
+    /* Readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(feed->header->magic, OCTOPING_FEED_MAGIC, 8);
+    return feed;
+}
+
+void octoping_feed_publish(octoping_feed_t* feed, octoping_result_t const* result)
+{
+    uint64_t index = feed->write_index;
+    octoping_feed_slot_t* slot = &feed->slots[index & (OCTOPING_FEED_SLOTS - 1)];
+
+    __atomic_store_n(&slot->seq, 2 * index + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->result, result, sizeof(octoping_result_t));
+    __atomic_store_n(&slot->seq, 2 * index + 2, __ATOMIC_RELEASE);
+    feed->write_index = index + 1;
+    __atomic_store_n(&feed->header->write_index, index + 1, __ATOMIC_RELEASE);
+}
+
+static void octoping_feed_percentiles(octoping_feed_percentiles_t* p, octoping_histogram_t const* histogram)
+{
+    p->min = (histogram->count > 0) ? histogram->min : 0;
+    p->p50 = octoping_histogram_percentile(histogram, 0.5);
+    p->p90 = octoping_histogram_percentile(histogram, 0.9);
+    p->p99 = octoping_histogram_percentile(histogram, 0.99);
+    p->max = histogram->max;
+    p->mean = (histogram->count > 0) ? histogram->sum / (double)histogram->count : 0;
+}
+
+void octoping_feed_publish_summary(octoping_feed_t* feed, uint64_t window_start, uint64_t window_end,
+    octoping_stats_t const* stats)
+{
+    octoping_feed_summary_t summary;
+
+    /* The percentiles are computed before taking the lock, to keep it short */
+    memset(&summary, 0, sizeof(summary));
+    summary.window_start = window_start;
+    summary.window_end = window_end;
+    summary.nb_echoes = stats->nb_echoes;
+    summary.nb_lost = stats->nb_lost;
+    summary.nb_reordered = stats->nb_reordered;
+    summary.nb_late = stats->nb_late;
+    octoping_feed_percentiles(&summary.rtt, &stats->rtt);
+    octoping_feed_percentiles(&summary.up_t, &stats->up_t);
+    octoping_feed_percentiles(&summary.down_t, &stats->down_t);
+    octoping_feed_percentiles(&summary.jitter, &stats->jitter);
+
+    __atomic_store_n(&feed->header->summary_seq, feed->summary_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&feed->header->summary, &summary, sizeof(summary));
+    feed->summary_seq += 2;
+    __atomic_store_n(&feed->header->summary_seq, feed->summary_seq, __ATOMIC_RELEASE);
+}
+
+void octoping_feed_close(octoping_feed_t* feed)
+{
+    if (feed != NULL) {
+        __atomic_store_n(&feed->header->is_closed, 1, __ATOMIC_RELEASE);
+        octoping_feed_release(feed);
+    }
+}
+
+octoping_feed_t* octoping_feed_open(char const* name)
+{
+    octoping_feed_t* feed = (octoping_feed_t*)calloc(1, sizeof(octoping_feed_t));
+    octoping_feed_header_t const* header;
+    void* map = MAP_FAILED;
+    struct stat st;
+    int fd = -1;
+
+    if (feed == NULL) {
+        printf("Cannot allocate the feed\n");
+    }
+    else if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        printf("Cannot open the feed %s\n", name);
+    }
+    else if (fstat(fd, &st) != 0 || (size_t)st.st_size < octoping_feed_header_size() ||
+        (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        printf("Cannot map the feed %s\n", name);
+    }
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+    if (map == MAP_FAILED) {
+        free(feed);
+        return NULL;
+    }
+
+    header = (octoping_feed_header_t const*)map;
+    feed->header = (octoping_feed_header_t*)map;
+    feed->map_size = (size_t)st.st_size;
+    if (memcmp(header->magic, OCTOPING_FEED_MAGIC, 8) != 0 || header->version != OCTOPING_FEED_VERSION ||
+        header->slot_size != sizeof(octoping_feed_slot_t) || header->nb_slots != OCTOPING_FEED_SLOTS ||
+        (size_t)header->header_size + (size_t)header->nb_slots * header->slot_size > feed->map_size) {
+        printf("%s is not an octoping feed of this version\n", name);
+        octoping_feed_release(feed);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    feed->slots = (octoping_feed_slot_t*)((uint8_t*)map + header->header_size);
+    return feed;
+}
+
+/*
+ * Read the result number *index. Returns 1 if the result was read, and
+ * increments the index, 0 if it is not published yet, and -1 if it was
+ * overwritten, after setting the index to the oldest result available.
+ */
+int octoping_feed_read(octoping_feed_t const* feed, uint64_t* index, octoping_result_t* result)
+{
+    uint64_t write_index = __atomic_load_n(&feed->header->write_index, __ATOMIC_ACQUIRE);
+    octoping_feed_slot_t const* slot;
+    uint64_t seq;
+
+    if (*index >= write_index) {
+        return 0;
+    }
+    if (write_index - *index > OCTOPING_FEED_SLOTS) {
+        *index = write_index - OCTOPING_FEED_SLOTS;
+        return -1;
+    }
+    slot = &feed->slots[*index & (OCTOPING_FEED_SLOTS - 1)];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 2 * *index + 2) {
+        memcpy(result, &slot->result, sizeof(octoping_result_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+            *index += 1;
+            return 1;
+        }
+    }
+    /* The writer lapped the reader while it was reading */
+    *index = __atomic_load_n(&feed->header->write_index, __ATOMIC_ACQUIRE);
+    *index = (*index > OCTOPING_FEED_SLOTS) ? *index - OCTOPING_FEED_SLOTS + 1 : 0;
+    return -1;
+}
+
+/*
+ * Read the summary, if one was published since the sequence *summary_seq.
+ * Returns 1 if a new summary was read, 0 otherwise.
+ */
+int octoping_feed_read_summary(octoping_feed_t const* feed, uint64_t* summary_seq, octoping_feed_summary_t* summary)
+{
+    for (;;) {
+        uint64_t seq = __atomic_load_n(&feed->header->summary_seq, __ATOMIC_ACQUIRE);
+
+        if (seq == *summary_seq) {
+            return 0;
+        }
+        if ((seq & 1) == 0) {
+            memcpy(summary, &feed->header->summary, sizeof(octoping_feed_summary_t));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&feed->header->summary_seq, __ATOMIC_RELAXED) == seq) {
+                *summary_seq = seq;
+                return 1;
+            }
+        }
+    }
+}
+
+void octoping_feed_release(octoping_feed_t* feed)
+{
+    if (feed != NULL) {
+        (void)munmap(feed->header, feed->map_size);
+        free(feed);
+    }
+}
+
+static void octoping_feed_print_percentiles(char const* name, octoping_feed_percentiles_t const* p)
+{
+    printf("    %-7s min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f, mean %.3f us\n", name,
+        ((double)p->min) / 1000.0, ((double)p->p50) / 1000.0, ((double)p->p90) / 1000.0, ((double)p->p99) / 1000.0,
+        ((double)p->max) / 1000.0, p->mean / 1000.0);
+}
+
+/*
+ * Follow a feed, and print its results in CSV, with the dwell and size
+ * columns, and its summaries on stdout, until the writer closes it.
+ */
+int octoping_feed_follow(octoping_options_t* options)
+{
+    int ret = 0;
+    octoping_feed_t* feed = octoping_feed_open(options->follow_name);
+
+    if (feed == NULL) {
+        ret = -1;
+    }
+    else {
+        int timestamps = feed->header->timestamps;
+        uint64_t index = 0;
+        uint64_t summary_seq = 0;
+        uint64_t nb_missed = 0;
+        int is_closed = 0;
+
+        ret = octoping_csv_header(stdout, timestamps, 0, 1, 1);
+        while (ret == 0) {
+            octoping_result_t result;
+            octoping_feed_summary_t summary;
+            uint64_t before = index;
+            int nb_read = 0;
+            int r;
+
+            while ((r = octoping_feed_read(feed, &index, &result)) != 0 && ret == 0) {
+                if (r < 0) {
+                    nb_missed += index - before;
+                }
+                else {
+                    ret = octoping_csv_line(stdout, timestamps, 1, 1, NULL, &result);
+                    nb_read++;
+                }
+                before = index;
+            }
+            if (octoping_feed_read_summary(feed, &summary_seq, &summary)) {
+                printf("Summary %.3fs to %.3fs: %" PRIu64 " echoes, %" PRIu64 " lost, %" PRIu64 " reordered, %" PRIu64 " late\n",
+                    ((double)(summary.window_start - feed->header->start_time)) / 1000000000.0,
+                    ((double)(summary.window_end - feed->header->start_time)) / 1000000000.0,
+                    summary.nb_echoes, summary.nb_lost, summary.nb_reordered, summary.nb_late);
+                octoping_feed_print_percentiles("rtt", &summary.rtt);
+                octoping_feed_print_percentiles("up_t", &summary.up_t);
+                octoping_feed_print_percentiles("down_t", &summary.down_t);
+                octoping_feed_print_percentiles("jitter", &summary.jitter);
+            }
+            if (is_closed) {
+                break;
+            }
+            if (nb_read == 0) {
+                (void)fflush(stdout);
+                /* Read once more after the close, to get the last results */
+                is_closed = __atomic_load_n(&feed->header->is_closed, __ATOMIC_ACQUIRE);
+                if (!is_closed) {
+                    (void)usleep(100);
+                }
+            }
+        }
+        if (nb_missed > 0) {
+            printf("Missed %" PRIu64 " results\n", nb_missed);
+        }
+        octoping_feed_release(feed);
+    }
+    return ret;
+}
+#endif
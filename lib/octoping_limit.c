@@ -0,0 +1,108 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "octoping.h"
+
+/*
+ * Per source admission control. The bucket of each source is kept as a
+ * single time, the time at which the bucket will be full again: each
+ * echo pushes it one interval later, and a probe is admitted if that
+ * time is less than burst intervals in the future. The drops do not
+ * change it, so a source that keeps sending too fast gets exactly its
+ * rate.
+ */
+
+octoping_limit_t* octoping_limit_create(uint64_t interval_ns, int burst)
+{
+    octoping_limit_t* limit = (octoping_limit_t*)calloc(1, sizeof(octoping_limit_t));
+
+    if (limit != NULL) {
+        limit->interval_ns = interval_ns;
+        limit->tolerance_ns = interval_ns * (uint64_t)((burst > 1) ? burst - 1 : 0);
+    }
+    return limit;
+}
+
+/*
+ * Return 1 if the probe from this address, in network order, shall be
+ * echoed, 0 if it exceeds the rate. The address 0 marks the empty
+ * entries; it is not a valid source.
+ */
+int octoping_limit_admit(octoping_limit_t* limit, uint32_t addr, uint64_t current_time)
+{
+    octoping_limit_set_t* set = &limit->sets[(addr * 0x9e3779b1u) >> (32 - OCTOPING_LIMIT_BITS)];
+    uint64_t full_time;
+    int way = 0;
+
+    while (way < OCTOPING_LIMIT_WAYS && set->addr[way] != addr) {
+        way++;
+    }
+    if (way >= OCTOPING_LIMIT_WAYS) {
+        /* Replace the fullest bucket, keeping its deficit */
+        way = 0;
+        for (int i = 1; i < OCTOPING_LIMIT_WAYS; i++) {
+            if (set->full_time[i] < set->full_time[way]) {
+                way = i;
+            }
+        }
+        set->addr[way] = addr;
+        OCTOPING_COUNTER_SET(set->drops[way], 0);
+    }
+
+    full_time = (set->full_time[way] > current_time) ? set->full_time[way] : current_time;
+    if (full_time > current_time + limit->tolerance_ns) {
+        OCTOPING_COUNTER_ADD(set->drops[way], 1);
+        return 0;
+    }
+    set->full_time[way] = full_time + limit->interval_ns;
+    return 1;
+}
+
+/*
+ * Parse the limit, an interval as in the client, e.g., 10ms or 100pps,
+ * optionally followed by a comma and the burst size.
+ */
+int octoping_parse_limit(char const* arg, uint64_t* interval_ns, int* burst)
+{
+    int ret = 0;
+    char interval[64];
+    char const* comma = strchr(arg, ',');
+    size_t l = (comma == NULL) ? strlen(arg) : (size_t)(comma - arg);
+
+    *burst = OCTOPING_LIMIT_BURST;
+    if (l >= sizeof(interval)) {
+        ret = -1;
+    }
+    else {
+        memcpy(interval, arg, l);
+        interval[l] = 0;
+        ret = octoping_parse_interval(interval, interval_ns);
+        if (ret == 0 && comma != NULL) {
+            *burst = atoi(comma + 1);
+            if (*burst <= 0) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
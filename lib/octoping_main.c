@@ -0,0 +1,620 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+static void usage(char const * sample_name)
+{
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "    %s [-r] [-T] [-p port] [-f file_name] [-F format] [-S seconds] [-B burst] [-s spin_us] [-e engine] [-z size[,size...]] [-t train_length] [-v version] [-R rotation] [-W seconds] [-m feed] <server_name> <server_port> <interval> <duration_seconds>\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-r] [-T] [-f file_name] [-F format] [-S seconds] [-B burst] [-z size[,size...]] [-t train_length] [-v version] [-R rotation] [-W seconds] [-j threads] -l target_file <interval> <duration_seconds>\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-r] [-T] [-p first_port] [-f file_name] [-F format] [-S seconds] [-B burst] [-z size[,size...]] [-v version] [-R rotation] [-W seconds] [-j threads] [-c first_cpu] -n flows <server_name> <server_port> <interval> <duration_seconds>\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-r] [-T] [-p port] [-b batch_size] [-w workers] [-c first_cpu] [-e engine] [-S seconds] [-q port|path] [-L interval[,burst]]\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-T] [-f file_name] [-F format] [-S seconds] [-B burst] [-z size[,size...]] [-t train_length] [-v version] [-L interval[,burst]] [-m feed] -M model <interval> <duration_seconds>\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-f file_name] -x binary_log\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s -y feed\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s [-f file_name] [-S seconds] [-j threads] -a csv_file\n", sample_name);
+    fprintf(stderr, "use -r for real time priority, locked memory, CPU pinning and busy polling (needs privileges).\n");
+    fprintf(stderr, "use -T to use kernel timestamps and nanosecond resolution (Linux only).\n");
+    fprintf(stderr, "use -p to set the local source port number.\n");
+    fprintf(stderr, "use -v 2 to send probes in the wire format version 2, with the server transmit time (client).\n");
+    fprintf(stderr, "use -b to echo up to batch_size packets per system call (server, Linux only).\n");
+    fprintf(stderr, "use -w to run several server workers on SO_REUSEPORT sockets (server, not on Windows).\n");
+    fprintf(stderr, "use -c to pin server worker or sender thread i to the CPU number first_cpu + i.\n");
+    fprintf(stderr, "use -l to probe all the targets listed in target_file, one \"address [port]\" per line (Linux only).\n");
+    fprintf(stderr, "use -n to send from that many flows, each with its own source port, at the aggregate rate set by the interval (Linux only).\n");
+    fprintf(stderr, "use -j to split the targets or flows between several sender threads, writing to file_name.0, file_name.1, etc.\n");
+    fprintf(stderr, "use -f to direct output to file instead of stdout.\n");
+    fprintf(stderr, "use -F to select the output format, csv (default), bin (requires -f) or summary.\n");
+    fprintf(stderr, "use -S to print a summary of the statistics every specified number of seconds (server: every 10 s by default).\n");
+    fprintf(stderr, "use -q to serve the server counters on the local TCP port, or on the Unix socket path (server, not on Windows).\n");
+    fprintf(stderr, "use -L to echo at most one probe per interval from each source address, with bursts of up to burst probes (server, default burst %d).\n", OCTOPING_LIMIT_BURST);
+    fprintf(stderr, "use -M to probe a simulated network in virtual time and check the results, e.g., -M delay=10ms,jitter=1ms,loss=0.01,offset=5ms,drift=20.\n");
+    fprintf(stderr, "use -x to convert a binary log to CSV, on stdout or in the file set with -f.\n");
+    fprintf(stderr, "use -a to analyze a CSV result file in parallel, with windows of -S seconds (default 60, not on Windows).\n");
+    fprintf(stderr, "use -B to send bursts of back-to-back probes at each interval.\n");
+    fprintf(stderr, "use -e to select the I/O engine, socket (default) or io_uring (Linux 6.0 or later, not with -l).\n");
+    fprintf(stderr, "use -z to set the probe payload size in bytes, or a list of sizes used in turn (max %d).\n", OCTOPING_PACKET_MAX);
+    fprintf(stderr, "use -t to send trains of back-to-back probes at each interval and estimate the capacity.\n");
+    fprintf(stderr, "use -s to busy-poll for the last spin_us microseconds before each send (single target).\n");
+    fprintf(stderr, "use -R to rotate the output file by size, 100M, by age, 1h, or both, 100M,1h (checked at each flush).\n");
+    fprintf(stderr, "use -m to publish the results and summaries in the shared memory feed /dev/shm/feed (Linux only).\n");
+    fprintf(stderr, "use -y to follow a shared memory feed and print its results and summaries.\n");
+    fprintf(stderr, "use -W to flush the output every specified number of seconds (default 1).\n");
+    fprintf(stderr, "A duration of 0 runs the client until it is interrupted with SIGINT or SIGTERM.\n");
+    fprintf(stderr, "The interval is in milliseconds, or followed by a unit: 250us, 0.5ms, 100000pps, 2Mpps.\n");
+    exit(1);
+}
+
+int parse_options(octoping_options_t * options, int argc, char** argv)
+{
+    int ret = 0;
+    int option_index = 1;
+
+    memset(options, 0, sizeof(octoping_options_t));
+    options->first_cpu = -1;
+
+    /* first parse the optional values. */
+    while (option_index < argc && ret == 0) {
+        char const* option_value = argv[option_index];
+
+        if (strcmp(option_value, "-r") == 0) {
+            options->real_time = 1;
+            option_index++;
+        }
+        else if (strcmp(option_value, "-T") == 0) {
+            options->timestamps = 1;
+            option_index++;
+        }
+        else if (strcmp(option_value, "-p") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Port value not set");
+                ret = -1;
+            }
+            else {
+                int source_port = atoi(argv[option_index]);
+                if (source_port < 0 || source_port > 0xffff) {
+                    fprintf(stderr, "Invalid source port: %s\n", argv[option_index]);
+                    ret = -1;
+                }
+                else {
+                    options->source_port = (uint16_t)source_port;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-e") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Engine not set");
+                ret = -1;
+            }
+            else if (strcmp(argv[option_index], "socket") == 0) {
+                options->engine = octoping_engine_socket;
+                option_index++;
+            }
+            else if (strcmp(argv[option_index], "io_uring") == 0) {
+                options->engine = octoping_engine_uring;
+                option_index++;
+            }
+            else {
+                fprintf(stderr, "Invalid engine: %s\n", argv[option_index]);
+                ret = -1;
+            }
+        }
+        else if (strcmp(option_value, "-b") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Batch size not set");
+                ret = -1;
+            }
+            else {
+                int batch_size = atoi(argv[option_index]);
+                if (batch_size <= 0 || batch_size > OCTOPING_MAX_BATCH) {
+                    fprintf(stderr, "Invalid batch size: %s (max %d)\n", argv[option_index], OCTOPING_MAX_BATCH);
+                    ret = -1;
+                }
+                else {
+                    options->batch_size = batch_size;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-w") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Number of workers not set");
+                ret = -1;
+            }
+            else {
+                int nb_workers = atoi(argv[option_index]);
+                if (nb_workers <= 0 || nb_workers > OCTOPING_MAX_WORKERS) {
+                    fprintf(stderr, "Invalid number of workers: %s (max %d)\n", argv[option_index], OCTOPING_MAX_WORKERS);
+                    ret = -1;
+                }
+                else {
+                    options->nb_workers = nb_workers;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-c") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "CPU number not set");
+                ret = -1;
+            }
+            else {
+                int first_cpu = atoi(argv[option_index]);
+                if (first_cpu < 0) {
+                    fprintf(stderr, "Invalid CPU number: %s\n", argv[option_index]);
+                    ret = -1;
+                }
+                else {
+                    options->first_cpu = first_cpu;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-B") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Burst size not set");
+                ret = -1;
+            }
+            else {
+                int burst_size = atoi(argv[option_index]);
+                if (burst_size <= 0 || burst_size > OCTOPING_MAX_BURST) {
+                    fprintf(stderr, "Invalid burst size: %s (max %d)\n", argv[option_index], OCTOPING_MAX_BURST);
+                    ret = -1;
+                }
+                else {
+                    options->burst_size = burst_size;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-n") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Number of flows not set");
+                ret = -1;
+            }
+            else {
+                int nb_flows = atoi(argv[option_index]);
+                if (nb_flows <= 0 || nb_flows > OCTOPING_MAX_TARGETS) {
+                    fprintf(stderr, "Invalid number of flows: %s (max %d)\n", argv[option_index], OCTOPING_MAX_TARGETS);
+                    ret = -1;
+                }
+                else {
+                    options->nb_flows = nb_flows;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-j") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Number of threads not set");
+                ret = -1;
+            }
+            else {
+                int nb_threads = atoi(argv[option_index]);
+                if (nb_threads <= 0 || nb_threads > OCTOPING_MAX_THREADS) {
+                    fprintf(stderr, "Invalid number of threads: %s (max %d)\n", argv[option_index], OCTOPING_MAX_THREADS);
+                    ret = -1;
+                }
+                else {
+                    options->nb_threads = nb_threads;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-z") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Probe size not set");
+                ret = -1;
+            }
+            else {
+                char const* next = argv[option_index];
+
+                options->nb_sizes = 0;
+                while (ret == 0 && *next != 0) {
+                    char* end;
+                    long size = strtol(next, &end, 10);
+
+                    if (end == next || size < 16 || size > OCTOPING_PACKET_MAX || (*end != ',' && *end != 0) ||
+                        options->nb_sizes >= OCTOPING_MAX_SIZES) {
+                        fprintf(stderr, "Invalid probe sizes: %s (16 to %d bytes, at most %d sizes)\n",
+                            argv[option_index], OCTOPING_PACKET_MAX, OCTOPING_MAX_SIZES);
+                        ret = -1;
+                    }
+                    else {
+                        options->sizes[options->nb_sizes++] = (uint16_t)size;
+                        next = (*end == ',') ? end + 1 : end;
+                    }
+                }
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-t") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Train length not set");
+                ret = -1;
+            }
+            else {
+                int train_length = atoi(argv[option_index]);
+                if (train_length < 2 || train_length > OCTOPING_MAX_BURST) {
+                    fprintf(stderr, "Invalid train length: %s (2 to %d)\n", argv[option_index], OCTOPING_MAX_BURST);
+                    ret = -1;
+                }
+                else {
+                    options->train_length = train_length;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-v") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Wire version not set");
+                ret = -1;
+            }
+            else if (strcmp(argv[option_index], "1") != 0 && strcmp(argv[option_index], "2") != 0) {
+                fprintf(stderr, "Invalid wire version: %s (1 or 2)\n", argv[option_index]);
+                ret = -1;
+            }
+            else {
+                options->wire_version = atoi(argv[option_index]);
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-s") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Spin time not set");
+                ret = -1;
+            }
+            else {
+                int spin_us = atoi(argv[option_index]);
+                if (spin_us < 0 || spin_us > 1000000) {
+                    fprintf(stderr, "Invalid spin time: %s\n", argv[option_index]);
+                    ret = -1;
+                }
+                else {
+                    options->spin_ns = ((uint64_t)spin_us) * 1000;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-l") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Target file not set");
+                ret = -1;
+            }
+            else {
+                options->target_file = argv[option_index];
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-f") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Port value not set");
+                ret = -1;
+            }
+            else {
+                options->file_name = argv[option_index];
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-F") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Output format not set");
+                ret = -1;
+            }
+            else if (octoping_parse_format(argv[option_index], &options->output_format) != 0) {
+                fprintf(stderr, "Invalid output format: %s\n", argv[option_index]);
+                ret = -1;
+            }
+            else {
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-S") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Summary interval not set");
+                ret = -1;
+            }
+            else {
+                int seconds = atoi(argv[option_index]);
+                if (seconds <= 0) {
+                    fprintf(stderr, "Invalid summary interval: %s\n", argv[option_index]);
+                    ret = -1;
+                }
+                else {
+                    options->summary_interval_ns = ((uint64_t)seconds) * 1000000000ull;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-q") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Query port or path not set");
+                ret = -1;
+            }
+            else {
+                options->query = argv[option_index];
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-a") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Result file not set");
+                ret = -1;
+            }
+            else {
+                options->analyze_file = argv[option_index];
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-L") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Rate limit not set");
+                ret = -1;
+            }
+            else if (octoping_parse_limit(argv[option_index], &options->limit_interval_ns, &options->limit_burst) != 0) {
+                fprintf(stderr, "Invalid rate limit: %s\n", argv[option_index]);
+                ret = -1;
+            }
+            else {
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-M") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Network model not set");
+                ret = -1;
+            }
+            else {
+                options->simulation = argv[option_index];
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-m") == 0 || strcmp(option_value, "-y") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Feed name not set");
+                ret = -1;
+            }
+            else {
+#ifdef OCTOPING_HAS_FEED
+                if (option_value[1] == 'm') {
+                    options->feed_name = argv[option_index];
+                }
+                else {
+                    options->follow_name = argv[option_index];
+                }
+                option_index++;
+#else
+                fprintf(stderr, "The shared memory feed is only available on Linux\n");
+                ret = -1;
+#endif
+            }
+        }
+        else if (strcmp(option_value, "-R") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Rotation not set");
+                ret = -1;
+            }
+            else if (octoping_parse_rotation(argv[option_index], &options->rotate_bytes, &options->rotate_ns) != 0) {
+                fprintf(stderr, "Invalid rotation: %s\n", argv[option_index]);
+                ret = -1;
+            }
+            else {
+                option_index++;
+            }
+        }
+        else if (strcmp(option_value, "-W") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Flush interval not set");
+                ret = -1;
+            }
+            else {
+                int seconds = atoi(argv[option_index]);
+                if (seconds <= 0) {
+                    fprintf(stderr, "Invalid flush interval: %s\n", argv[option_index]);
+                    ret = -1;
+                }
+                else {
+                    options->flush_interval_ns = ((uint64_t)seconds) * 1000000000ull;
+                    option_index++;
+                }
+            }
+        }
+        else if (strcmp(option_value, "-x") == 0) {
+            option_index++;
+            if (option_index >= argc) {
+                fprintf(stderr, "Binary log not set");
+                ret = -1;
+            }
+            else {
+                options->export_file = argv[option_index];
+                option_index++;
+            }
+        } else {
+            /* end of optional parameters */
+            break;
+        }
+    }
+    if (ret == 0 && options->nb_flows > 0 && options->target_file != NULL) {
+        fprintf(stderr, "The options -n and -l cannot be combined\n");
+        ret = -1;
+    }
+    if (ret == 0 && options->simulation != NULL && (options->nb_flows > 0 || options->target_file != NULL)) {
+        fprintf(stderr, "The simulation uses a single target, it cannot be combined with -n or -l\n");
+        ret = -1;
+    }
+    if (ret == 0 && options->feed_name != NULL && (options->nb_flows > 0 || options->target_file != NULL)) {
+        fprintf(stderr, "The feed has a single target, it cannot be combined with -n or -l\n");
+        ret = -1;
+    }
+    if (ret == 0 && options->train_length > 1) {
+        /* Trains are sent as bursts */
+        options->burst_size = options->train_length;
+    }
+    if (ret == 0 && options->output_format == octoping_format_binary && options->file_name == NULL) {
+        fprintf(stderr, "The binary format requires an output file\n");
+        ret = -1;
+    }
+    if (ret == 0 && (options->rotate_bytes > 0 || options->rotate_ns > 0) &&
+        (options->file_name == NULL || options->output_format == octoping_format_summary)) {
+        fprintf(stderr, "The rotation requires a CSV or binary output file\n");
+        ret = -1;
+    }
+    if (ret == 0 && (options->export_file != NULL || options->analyze_file != NULL || options->follow_name != NULL)) {
+        if (option_index != argc) {
+            fprintf(stderr, "Invalid export specification\n");
+            ret = -1;
+        }
+    }
+    else if (ret == 0) {
+        int has_target = (options->target_file == NULL && options->simulation == NULL);
+        int nb_args = (has_target) ? 4 : 2;
+
+        if (option_index >= argc && has_target) {
+            options->is_server = 1;
+            if (options->feed_name != NULL) {
+                fprintf(stderr, "The feed publishes the results of a client\n");
+                ret = -1;
+            }
+        }
+        else if (option_index + nb_args != argc) {
+            fprintf(stderr, "Invalid client specification\n");
+            ret = -1;
+        }
+        else {
+            char** args = argv + option_index;
+            int seconds;
+
+            if (has_target) {
+                int server_port = atoi(args[1]);
+
+                if (server_port < 0 || server_port > 0xffff) {
+                    fprintf(stderr, "Invalid server port: %s\n", args[1]);
+                    ret = -1;
+                }
+                options->server_name = args[0];
+                options->server_port = (uint16_t)server_port;
+                args += 2;
+            }
+            seconds = atoi(args[1]);
+
+            if (octoping_parse_interval(args[0], &options->interval_ns) != 0) {
+                printf("Invalid interval: %s\n", args[0]);
+                ret = -1;
+            } else if (seconds < 0 || (seconds == 0 && strcmp(args[1], "0") != 0)) {
+                printf("Invalid duration in seconds: %s\n", args[1]);
+                ret = -1;
+            }
+            else {
+                options->duration_us = ((uint64_t)seconds) * 1000000;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int get_port(char const* sample_name, char const* port_arg)
+{
+    int server_port = atoi(port_arg);
+    if (server_port <= 0) {
+        fprintf(stderr, "Invalid port: %s\n", port_arg);
+        usage(sample_name);
+    }
+
+    return server_port;
+}
+
+int main(int argc, char** argv)
+{
+    int exit_code = 0;
+    octoping_options_t options;
+#ifdef _WINDOWS
+    WSADATA wsaData = { 0 };
+    (void)WSA_START(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    if (parse_options(&options, argc, argv) != 0){
+        usage(argv[0]);
+    }
+    else
+    {
+        if (options.real_time) {
+            (void)octoping_realtime_setup(&options);
+        }
+        if (options.analyze_file != NULL) {
+            exit_code = octoping_analyze(&options);
+        }
+        else if (options.export_file != NULL) {
+            exit_code = octoping_binlog_export(options.export_file, options.file_name);
+        }
+#ifdef OCTOPING_HAS_FEED
+        else if (options.follow_name != NULL) {
+            exit_code = octoping_feed_follow(&options);
+        }
+#endif
+        else if (options.is_server) {
+            exit_code = octoping_server(&options);
+        }
+        else if (options.simulation != NULL) {
+            exit_code = octoping_simulate(&options);
+        }
+        else if (options.target_file != NULL || options.nb_flows > 0) {
+            exit_code = octoping_multi_client(&options);
+        }
+        else {
+            exit_code = octoping_client(&options);
+        }
+    }
+    exit(exit_code);
+}
@@ -0,0 +1,422 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+#ifndef _WINDOWS
+#include <stddef.h>
+#include <poll.h>
+#include <sys/un.h>
+#endif
+
+/*
+ * Server monitor. The workers only update their own counters and client
+ * tables; the monitor sums them, prints the periodic log lines, and
+ * answers the queries on the local endpoint.
+ */
+
+uint64_t octoping_top_epoch = 0;
+
+/*
+ * Count a packet in the client table of the current epoch. The epoch
+ * may change while the packet is counted, in which case the packet is
+ * counted in the table of the previous interval, or lost when the table
+ * is cleared. This is acceptable for an estimate of the heavy clients.
+ */
+void octoping_top_add(octoping_top_t* top, struct sockaddr_in const* addr)
+{
+    uint64_t key = (((uint64_t)ntohl(addr->sin_addr.s_addr)) << 16) | ntohs(addr->sin_port);
+    uint64_t epoch = OCTOPING_COUNTER_READ(octoping_top_epoch);
+    octoping_top_slot_t* slot = &top->slots[epoch & 1][(key * 0x9e3779b97f4a7c15ull) >> (64 - OCTOPING_TOP_BITS)];
+
+    if (slot->key == key) {
+        slot->count++;
+    }
+    else if (slot->count <= 1) {
+        slot->key = key;
+        slot->count = 1;
+    }
+    else {
+        slot->count--;
+    }
+}
+
+#ifndef _WINDOWS
+#define OCTOPING_MONITOR_POLL_MS 100
+#define OCTOPING_MONITOR_SEND_TIMEOUT_MS 1000
+
+typedef struct st_octoping_monitor_t {
+    octoping_server_worker_t* workers;
+    int nb_workers;
+    uint64_t start_time;
+    uint64_t log_time;
+    octoping_server_counters_t last;
+    octoping_top_slot_t top[OCTOPING_TOP_CLIENTS];
+    int nb_top;
+    double top_duration;
+    octoping_top_slot_t limited[OCTOPING_TOP_CLIENTS];
+    int nb_limited;
+} octoping_monitor_t;
+
+static void octoping_monitor_read(octoping_server_counters_t const* counters, octoping_server_counters_t* copy)
+{
+    copy->rx_packets = OCTOPING_COUNTER_READ(counters->rx_packets);
+    copy->rx_bytes = OCTOPING_COUNTER_READ(counters->rx_bytes);
+    copy->rx_calls = OCTOPING_COUNTER_READ(counters->rx_calls);
+    copy->tx_packets = OCTOPING_COUNTER_READ(counters->tx_packets);
+    copy->tx_bytes = OCTOPING_COUNTER_READ(counters->tx_bytes);
+    copy->short_packets = OCTOPING_COUNTER_READ(counters->short_packets);
+    copy->send_errors = OCTOPING_COUNTER_READ(counters->send_errors);
+    copy->rx_drops = OCTOPING_COUNTER_READ(counters->rx_drops);
+    copy->limited = OCTOPING_COUNTER_READ(counters->limited);
+}
+
+static void octoping_monitor_sum(octoping_monitor_t const* monitor, octoping_server_counters_t* total)
+{
+    memset(total, 0, sizeof(octoping_server_counters_t));
+    for (int i = 0; i < monitor->nb_workers; i++) {
+        octoping_server_counters_t counters;
+
+        octoping_monitor_read(&monitor->workers[i].counters, &counters);
+        total->rx_packets += counters.rx_packets;
+        total->rx_bytes += counters.rx_bytes;
+        total->rx_calls += counters.rx_calls;
+        total->tx_packets += counters.tx_packets;
+        total->tx_bytes += counters.tx_bytes;
+        total->short_packets += counters.short_packets;
+        total->send_errors += counters.send_errors;
+        total->rx_drops += counters.rx_drops;
+        total->limited += counters.limited;
+    }
+}
+
+static void octoping_monitor_client_name(uint64_t key, int with_port, char* name, size_t name_size)
+{
+    struct in_addr addr;
+    char addr_text[INET_ADDRSTRLEN];
+
+    addr.s_addr = htonl((uint32_t)(key >> 16));
+    if (inet_ntop(AF_INET, &addr, addr_text, sizeof(addr_text)) == NULL) {
+        addr_text[0] = 0;
+    }
+    if (with_port) {
+        (void)snprintf(name, name_size, "%s:%d", addr_text, (int)(key & 0xffff));
+    }
+    else {
+        (void)snprintf(name, name_size, "%s", addr_text);
+    }
+}
+
+/* Insert a client in a list sorted by decreasing count, if it is one of the OCTOPING_TOP_CLIENTS heaviest */
+static void octoping_monitor_rank(octoping_top_slot_t* top, int* nb_top, uint64_t key, uint64_t count)
+{
+    if (*nb_top < OCTOPING_TOP_CLIENTS || count > top[OCTOPING_TOP_CLIENTS - 1].count) {
+        int k = (*nb_top < OCTOPING_TOP_CLIENTS) ? (*nb_top)++ : OCTOPING_TOP_CLIENTS - 1;
+
+        while (k > 0 && top[k - 1].count < count) {
+            top[k] = top[k - 1];
+            k--;
+        }
+        top[k].key = key;
+        top[k].count = count;
+    }
+}
+
+/*
+ * Switch the workers to the other client table, then collect the heavy
+ * clients of the previous interval and clear their table. A client is
+ * normally served by a single worker, so the tables are not merged.
+ */
+static void octoping_monitor_collect_top(octoping_monitor_t* monitor, double duration)
+{
+    uint64_t epoch = OCTOPING_COUNTER_READ(octoping_top_epoch);
+    int table = (int)(epoch & 1);
+
+    OCTOPING_COUNTER_SET(octoping_top_epoch, epoch + 1);
+    monitor->nb_top = 0;
+    monitor->top_duration = duration;
+
+    for (int i = 0; i < monitor->nb_workers; i++) {
+        octoping_top_slot_t* slots = monitor->workers[i].top->slots[table];
+
+        for (int j = 0; j < OCTOPING_TOP_SLOTS; j++) {
+            if (slots[j].count > 0) {
+                octoping_monitor_rank(monitor->top, &monitor->nb_top, slots[j].key, slots[j].count);
+            }
+        }
+        memset(slots, 0, OCTOPING_TOP_SLOTS * sizeof(octoping_top_slot_t));
+    }
+}
+
+/*
+ * Collect the sources with the most probes over the rate limit since the
+ * previous interval, and reset their counts. A drop counted by a worker
+ * while the monitor resets the count may be lost.
+ */
+static void octoping_monitor_collect_limited(octoping_monitor_t* monitor)
+{
+    monitor->nb_limited = 0;
+
+    for (int i = 0; i < monitor->nb_workers; i++) {
+        octoping_limit_t* limit = monitor->workers[i].limit;
+
+        for (int j = 0; limit != NULL && j < OCTOPING_LIMIT_SETS; j++) {
+            octoping_limit_set_t* set = &limit->sets[j];
+
+            for (int w = 0; w < OCTOPING_LIMIT_WAYS; w++) {
+                uint32_t drops = OCTOPING_COUNTER_READ(set->drops[w]);
+
+                if (drops > 0) {
+                    OCTOPING_COUNTER_SET(set->drops[w], 0);
+                    octoping_monitor_rank(monitor->limited, &monitor->nb_limited,
+                        ((uint64_t)ntohl(OCTOPING_COUNTER_READ(set->addr[w]))) << 16, drops);
+                }
+            }
+        }
+    }
+}
+
+static void octoping_monitor_log(octoping_monitor_t* monitor, uint64_t now)
+{
+    octoping_server_counters_t total;
+    double elapsed = ((double)(now - monitor->log_time)) / 1000000000.0;
+    uint64_t rx_packets;
+    uint64_t rx_calls;
+
+    octoping_monitor_sum(monitor, &total);
+    octoping_monitor_collect_top(monitor, elapsed);
+    octoping_monitor_collect_limited(monitor);
+    rx_packets = total.rx_packets - monitor->last.rx_packets;
+    rx_calls = total.rx_calls - monitor->last.rx_calls;
+
+    printf("Server: rx %.0f pps %.3f Mbps, tx %.0f pps %.3f Mbps, %.1f packets per call, %" PRIu64 " short, %" PRIu64
+        " send errors, %" PRIu64 " kernel drops, %" PRIu64 " limited\n",
+        ((double)rx_packets) / elapsed, ((double)(total.rx_bytes - monitor->last.rx_bytes)) * 8.0 / (elapsed * 1000000.0),
+        ((double)(total.tx_packets - monitor->last.tx_packets)) / elapsed,
+        ((double)(total.tx_bytes - monitor->last.tx_bytes)) * 8.0 / (elapsed * 1000000.0),
+        (rx_calls > 0) ? ((double)rx_packets) / ((double)rx_calls) : 0.0,
+        total.short_packets - monitor->last.short_packets, total.send_errors - monitor->last.send_errors,
+        total.rx_drops - monitor->last.rx_drops, total.limited - monitor->last.limited);
+    if (monitor->nb_top > 0) {
+        printf("Top clients:");
+        for (int i = 0; i < monitor->nb_top; i++) {
+            char name[INET_ADDRSTRLEN + 8];
+
+            octoping_monitor_client_name(monitor->top[i].key, 1, name, sizeof(name));
+            printf(" %s %.0f pps%s", name, ((double)monitor->top[i].count) / elapsed, (i + 1 < monitor->nb_top) ? "," : "");
+        }
+        printf("\n");
+    }
+    if (monitor->nb_limited > 0) {
+        printf("Limited sources:");
+        for (int i = 0; i < monitor->nb_limited; i++) {
+            char name[INET_ADDRSTRLEN + 8];
+
+            octoping_monitor_client_name(monitor->limited[i].key, 0, name, sizeof(name));
+            printf(" %s %.0f pps dropped%s", name, ((double)monitor->limited[i].count) / elapsed,
+                (i + 1 < monitor->nb_limited) ? "," : "");
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+
+    monitor->last = total;
+    monitor->log_time = now;
+}
+
+/*
+ * Open the query endpoint: a TCP socket bound to the loopback address if
+ * the argument is a port number, a Unix socket otherwise.
+ */
+static SOCKET_TYPE octoping_monitor_listen(char const* query)
+{
+    SOCKET_TYPE s = INVALID_SOCKET;
+    int ret = 0;
+
+    if (strchr(query, '/') == NULL) {
+        struct sockaddr_in addr4 = { 0 };
+        int port = atoi(query);
+        int one = 1;
+
+        if (port <= 0 || port > 0xffff) {
+            printf("Invalid query port: %s\n", query);
+            return INVALID_SOCKET;
+        }
+        addr4.sin_family = AF_INET;
+        addr4.sin_port = htons((unsigned short)port);
+        addr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (s != INVALID_SOCKET) {
+            (void)setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*)&one, sizeof(one));
+            ret = bind(s, (struct sockaddr*)&addr4, sizeof(addr4));
+        }
+    }
+    else {
+        struct sockaddr_un addr_un = { 0 };
+
+        if (strlen(query) >= sizeof(addr_un.sun_path)) {
+            printf("Query socket path too long: %s\n", query);
+            return INVALID_SOCKET;
+        }
+        addr_un.sun_family = AF_UNIX;
+        memcpy(addr_un.sun_path, query, strlen(query));
+        /* Remove the socket left by a previous run */
+        (void)unlink(query);
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s != INVALID_SOCKET) {
+            ret = bind(s, (struct sockaddr*)&addr_un, sizeof(addr_un));
+        }
+    }
+
+    if (s == INVALID_SOCKET || ret != 0 || listen(s, 16) != 0) {
+        network_error();
+        printf("Cannot listen for queries on %s\n", query);
+        if (s != INVALID_SOCKET) {
+            SOCKET_CLOSE(s);
+            s = INVALID_SOCKET;
+        }
+    }
+    return s;
+}
+
+static void octoping_monitor_metric(FILE* F, char const* name, char const* type, octoping_monitor_t const* monitor,
+    size_t offset)
+{
+    fprintf(F, "# TYPE octoping_%s %s\n", name, type);
+    for (int i = 0; i < monitor->nb_workers; i++) {
+        uint64_t const* counter = (uint64_t const*)(((uint8_t const*)&monitor->workers[i].counters) + offset);
+
+        fprintf(F, "octoping_%s{worker=\"%d\"} %" PRIu64 "\n", name, i, OCTOPING_COUNTER_READ(*counter));
+    }
+}
+
+/*
+ * Write the counters of each worker, and the heavy and limited clients of
+ * the last log interval, then close the connection.
+ */
+static void octoping_monitor_answer(octoping_monitor_t const* monitor, SOCKET_TYPE s, uint64_t now)
+{
+    struct timeval timeout = { 0 };
+    FILE* F;
+
+    timeout.tv_sec = OCTOPING_MONITOR_SEND_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (OCTOPING_MONITOR_SEND_TIMEOUT_MS % 1000) * 1000;
+    (void)setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+
+    if ((F = fdopen(s, "w")) == NULL) {
+        SOCKET_CLOSE(s);
+        return;
+    }
+    fprintf(F, "# TYPE octoping_uptime_seconds gauge\n");
+    fprintf(F, "octoping_uptime_seconds %.3f\n", ((double)(now - monitor->start_time)) / 1000000000.0);
+    octoping_monitor_metric(F, "rx_packets_total", "counter", monitor, offsetof(octoping_server_counters_t, rx_packets));
+    octoping_monitor_metric(F, "rx_bytes_total", "counter", monitor, offsetof(octoping_server_counters_t, rx_bytes));
+    octoping_monitor_metric(F, "rx_calls_total", "counter", monitor, offsetof(octoping_server_counters_t, rx_calls));
+    octoping_monitor_metric(F, "tx_packets_total", "counter", monitor, offsetof(octoping_server_counters_t, tx_packets));
+    octoping_monitor_metric(F, "tx_bytes_total", "counter", monitor, offsetof(octoping_server_counters_t, tx_bytes));
+    octoping_monitor_metric(F, "short_packets_total", "counter", monitor, offsetof(octoping_server_counters_t, short_packets));
+    octoping_monitor_metric(F, "send_errors_total", "counter", monitor, offsetof(octoping_server_counters_t, send_errors));
+    octoping_monitor_metric(F, "rx_drops_total", "counter", monitor, offsetof(octoping_server_counters_t, rx_drops));
+    octoping_monitor_metric(F, "limited_total", "counter", monitor, offsetof(octoping_server_counters_t, limited));
+    if (monitor->nb_top > 0) {
+        fprintf(F, "# TYPE octoping_top_client_pps gauge\n");
+        for (int i = 0; i < monitor->nb_top; i++) {
+            char name[INET_ADDRSTRLEN + 8];
+
+            octoping_monitor_client_name(monitor->top[i].key, 1, name, sizeof(name));
+            fprintf(F, "octoping_top_client_pps{client=\"%s\"} %.0f\n", name,
+                ((double)monitor->top[i].count) / monitor->top_duration);
+        }
+    }
+    if (monitor->nb_limited > 0) {
+        fprintf(F, "# TYPE octoping_limited_source_pps gauge\n");
+        for (int i = 0; i < monitor->nb_limited; i++) {
+            char name[INET_ADDRSTRLEN + 8];
+
+            octoping_monitor_client_name(monitor->limited[i].key, 0, name, sizeof(name));
+            fprintf(F, "octoping_limited_source_pps{source=\"%s\"} %.0f\n", name,
+                ((double)monitor->limited[i].count) / monitor->top_duration);
+        }
+    }
+    (void)fclose(F);
+}
+
+int octoping_server_monitor(octoping_options_t* options, octoping_server_worker_t* workers, int nb_workers)
+{
+    int ret = 0;
+    uint64_t log_interval = (options->summary_interval_ns > 0) ? options->summary_interval_ns : OCTOPING_SERVER_LOG_INTERVAL;
+    SOCKET_TYPE s_query = INVALID_SOCKET;
+    octoping_monitor_t monitor;
+    struct sched_param param;
+
+    /* The workers may run with a real time policy, the monitor does not */
+    memset(&param, 0, sizeof(param));
+    (void)pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+    memset(&monitor, 0, sizeof(monitor));
+    monitor.workers = workers;
+    monitor.nb_workers = nb_workers;
+    monitor.start_time = current_time_ns();
+    monitor.log_time = monitor.start_time;
+
+    if (options->query != NULL) {
+        s_query = octoping_monitor_listen(options->query);
+        if (s_query == INVALID_SOCKET) {
+            ret = -1;
+        }
+    }
+
+    while (ret == 0 && !octoping_server_is_stopping()) {
+        uint64_t now;
+
+        if (s_query != INVALID_SOCKET) {
+            struct pollfd pfd;
+
+            pfd.fd = s_query;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, OCTOPING_MONITOR_POLL_MS) > 0 && (pfd.revents & POLLIN) != 0) {
+                SOCKET_TYPE s = accept(s_query, NULL, NULL);
+
+                if (s != INVALID_SOCKET) {
+                    octoping_monitor_answer(&monitor, s, current_time_ns());
+                }
+            }
+        }
+        else {
+            usleep(OCTOPING_MONITOR_POLL_MS * 1000);
+        }
+        now = current_time_ns();
+        if (now >= monitor.log_time + log_interval) {
+            octoping_monitor_log(&monitor, now);
+        }
+    }
+
+    if (s_query != INVALID_SOCKET) {
+        SOCKET_CLOSE(s_query);
+        if (strchr(options->query, '/') != NULL) {
+            (void)unlink(options->query);
+        }
+    }
+
+    return ret;
+}
+#endif
@@ -0,0 +1,659 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "octoping.h"
+
+/*
+ * Multi-target client. The targets are read from a file, with one
+ * target per line, written as an IPv4 address optionally followed by
+ * a port number. Empty lines and lines starting with '#' are ignored.
+ *
+ * Each target gets its own session and its own socket. The first
+ * sends of the sessions are spread over the probing interval, and the
+ * next sends are scheduled on a timer wheel. A timerfd armed at the
+ * next expiry of the wheel and all the sockets are polled with epoll.
+ */
+
+#ifdef OCTOPING_HAS_EPOLL
+#define OCTOPING_EPOLL_EVENTS 256
+
+static int octoping_read_targets(char const* target_file, uint16_t default_port,
+    struct sockaddr_in** targets, int* nb_targets)
+{
+    int ret = 0;
+    FILE* F = fopen(target_file, "r");
+    char line[256];
+    int line_number = 0;
+    int allocated = 0;
+
+    *targets = NULL;
+    *nb_targets = 0;
+
+    if (F == NULL) {
+        printf("Cannot open %s\n", target_file);
+        return -1;
+    }
+
+    while (ret == 0 && fgets(line, sizeof(line), F) != NULL) {
+        char address[64];
+        int port = default_port;
+        int nb_fields;
+
+        line_number++;
+        nb_fields = sscanf(line, "%63s %d", address, &port);
+        if (nb_fields <= 0 || address[0] == '#') {
+            continue;
+        }
+        if (*nb_targets >= OCTOPING_MAX_TARGETS) {
+            printf("Too many targets in %s, max %d\n", target_file, OCTOPING_MAX_TARGETS);
+            ret = -1;
+        }
+        else if (port <= 0 || port > 0xffff) {
+            printf("Invalid port on line %d of %s\n", line_number, target_file);
+            ret = -1;
+        }
+        else {
+            struct sockaddr_in addr = { 0 };
+
+            if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+                printf("%s is not a valid IPv4 address, line %d of %s\n", address, line_number, target_file);
+                ret = -1;
+            }
+            else {
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons((uint16_t)port);
+                if (*nb_targets >= allocated) {
+                    int new_allocated = (allocated == 0) ? 64 : 2 * allocated;
+                    struct sockaddr_in* new_targets = (struct sockaddr_in*)realloc(*targets,
+                        (size_t)new_allocated * sizeof(struct sockaddr_in));
+                    if (new_targets == NULL) {
+                        printf("Cannot allocate %d targets\n", new_allocated);
+                        ret = -1;
+                    }
+                    else {
+                        *targets = new_targets;
+                        allocated = new_allocated;
+                    }
+                }
+                if (ret == 0) {
+                    (*targets)[*nb_targets] = addr;
+                    *nb_targets += 1;
+                }
+            }
+        }
+    }
+    fclose(F);
+
+    if (ret == 0 && *nb_targets == 0) {
+        printf("No target found in %s\n", target_file);
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Each target uses a socket, so the file descriptor limit may need to be raised.
+ */
+static void octoping_raise_fd_limit(int nb_targets)
+{
+    struct rlimit limit;
+    rlim_t needed = (rlim_t)nb_targets + 32;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+        limit.rlim_cur = (limit.rlim_max < needed) ? limit.rlim_max : needed;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < needed) {
+            printf("Cannot raise the file descriptor limit to %llu\n", (unsigned long long)needed);
+        }
+    }
+}
+
+static int octoping_arm_timer(int tfd, uint64_t next_time)
+{
+    struct itimerspec its = { 0 };
+
+    its.it_value.tv_sec = (time_t)(next_time / 1000000000ull);
+    its.it_value.tv_nsec = (long)(next_time % 1000000000ull);
+    OCTOPING_COUNT_SYSCALL();
+    return timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * In load mode, all the flows go to the same server. Each flow is a
+ * separate socket, bound to its own source port.
+ */
+static int octoping_flow_targets(octoping_options_t const* options, struct sockaddr_in** targets, int* nb_targets)
+{
+    struct sockaddr_in addr = { 0 };
+
+    *targets = NULL;
+    *nb_targets = 0;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((options->server_port == 0) ? OCTOPING_PORT : options->server_port);
+    if (inet_pton(AF_INET, options->server_name, &addr.sin_addr) != 1) {
+        printf("%s is not a valid IPv4 address\n", options->server_name);
+        return -1;
+    }
+    if ((*targets = (struct sockaddr_in*)malloc((size_t)options->nb_flows * sizeof(struct sockaddr_in))) == NULL) {
+        printf("Cannot allocate %d flows\n", options->nb_flows);
+        return -1;
+    }
+    for (int i = 0; i < options->nb_flows; i++) {
+        (*targets)[i] = addr;
+    }
+    *nb_targets = options->nb_flows;
+    return 0;
+}
+
+static int octoping_flow_bind(SOCKET_TYPE s, uint16_t port, uint16_t* bound_port)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s, (struct sockaddr*)&addr, &addr_len) != 0) {
+        network_error();
+        printf("Cannot bind the flow socket to port %d\n", port);
+        return -1;
+    }
+    *bound_port = ntohs(addr.sin_port);
+    return 0;
+}
+
+typedef struct st_octoping_flow_rank_t {
+    double value;
+    int index;
+} octoping_flow_rank_t;
+
+static int octoping_flow_rank_compare(void const* a, void const* b)
+{
+    double va = ((octoping_flow_rank_t const*)a)->value;
+    double vb = ((octoping_flow_rank_t const*)b)->value;
+
+    return (va < vb) ? 1 : ((va > vb) ? -1 : 0);
+}
+
+/*
+ * Load mode report: the loss rate and rtt of each flow, then the flows
+ * with the highest loss rates and the highest mean rtt, compared to the
+ * median of all flows. A single bad ECMP path or server queue shows up
+ * as a group of flows well above the median.
+ */
+static void octoping_flow_report(FILE* F, octoping_session_t const* sessions, int nb_sessions)
+{
+    octoping_flow_rank_t* loss = (octoping_flow_rank_t*)malloc((size_t)nb_sessions * sizeof(octoping_flow_rank_t));
+    octoping_flow_rank_t* rtt = (octoping_flow_rank_t*)malloc((size_t)nb_sessions * sizeof(octoping_flow_rank_t));
+
+    fprintf(F, "flow, sent, echoes, lost, loss_pct, rtt_min, rtt_mean, rtt_max\n");
+    for (int i = 0; i < nb_sessions; i++) {
+        octoping_flow_stats_t const* flow = &sessions[i].flow;
+        uint64_t nb_probes = flow->nb_echoes + flow->nb_lost;
+        double loss_rate = (nb_probes > 0) ? 100.0 * ((double)flow->nb_lost) / ((double)nb_probes) : 0;
+        double rtt_mean = (flow->nb_echoes > 0) ? flow->rtt_sum / ((double)flow->nb_echoes) : 0;
+
+        fprintf(F, "%s, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %.3f, %.3f, %.3f, %.3f\n", sessions[i].label,
+            sessions[i].tracker.nb_sent, flow->nb_echoes, flow->nb_lost, loss_rate,
+            ((double)flow->rtt_min) / 1000.0, rtt_mean / 1000.0, ((double)flow->rtt_max) / 1000.0);
+        if (loss != NULL && rtt != NULL) {
+            loss[i].value = loss_rate;
+            loss[i].index = i;
+            rtt[i].value = rtt_mean;
+            rtt[i].index = i;
+        }
+    }
+
+    if (loss != NULL && rtt != NULL && nb_sessions > 2) {
+        int nb_outliers = (nb_sessions < OCTOPING_FLOW_OUTLIERS) ? nb_sessions : OCTOPING_FLOW_OUTLIERS;
+        double median_loss;
+        double median_rtt;
+
+        qsort(loss, (size_t)nb_sessions, sizeof(octoping_flow_rank_t), octoping_flow_rank_compare);
+        qsort(rtt, (size_t)nb_sessions, sizeof(octoping_flow_rank_t), octoping_flow_rank_compare);
+        median_loss = loss[nb_sessions / 2].value;
+        median_rtt = rtt[nb_sessions / 2].value;
+
+        fprintf(F, "Highest loss rates, median of %d flows %.3f%%:\n", nb_sessions, median_loss);
+        for (int i = 0; i < nb_outliers && loss[i].value > 0; i++) {
+            fprintf(F, "    %s: %.3f%%\n", sessions[loss[i].index].label, loss[i].value);
+        }
+        fprintf(F, "Highest mean rtt, median of %d flows %.3f us:\n", nb_sessions, median_rtt / 1000.0);
+        for (int i = 0; i < nb_outliers; i++) {
+            fprintf(F, "    %s: %.3f us, %.2f times the median\n", sessions[rtt[i].index].label, rtt[i].value / 1000.0,
+                (median_rtt > 0) ? rtt[i].value / median_rtt : 0);
+        }
+    }
+    free(loss);
+    free(rtt);
+}
+
+/*
+ * Sender thread. Each thread owns a contiguous range of the sessions,
+ * with its own wheel, epoll and timer descriptors, and output.
+ */
+typedef struct st_octoping_multi_thread_t {
+    octoping_options_t* options;
+    octoping_session_t* sessions;
+    int nb_sessions;
+    int thread_id;
+    int nb_threads;
+    uint64_t start_time;
+    char const* file_name;
+    char file_name_buffer[512];
+    octoping_stats_t* stats;
+    int ret;
+    pthread_t thread;
+} octoping_multi_thread_t;
+
+static int octoping_multi_run(octoping_multi_thread_t* thread)
+{
+    int ret = 0;
+    octoping_options_t* options = thread->options;
+    octoping_session_t* sessions = thread->sessions;
+    octoping_wheel_t* wheel = NULL;
+    int epfd = -1;
+    int tfd = -1;
+    octoping_output_t output;
+
+    memset(&output, 0, sizeof(output));
+    if (thread->nb_threads > 1 && options->first_cpu >= 0 &&
+        octoping_realtime_pin(options->first_cpu + thread->thread_id) != 0) {
+        printf("Thread %d cannot be pinned to CPU %d\n", thread->thread_id, options->first_cpu + thread->thread_id);
+    }
+    if ((wheel = (octoping_wheel_t*)malloc(sizeof(octoping_wheel_t))) == NULL) {
+        printf("Cannot allocate the timer wheel\n");
+        ret = -1;
+    }
+    else if ((epfd = epoll_create1(0)) < 0 || (tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) < 0) {
+        network_error();
+        printf("Cannot create the epoll and timer descriptors\n");
+        ret = -1;
+    }
+    else {
+        struct epoll_event ev = { 0 };
+        uint64_t start_time = thread->start_time;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) != 0) {
+            network_error();
+            ret = -1;
+        }
+
+        octoping_wheel_init(wheel, sessions[0].pacer.interval_ns / OCTOPING_WHEEL_SLOTS, start_time);
+        for (int i = 0; ret == 0 && i < thread->nb_sessions; i++) {
+            octoping_session_t* session = &sessions[i];
+
+            ev.events = EPOLLIN;
+            ev.data.ptr = session;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, session->s, &ev) != 0) {
+                network_error();
+                ret = -1;
+            }
+            octoping_wheel_insert(wheel, &session->timer, session->pacer.next_time);
+        }
+
+        if (ret == 0 && octoping_output_open(&output, thread->file_name, options->output_format,
+            options->timestamps, 1, options->nb_sizes > 0, options->summary_interval_ns) != 0) {
+            ret = -1;
+        }
+        output.report = thread->stats;
+        output.flush_interval_ns = options->flush_interval_ns;
+        output.rotate_bytes = options->rotate_bytes;
+        output.rotate_ns = options->rotate_ns;
+        output.with_dwell = (options->wire_version == 2);
+        if (thread->nb_threads > 1) {
+            /* The summary of all the threads is printed at the end */
+            output.F_summary = NULL;
+        }
+        if (ret == 0 && octoping_output_header(&output, options, start_time, sessions, (size_t)thread->nb_sessions) != 0) {
+            printf("Cannot write first line on %s", thread->file_name);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            uint64_t end_send_time = (options->duration_us > 0) ? start_time + options->duration_us * 1000 : UINT64_MAX;
+            uint64_t end_recv_time = (options->duration_us > 0) ? end_send_time + OCTOPING_CLIENT_LINGER : UINT64_MAX;
+            uint64_t r_t = start_time + 1000000000ull;
+            uint64_t t = current_time_ns();
+            struct epoll_event events[OCTOPING_EPOLL_EVENTS];
+
+            while (ret == 0 && t < end_recv_time) {
+                octoping_timer_t* timer;
+                uint64_t next_time;
+                int nb_events;
+
+                octoping_client_check_stop(t, &end_send_time, &end_recv_time);
+                if (t >= r_t) {
+                    if (options->file_name != NULL && options->duration_us > 0 && thread->thread_id == 0) {
+                        printf(".");
+                        fflush(stdout);
+                    }
+                    if (octoping_output_periodic(&output, t) != 0) {
+                        ret = -1;
+                    }
+                    r_t += 1000000000ull;
+                }
+
+                while (ret == 0 && (timer = octoping_wheel_next_expired(wheel, t)) != NULL) {
+                    octoping_session_t* session = (octoping_session_t*)timer->app_ctx;
+
+                    if (session->pacer.next_time > end_send_time) {
+                        /* The continuous run was interrupted */
+                        continue;
+                    }
+                    /* Send the whole burst back to back, each probe stamped with its own send time */
+                    do {
+                        t = current_time_ns();
+                        ret = octoping_session_send(session, t, &output);
+                        octoping_pacer_on_send(&session->pacer, t);
+                    } while (ret == 0 && session->pacer.burst_sent != 0);
+                    if (ret == 0 && session->pacer.next_time <= end_send_time) {
+                        octoping_wheel_insert(wheel, &session->timer, session->pacer.next_time);
+                    }
+                }
+
+                next_time = octoping_wheel_next_time(wheel);
+                if (next_time > r_t) {
+                    next_time = r_t;
+                }
+                if (next_time > end_recv_time) {
+                    next_time = end_recv_time;
+                }
+                if (ret == 0 && octoping_arm_timer(tfd, next_time) != 0) {
+                    network_error();
+                    printf("Cannot arm the timer\n");
+                    ret = -1;
+                }
+
+                OCTOPING_COUNT_SYSCALL();
+                nb_events = (ret == 0) ? epoll_wait(epfd, events, OCTOPING_EPOLL_EVENTS, -1) : 0;
+                if (nb_events < 0 && errno != EINTR) {
+                    network_error();
+                    printf("Error: epoll_wait returns %d\n", nb_events);
+                    ret = -1;
+                }
+                for (int i = 0; ret == 0 && i < nb_events; i++) {
+                    octoping_session_t* session = (octoping_session_t*)events[i].data.ptr;
+
+                    if (session == NULL) {
+                        uint64_t expirations;
+
+                        OCTOPING_COUNT_SYSCALL();
+                        (void)read(tfd, &expirations, sizeof(expirations));
+                    }
+                    else {
+                        int r;
+                        while ((r = octoping_session_receive(session, MSG_DONTWAIT, &output)) > 0);
+                        if (r < 0) {
+                            printf("Error while processing echo from %s\n", session->label);
+                            ret = -1;
+                        }
+                    }
+                }
+                t = current_time_ns();
+            }
+
+            for (int i = 0; ret == 0 && i < thread->nb_sessions; i++) {
+                ret = octoping_session_report_missing(&sessions[i], &output);
+            }
+        }
+
+        if (octoping_output_close(&output) != 0 && ret == 0) {
+            printf("Cannot write the results on %s\n",
+                (thread->file_name == NULL) ? "stdout" : thread->file_name);
+            ret = -1;
+        }
+    }
+
+    if (tfd >= 0) {
+        close(tfd);
+    }
+    if (epfd >= 0) {
+        close(epfd);
+    }
+    free(wheel);
+    thread->ret = ret;
+
+    return ret;
+}
+
+static void* octoping_multi_thread(void* arg)
+{
+    (void)octoping_multi_run((octoping_multi_thread_t*)arg);
+    return NULL;
+}
+
+int octoping_multi_client(octoping_options_t* options)
+{
+    int ret = 0;
+    struct sockaddr_in* targets = NULL;
+    int nb_targets = 0;
+    int nb_sockets = 0;
+    int nb_threads = (options->nb_threads > 1) ? options->nb_threads : 1;
+    int nb_started = 0;
+    octoping_session_t* sessions = NULL;
+    octoping_multi_thread_t* threads = NULL;
+    octoping_stats_t* stats = NULL;
+    uint16_t default_port = (options->server_port == 0) ? OCTOPING_PORT : options->server_port;
+
+    if (options->engine == octoping_engine_uring) {
+        printf("The io_uring engine is not available with -l or -n, using sockets.\n");
+    }
+    if (nb_threads > 1 && options->file_name == NULL && options->output_format != octoping_format_summary) {
+        printf("With several threads, the results are written in one file per thread, set with -f.\n");
+        ret = -1;
+    }
+    else if ((options->nb_flows > 0) ? octoping_flow_targets(options, &targets, &nb_targets) != 0 :
+        octoping_read_targets(options->target_file, default_port, &targets, &nb_targets) != 0) {
+        ret = -1;
+    }
+    else if ((sessions = (octoping_session_t*)calloc((size_t)nb_targets, sizeof(octoping_session_t))) == NULL ||
+        (threads = (octoping_multi_thread_t*)calloc((size_t)nb_threads, sizeof(octoping_multi_thread_t))) == NULL ||
+        (stats = (octoping_stats_t*)calloc((size_t)nb_threads + 1, sizeof(octoping_stats_t))) == NULL) {
+        printf("Cannot allocate %d sessions\n", nb_targets);
+        ret = -1;
+    }
+    else {
+        uint64_t start_time = current_time_ns();
+        /* In load mode, the interval is the aggregate interval of all flows */
+        uint64_t interval = (options->nb_flows > 0) ? options->interval_ns * (uint64_t)nb_targets : options->interval_ns;
+
+        if (nb_threads > nb_targets) {
+            nb_threads = nb_targets;
+        }
+        if (options->nb_flows > 0) {
+            char address[INET_ADDRSTRLEN];
+            printf("Will send packets to %s:%d from %d flows, %d threads\n",
+                inet_ntop(AF_INET, &targets[0].sin_addr, address, sizeof(address)), ntohs(targets[0].sin_port),
+                nb_targets, nb_threads);
+        }
+        else {
+            printf("Will send packets to %d targets\n", nb_targets);
+        }
+        octoping_raise_fd_limit(nb_targets);
+
+        for (; ret == 0 && nb_sockets < nb_targets; nb_sockets++) {
+            char label[OCTOPING_LABEL_MAX];
+            char address[INET_ADDRSTRLEN];
+            octoping_session_t* session = &sessions[nb_sockets];
+            SOCKET_TYPE s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            int thread_id = (int)(((int64_t)nb_sockets * nb_threads) / nb_targets);
+            int first_in_thread = (int)(((int64_t)thread_id * nb_targets + nb_threads - 1) / nb_threads);
+
+            if (s == INVALID_SOCKET) {
+                network_error();
+                printf("Cannot create socket for target %d\n", nb_sockets);
+                ret = -1;
+                break;
+            }
+            if (options->real_time) {
+                octoping_realtime_socket(s);
+            }
+            (void)snprintf(label, sizeof(label), "%s:%d",
+                inet_ntop(AF_INET, &targets[nb_sockets].sin_addr, address, sizeof(address)),
+                ntohs(targets[nb_sockets].sin_port));
+            if (options->nb_flows > 0) {
+                uint16_t source_port = 0;
+
+                if (octoping_flow_bind(s, (options->source_port == 0) ? 0 : (uint16_t)(options->source_port + nb_sockets),
+                    &source_port) != 0) {
+                    ret = -1;
+                }
+                else {
+                    size_t len = strlen(label);
+                    (void)snprintf(label + len, sizeof(label) - len, "/%d", source_port);
+                }
+            }
+            /* The target index is local to the output of the thread */
+            if (octoping_session_init(session, s, &targets[nb_sockets], label, (uint32_t)(nb_sockets - first_in_thread),
+                options->timestamps, start_time) != 0) {
+                printf("Cannot initialize the session for target %d\n", nb_sockets);
+                ret = -1;
+            }
+            octoping_session_set_probes(session, options->sizes, options->nb_sizes, options->train_length);
+            session->wire_v2 = (options->wire_version == 2);
+#ifdef OCTOPING_HAS_TIMESTAMPING
+            if (ret == 0 && options->timestamps && octoping_enable_timestamps(s, 1) != 0) {
+                ret = -1;
+            }
+#endif
+            /* Spread the first probes of the targets over the interval */
+            octoping_pacer_init(&session->pacer, start_time + (interval * (uint64_t)nb_sockets) / (uint64_t)nb_targets,
+                interval, options->burst_size);
+        }
+
+        for (int k = 0; ret == 0 && k < nb_threads; k++) {
+            octoping_multi_thread_t* thread = &threads[k];
+            int first = (int)(((int64_t)k * nb_targets + nb_threads - 1) / nb_threads);
+            int next = (int)(((int64_t)(k + 1) * nb_targets + nb_threads - 1) / nb_threads);
+
+            thread->options = options;
+            thread->sessions = &sessions[first];
+            thread->nb_sessions = next - first;
+            thread->thread_id = k;
+            thread->nb_threads = nb_threads;
+            thread->start_time = start_time;
+            thread->stats = (nb_threads > 1) ? &stats[k] : options->report;
+            thread->file_name = options->file_name;
+            if (nb_threads > 1) {
+                if (options->output_format == octoping_format_summary) {
+                    thread->file_name = NULL;
+                }
+                else {
+                    (void)snprintf(thread->file_name_buffer, sizeof(thread->file_name_buffer), "%s.%d",
+                        options->file_name, k);
+                    thread->file_name = thread->file_name_buffer;
+                }
+            }
+        }
+
+        if (ret == 0 && options->duration_us == 0) {
+            octoping_client_catch_signals();
+        }
+        if (ret == 0 && nb_threads == 1) {
+            ret = octoping_multi_run(&threads[0]);
+        }
+        else if (ret == 0) {
+            for (; nb_started < nb_threads; nb_started++) {
+                if (pthread_create(&threads[nb_started].thread, NULL, octoping_multi_thread, &threads[nb_started]) != 0) {
+                    printf("Cannot start thread %d\n", nb_started);
+                    ret = -1;
+                    break;
+                }
+            }
+            for (int k = 0; k < nb_started; k++) {
+                (void)pthread_join(threads[k].thread, NULL);
+                if (threads[k].ret != 0) {
+                    ret = -1;
+                }
+            }
+        }
+        printf("\n");
+
+        if (ret == 0) {
+            octoping_tracker_t total = { 0 };
+            octoping_pacer_t total_pacer = { 0 };
+
+            if (options->nb_flows > 0) {
+                octoping_flow_report(stdout, sessions, nb_targets);
+            }
+            for (int i = 0; i < nb_targets; i++) {
+                if (options->nb_flows == 0) {
+                    octoping_session_print_counts(stdout, sessions[i].label, &sessions[i].tracker);
+                    octoping_session_print_clock(stdout, sessions[i].label, &sessions[i]);
+                }
+                total.nb_sent += sessions[i].tracker.nb_sent;
+                total.nb_on_time += sessions[i].tracker.nb_on_time;
+                total.nb_reordered += sessions[i].tracker.nb_reordered;
+                total.nb_duplicate += sessions[i].tracker.nb_duplicate;
+                total.nb_late += sessions[i].tracker.nb_late;
+                total.nb_lost += sessions[i].tracker.nb_lost;
+                octoping_pacer_merge(&total_pacer, &sessions[i].pacer);
+            }
+            octoping_session_print_counts(stdout, (options->nb_flows > 0) ? "all flows" : "all targets", &total);
+            octoping_pacer_print(stdout, (options->nb_flows > 0) ? "all flows" : "all targets", &total_pacer);
+        }
+
+        if (ret == 0 && nb_threads > 1) {
+            octoping_stats_t* all = &stats[nb_threads];
+            FILE* F = stdout;
+
+            for (int k = 0; k < nb_threads; k++) {
+                octoping_stats_merge(all, &stats[k]);
+            }
+            if (options->output_format == octoping_format_summary && options->file_name != NULL &&
+                (F = octoping_open_output(options->file_name)) == NULL) {
+                ret = -1;
+            }
+            else {
+                if (octoping_stats_print(F, "Summary of all threads", all) != 0) {
+                    ret = -1;
+                }
+                if (F != stdout) {
+                    (void)fclose(F);
+                }
+            }
+            if (options->report != NULL) {
+                *options->report = *all;
+            }
+        }
+    }
+
+    for (int i = 0; i < nb_sockets; i++) {
+        SOCKET_CLOSE(sessions[i].s);
+        octoping_session_release(&sessions[i]);
+    }
+    free(threads);
+    free(stats);
+    free(sessions);
+    free(targets);
+
+    return ret;
+}
+#else
+int octoping_multi_client(octoping_options_t* options)
+{
+    (void)options;
+    printf("The multi-target mode is not supported on this platform.\n");
+    return -1;
+}
+#endif
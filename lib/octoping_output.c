@@ -0,0 +1,640 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Output of the probe results, either as CSV lines or as a binary log.
+ * In CSV, times are printed in microseconds, or in nanoseconds with
+ * two additional columns if kernel timestamps are used. With the wire
+ * format version 2, the dwell and net_rtt columns follow. The probe size
+ * is printed in a last column if the probe sizes are set.
+ */
+
+void octoping_result_derive(octoping_result_t* result)
+{
+    if ((result->flags & OCTOPING_RESULT_LOST) == 0 && result->echo > result->sent) {
+        result->rtt = result->echo - result->sent;
+        result->wire_rtt = result->wire_echo - result->wire_sent;
+        result->net_rtt = result->wire_rtt - result->dwell;
+        result->up_t = result->received - result->phase - result->wire_sent;
+        result->down_t = result->net_rtt - result->up_t;
+    }
+    else {
+        result->rtt = 0;
+        result->wire_rtt = 0;
+        result->net_rtt = 0;
+        result->up_t = 0;
+        result->down_t = 0;
+    }
+}
+
+int octoping_parse_format(char const* arg, int* format)
+{
+    int ret = 0;
+
+    if (strcmp(arg, "csv") == 0) {
+        *format = octoping_format_csv;
+    }
+    else if (strcmp(arg, "bin") == 0) {
+        *format = octoping_format_binary;
+    }
+    else if (strcmp(arg, "summary") == 0) {
+        *format = octoping_format_summary;
+    }
+    else {
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Parse a rotation specification: a size followed by K, M or G, a period
+ * followed by s, m, h or d, or both separated by a comma, e.g. "100M,1h".
+ */
+int octoping_parse_rotation(char const* arg, uint64_t* rotate_bytes, uint64_t* rotate_ns)
+{
+    int ret = 0;
+    char const* x = arg;
+
+    *rotate_bytes = 0;
+    *rotate_ns = 0;
+    while (ret == 0 && *x != 0) {
+        char* end = NULL;
+        double v = strtod(x, &end);
+
+        if (end == x || v <= 0) {
+            ret = -1;
+            break;
+        }
+        switch (*end) {
+        case 'K':
+            *rotate_bytes = (uint64_t)(v * 1024.0);
+            break;
+        case 'M':
+            *rotate_bytes = (uint64_t)(v * 1024.0 * 1024.0);
+            break;
+        case 'G':
+            *rotate_bytes = (uint64_t)(v * 1024.0 * 1024.0 * 1024.0);
+            break;
+        case 's':
+            *rotate_ns = (uint64_t)(v * 1000000000.0);
+            break;
+        case 'm':
+            *rotate_ns = (uint64_t)(v * 60000000000.0);
+            break;
+        case 'h':
+            *rotate_ns = (uint64_t)(v * 3600000000000.0);
+            break;
+        case 'd':
+            *rotate_ns = (uint64_t)(v * 86400000000000.0);
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+        if (ret == 0) {
+            end++;
+            if (*end == ',') {
+                end++;
+            }
+            else if (*end != 0) {
+                ret = -1;
+            }
+            x = end;
+        }
+    }
+    if (ret == 0 && *rotate_bytes == 0 && *rotate_ns == 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int octoping_csv_header(FILE* F, int timestamps, int with_label, int with_size, int with_dwell)
+{
+    int ret = 0;
+
+    if (with_label && fprintf(F, "target, ") <= 0) {
+        ret = -1;
+    }
+    else if (fprintf(F, (timestamps) ?
+        "number, sent, received, echo, rtt, up_t, down_t, phase, drift, wire_rtt, stack_t%s%s\n" :
+        "number, sent, received, echo, rtt, up_t, down_t, phase, drift%s%s\n",
+        (with_dwell) ? ", dwell, net_rtt" : "", (with_size) ? ", size" : "") <= 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int octoping_csv_line(FILE* F, int timestamps, int with_size, int with_dwell, char const* label,
+    octoping_result_t const* result)
+{
+    int ret = 0;
+    int64_t unit = (timestamps) ? 1 : 1000;
+
+    if (label != NULL && fprintf(F, "%s,", label) < 0) {
+        ret = -1;
+    }
+    else if ((result->flags & OCTOPING_RESULT_LOST) != 0) {
+        if (fprintf(F, (timestamps) ? "%"PRIu64",%"PRId64",0,0,0,0,0,0,0,0,0" : "%"PRIu64",%"PRId64",0,0,0,0,0,0,0",
+            result->seqnum, result->sent / unit) < 0) {
+            ret = -1;
+        }
+    }
+    else if ((timestamps) ?
+        fprintf(F, "%"PRIu64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64", %"PRId64", %"PRId64", %"PRId64", %"PRId64", %"PRId64,
+            result->seqnum, result->sent, result->received, result->echo, result->rtt, result->up_t, result->down_t,
+            result->phase, result->drift, result->wire_rtt, result->rtt - result->wire_rtt) < 0 :
+        fprintf(F, "%"PRIu64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64", %"PRId64", %"PRId64", %"PRId64,
+            result->seqnum, result->sent / unit, result->received / unit, result->echo / unit, result->rtt / unit,
+            result->up_t / unit, result->down_t / unit, result->phase / unit, result->drift) < 0) {
+        ret = -1;
+    }
+    if (ret == 0 && with_dwell && fprintf(F, ", %" PRId64 ", %" PRId64, result->dwell / unit, result->net_rtt / unit) < 0) {
+        ret = -1;
+    }
+    if (ret == 0 && ((with_size) ? fprintf(F, ", %u\n", result->length) < 0 : fputc('\n', F) == EOF)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int octoping_output_open(octoping_output_t* output, char const* file_name, octoping_format_t format,
+    int timestamps, int with_label, int with_size, uint64_t summary_interval_ns)
+{
+    int ret = 0;
+
+    memset(output, 0, sizeof(octoping_output_t));
+    output->format = format;
+    output->timestamps = (timestamps) ? 1 : 0;
+    output->with_label = (with_label) ? 1 : 0;
+    output->with_size = (with_size) ? 1 : 0;
+    output->summary_interval_ns = summary_interval_ns;
+    output->file_name = file_name;
+    output->F_summary = stdout;
+
+    if ((output->window = (octoping_stats_t*)malloc(sizeof(octoping_stats_t))) == NULL ||
+        (output->total = (octoping_stats_t*)malloc(sizeof(octoping_stats_t))) == NULL) {
+        printf("Cannot allocate the statistics\n");
+        ret = -1;
+    }
+    else {
+        octoping_stats_reset(output->window);
+        octoping_stats_reset(output->total);
+    }
+
+    if (ret != 0) {
+        /* Already failed */
+    }
+    else if (format == octoping_format_summary) {
+        if ((output->F_summary = octoping_open_output(file_name)) == NULL) {
+            ret = -1;
+        }
+    }
+    else if (format == octoping_format_callback) {
+        /* The results go to output->result_fn, nothing is printed */
+        output->F_summary = NULL;
+    }
+    else if (format == octoping_format_binary) {
+        if (file_name == NULL) {
+            printf("The binary format requires an output file\n");
+            ret = -1;
+        }
+        else if ((output->buffer = (uint8_t*)malloc(OCTOPING_OUTPUT_BUFFER_SIZE)) == NULL) {
+            printf("Cannot allocate the output buffer\n");
+            ret = -1;
+        }
+        else if ((output->F = octoping_open_file(file_name, "wb")) == NULL) {
+            ret = -1;
+        }
+        else {
+            output->buffer_size = OCTOPING_OUTPUT_BUFFER_SIZE;
+        }
+    }
+    else if ((output->F = octoping_open_output(file_name)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret != 0 && output->F_summary != NULL) {
+        if (output->F_summary != stdout) {
+            (void)fclose(output->F_summary);
+        }
+        output->F_summary = NULL;
+    }
+    return ret;
+}
+
+static int octoping_output_write(octoping_output_t* output, char const* label, octoping_result_t const* result)
+{
+    int ret = 0;
+
+    if (output->format != octoping_format_binary && output->format != octoping_format_csv) {
+        /* Nothing to write */
+    }
+    else if (output->F == NULL) {
+        /* The file could not be reopened after a rotation */
+        ret = -1;
+    }
+    else if (output->format == octoping_format_binary) {
+        ret = octoping_binlog_record(output, result);
+    }
+    else {
+        ret = octoping_csv_line(output->F, output->timestamps, output->with_size, output->with_dwell, label, result);
+    }
+    return ret;
+}
+
+static int octoping_file_exists(char const* file_name)
+{
+    FILE* F = NULL;
+#ifdef _WINDOWS
+    if (fopen_s(&F, file_name, "rb") != 0) {
+        F = NULL;
+    }
+#else
+    F = fopen(file_name, "rb");
+#endif
+    if (F != NULL) {
+        (void)fclose(F);
+    }
+    return F != NULL;
+}
+
+/*
+ * Rename the full file with the UTC time at which it was started, adding
+ * a counter if several files were started in the same second, and start
+ * a new one with the same header. If the file cannot be renamed, the
+ * rotation is disabled and the results are appended to the file.
+ */
+static int octoping_output_rotate(octoping_output_t* output, uint64_t current_time)
+{
+    int ret = 0;
+    char rotated[512];
+    char const* mode = (output->format == octoping_format_binary) ? "wb" : "wt";
+    time_t file_time = (time_t)(output->file_start / 1000000000ull);
+    struct tm tm;
+    size_t l;
+
+    if (fclose(output->F) != 0) {
+        ret = -1;
+    }
+    output->F = NULL;
+#ifdef _WINDOWS
+    (void)gmtime_s(&tm, &file_time);
+#else
+    (void)gmtime_r(&file_time, &tm);
+#endif
+    l = (size_t)snprintf(rotated, sizeof(rotated), "%s.", output->file_name);
+    if (l < sizeof(rotated)) {
+        l += strftime(rotated + l, sizeof(rotated) - l, "%Y%m%d-%H%M%S", &tm);
+    }
+    for (int i = 1; l < sizeof(rotated) && octoping_file_exists(rotated); i++) {
+        (void)snprintf(rotated + l, sizeof(rotated) - l, ".%d", i);
+    }
+    if (l >= sizeof(rotated) || rename(output->file_name, rotated) != 0) {
+        printf("Cannot rename %s, rotation disabled\n", output->file_name);
+        output->rotate_bytes = 0;
+        output->rotate_ns = 0;
+        mode = (output->format == octoping_format_binary) ? "ab" : "at";
+    }
+    if ((output->F = octoping_open_file(output->file_name, mode)) == NULL) {
+        ret = -1;
+    }
+    else if (output->rotate_bytes == 0 && output->rotate_ns == 0) {
+        /* Appending to the current file */
+    }
+    else if (output->format == octoping_format_binary) {
+        if (fwrite(output->header, 1, output->header_size, output->F) != output->header_size) {
+            ret = -1;
+        }
+    }
+    else {
+        ret = octoping_csv_header(output->F, output->timestamps, output->with_label, output->with_size, output->with_dwell);
+    }
+    output->file_start = current_time;
+    return ret;
+}
+
+/*
+ * Flush the output if the flush interval has elapsed since the last
+ * flush, then check whether the file shall be rotated.
+ */
+static int octoping_output_scheduled_flush(octoping_output_t* output, uint64_t current_time)
+{
+    int ret = 0;
+    uint64_t flush_interval = (output->flush_interval_ns > 0) ? output->flush_interval_ns : OCTOPING_OUTPUT_FLUSH_INTERVAL;
+
+    if (current_time >= output->last_flush + flush_interval) {
+        output->last_flush = current_time;
+        ret = octoping_output_flush(output);
+        if (ret == 0 && output->F != NULL && output->F != stdout && (output->rotate_bytes > 0 || output->rotate_ns > 0)) {
+#ifdef _WINDOWS
+            uint64_t file_size = (uint64_t)_ftelli64(output->F);
+#else
+            uint64_t file_size = (uint64_t)ftello(output->F);
+#endif
+            if ((output->rotate_ns > 0 && current_time >= output->file_start + output->rotate_ns) ||
+                (output->rotate_bytes > 0 && file_size >= output->rotate_bytes)) {
+                ret = octoping_output_rotate(output, current_time);
+            }
+        }
+    }
+    return ret;
+}
+
+#ifndef _WINDOWS
+/*
+ * Writer thread. Drains the ring, flushes the output and rotates the
+ * files on schedule, and sleeps when there is nothing to write. In real
+ * time mode, the writer runs with the default scheduling policy and off
+ * the CPU of the probe loop, which spins with a real time policy and
+ * would otherwise starve it. Once asked to stop, it drains the entries
+ * pushed before the request and exits.
+ */
+static void* octoping_output_writer(void* arg)
+{
+    octoping_output_t* output = (octoping_output_t*)arg;
+    octoping_output_entry_t entry;
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    (void)pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    if (octoping_realtime_unpin() != 0) {
+        printf("Cannot move the writer thread off the probe loop CPU\n");
+    }
+
+    while (1) {
+        uint64_t stop = OCTOPING_LOAD_ACQUIRE(&output->writer_stop);
+
+        while (octoping_ring_pop(output->ring, &entry) == 0) {
+            if (octoping_output_write(output, entry.label, &entry.result) != 0) {
+                OCTOPING_STORE_RELEASE(&output->writer_error, 1);
+            }
+        }
+        if (stop) {
+            break;
+        }
+        if (octoping_output_scheduled_flush(output, current_time_ns()) != 0) {
+            OCTOPING_STORE_RELEASE(&output->writer_error, 1);
+        }
+        usleep(OCTOPING_OUTPUT_IDLE_US);
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Start the writer thread. If that fails, the results are written by
+ * the probe loop.
+ */
+static void octoping_output_start_writer(octoping_output_t* output)
+{
+#ifndef _WINDOWS
+    if ((output->ring = (octoping_ring_t*)malloc(sizeof(octoping_ring_t))) == NULL ||
+        octoping_ring_init(output->ring, sizeof(octoping_output_entry_t), OCTOPING_OUTPUT_RING_SIZE) != 0) {
+        printf("Cannot allocate the output ring, writing from the probe loop\n");
+    }
+    else if (pthread_create(&output->writer, NULL, octoping_output_writer, output) != 0) {
+        printf("Cannot start the writer thread, writing from the probe loop\n");
+        octoping_ring_release(output->ring);
+    }
+    else {
+        return;
+    }
+    free(output->ring);
+    output->ring = NULL;
+#else
+    (void)output;
+#endif
+}
+
+static void octoping_output_stop_writer(octoping_output_t* output)
+{
+#ifndef _WINDOWS
+    if (output->ring != NULL) {
+        OCTOPING_STORE_RELEASE(&output->writer_stop, 1);
+        (void)pthread_join(output->writer, NULL);
+        if (output->ring->nb_overflow > 0) {
+            printf("Output too slow, %" PRIu64 " results were not written\n", output->ring->nb_overflow);
+        }
+        octoping_ring_release(output->ring);
+        free(output->ring);
+        output->ring = NULL;
+    }
+#else
+    (void)output;
+#endif
+}
+
+int octoping_output_header(octoping_output_t* output, octoping_options_t const* options, uint64_t start_time,
+    octoping_session_t const* sessions, size_t nb_sessions)
+{
+    int ret = 0;
+
+    output->start_time = start_time;
+    output->window_start = start_time;
+    output->last_flush = start_time;
+    output->file_start = start_time;
+    if (output->format == octoping_format_binary) {
+        ret = octoping_binlog_header(output, options, start_time, sessions, nb_sessions);
+        if (ret == 0 && (output->rotate_bytes > 0 || output->rotate_ns > 0)) {
+            /* Keep a copy of the header, to start the next files */
+            if (ftell(output->F) != 0) {
+                printf("The binary header is too large for rotating the files\n");
+                ret = -1;
+            }
+            else if ((output->header = (uint8_t*)malloc(output->buffer_used)) == NULL) {
+                printf("Cannot allocate the binary header\n");
+                ret = -1;
+            }
+            else {
+                memcpy(output->header, output->buffer, output->buffer_used);
+                output->header_size = output->buffer_used;
+            }
+        }
+    }
+    else if (output->format == octoping_format_csv) {
+        ret = octoping_csv_header(output->F, output->timestamps, output->with_label, output->with_size, output->with_dwell);
+    }
+    if (ret == 0 && output->format != octoping_format_summary && output->format != octoping_format_callback &&
+        !output->write_in_loop) {
+        octoping_output_start_writer(output);
+    }
+    return ret;
+}
+
+int octoping_output_result(octoping_output_t* output, octoping_session_t* session, octoping_result_t const* result)
+{
+    int ret = 0;
+    char const* label = (output->with_label) ? session->label : NULL;
+
+    octoping_stats_add(output->window, result, &session->last_rtt);
+    octoping_flow_stats_add(&session->flow, result);
+#ifdef OCTOPING_HAS_FEED
+    if (output->feed != NULL) {
+        octoping_feed_publish(output->feed, result);
+    }
+#endif
+    if (output->format == octoping_format_callback) {
+        ret = output->result_fn(output->callback_ctx, session, result);
+    }
+    else if (output->ring != NULL) {
+        if (OCTOPING_LOAD_ACQUIRE(&output->writer_error)) {
+            ret = -1;
+        }
+        else {
+            octoping_output_entry_t entry;
+
+            entry.result = *result;
+            entry.label = label;
+            /* If the ring is full, the overflow is counted */
+            (void)octoping_ring_push(output->ring, &entry);
+        }
+    }
+    else {
+        ret = octoping_output_write(output, label, result);
+    }
+    return ret;
+}
+
+/*
+ * Print the statistics of the current window, if it is complete or if
+ * this is the end of the run, and add them to the totals. Nothing is
+ * printed if F_summary is NULL, as in the sender threads of the load mode.
+ */
+static int octoping_output_summary(octoping_output_t* output, uint64_t current_time, int is_final)
+{
+    int ret = 0;
+
+    if (output->window != NULL && output->total != NULL &&
+        (is_final || (output->summary_interval_ns > 0 && current_time >= output->window_start + output->summary_interval_ns))) {
+        char label[64];
+
+        if (output->summary_interval_ns > 0 && output->F_summary != NULL) {
+            (void)snprintf(label, sizeof(label), "Summary %.3fs to %.3fs",
+                ((double)(output->window_start - output->start_time)) / 1000000000.0,
+                ((double)(current_time - output->start_time)) / 1000000000.0);
+            ret = octoping_stats_print(output->F_summary, label, output->window);
+        }
+#ifdef OCTOPING_HAS_FEED
+        if (output->feed != NULL) {
+            octoping_feed_publish_summary(output->feed, output->window_start, current_time, output->window);
+        }
+#endif
+        octoping_stats_merge(output->total, output->window);
+        octoping_stats_reset(output->window);
+        output->window_start = current_time;
+        if (output->F_summary != NULL) {
+            if (is_final && ret == 0) {
+                ret = octoping_stats_print(output->F_summary, "Summary of the run", output->total);
+            }
+            if (ret == 0 && fflush(output->F_summary) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+int octoping_output_flush(octoping_output_t* output)
+{
+    int ret = 0;
+
+    if (output->buffer_used > 0) {
+        if (fwrite(output->buffer, 1, output->buffer_used, output->F) != output->buffer_used) {
+            ret = -1;
+        }
+        output->buffer_used = 0;
+    }
+    if (output->F != NULL && fflush(output->F) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int octoping_output_periodic(octoping_output_t* output, uint64_t current_time)
+{
+    int ret = 0;
+
+    if (output->ring == NULL) {
+        ret = octoping_output_scheduled_flush(output, current_time);
+    }
+    else if (OCTOPING_LOAD_ACQUIRE(&output->writer_error)) {
+        ret = -1;
+    }
+
+    if (octoping_output_summary(output, current_time, 0) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int octoping_output_close(octoping_output_t* output)
+{
+    return octoping_output_close_at(output, current_time_ns());
+}
+
+int octoping_output_close_at(octoping_output_t* output, uint64_t current_time)
+{
+    int ret = 0;
+
+    octoping_output_stop_writer(output);
+    if (output->writer_error) {
+        ret = -1;
+    }
+    if (output->F != NULL) {
+        if (octoping_output_flush(output) != 0) {
+            ret = -1;
+        }
+        if (output->F != stdout && fclose(output->F) != 0) {
+            ret = -1;
+        }
+        output->F = NULL;
+    }
+    if (octoping_output_summary(output, current_time, 1) != 0) {
+        ret = -1;
+    }
+#ifdef OCTOPING_HAS_FEED
+    octoping_feed_close(output->feed);
+    output->feed = NULL;
+#endif
+    if (output->report != NULL && output->total != NULL) {
+        *output->report = *output->total;
+    }
+    if (output->F_summary != NULL) {
+        if (output->F_summary != stdout && fclose(output->F_summary) != 0) {
+            ret = -1;
+        }
+        output->F_summary = NULL;
+    }
+    if (output->buffer != NULL) {
+        free(output->buffer);
+        output->buffer = NULL;
+    }
+    free(output->header);
+    output->header = NULL;
+    free(output->window);
+    output->window = NULL;
+    free(output->total);
+    output->total = NULL;
+    return ret;
+}
@@ -0,0 +1,192 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "octoping.h"
+#include <math.h>
+
+void octoping_pacer_init(octoping_pacer_t* pacer, uint64_t start_time, uint64_t interval_ns, int burst_size)
+{
+    memset(pacer, 0, sizeof(octoping_pacer_t));
+    pacer->interval_ns = interval_ns;
+    pacer->burst_size = (burst_size > 1) ? burst_size : 1;
+    pacer->next_time = start_time;
+}
+
+/*
+ * Record a send at time t, which is at or after the scheduled time.
+ * All the packets of a burst are scheduled at the same time. Once the
+ * burst is complete, schedule the next one.
+ */
+void octoping_pacer_on_send(octoping_pacer_t* pacer, uint64_t t)
+{
+    uint64_t drift = (t > pacer->next_time) ? t - pacer->next_time : 0;
+
+    pacer->nb_sends++;
+    pacer->drift_sum += (double)drift;
+    pacer->drift_sum_squares += ((double)drift) * ((double)drift);
+    if (drift > pacer->drift_max) {
+        pacer->drift_max = drift;
+    }
+
+    pacer->burst_sent++;
+    if (pacer->burst_sent >= pacer->burst_size) {
+        pacer->burst_sent = 0;
+        pacer->next_time += pacer->interval_ns;
+        if (t >= pacer->next_time + pacer->interval_ns) {
+            uint64_t missed = (t - pacer->next_time) / pacer->interval_ns;
+            pacer->next_time += missed * pacer->interval_ns;
+            pacer->nb_skipped += missed;
+        }
+    }
+}
+
+void octoping_pacer_merge(octoping_pacer_t* total, octoping_pacer_t const* pacer)
+{
+    total->nb_sends += pacer->nb_sends;
+    total->nb_skipped += pacer->nb_skipped;
+    total->drift_sum += pacer->drift_sum;
+    total->drift_sum_squares += pacer->drift_sum_squares;
+    if (pacer->drift_max > total->drift_max) {
+        total->drift_max = pacer->drift_max;
+    }
+}
+
+void octoping_pacer_print(FILE* F, char const* label, octoping_pacer_t const* pacer)
+{
+    double mean = 0;
+    double stdev = 0;
+
+    if (pacer->nb_sends > 0) {
+        double variance;
+        mean = pacer->drift_sum / (double)pacer->nb_sends;
+        variance = pacer->drift_sum_squares / (double)pacer->nb_sends - mean * mean;
+        stdev = (variance > 0) ? sqrt(variance) : 0;
+    }
+    fprintf(F, "%s: send drift from schedule mean %.3f us, stdev %.3f us, max %.3f us, %" PRIu64 " bursts skipped\n",
+        label, mean / 1000.0, stdev / 1000.0, ((double)pacer->drift_max) / 1000.0, pacer->nb_skipped);
+}
+
+/*
+ * Parse an interval, expressed as a number followed by an optional
+ * unit: "ms" (the default), "us", "ns", or "pps", "kpps" or "Mpps" for
+ * a packet rate.
+ */
+int octoping_parse_interval(char const* arg, uint64_t* interval_ns)
+{
+    char* end = NULL;
+    double v = strtod(arg, &end);
+    double ns;
+
+    if (end == arg || v <= 0) {
+        return -1;
+    }
+    if (*end == 0 || strcmp(end, "ms") == 0) {
+        ns = v * 1000000.0;
+    }
+    else if (strcmp(end, "us") == 0) {
+        ns = v * 1000.0;
+    }
+    else if (strcmp(end, "ns") == 0) {
+        ns = v;
+    }
+    else if (strcmp(end, "pps") == 0) {
+        ns = 1000000000.0 / v;
+    }
+    else if (strcmp(end, "kpps") == 0) {
+        ns = 1000000.0 / v;
+    }
+    else if (strcmp(end, "Mpps") == 0) {
+        ns = 1000.0 / v;
+    }
+    else {
+        return -1;
+    }
+    if (ns < 1.0 || ns > 3600000000000.0) {
+        return -1;
+    }
+    *interval_ns = (uint64_t)(ns + 0.5);
+    return 0;
+}
+
+/*
+ * Wait until the socket is readable or the wake time is reached.
+ * Returns 1 if the socket is readable, 0 if the wait timed out.
+ * If a timerfd is provided, it is armed at the wake time and polled
+ * with the socket, instead of using the select timeout.
+ */
+int octoping_wait_readable(SOCKET_TYPE s, int tfd, uint64_t current_time, uint64_t wake_time)
+{
+    int ret;
+    fd_set readfds;
+    struct timeval tv = { 0 };
+    struct timeval* ptv = &tv;
+    int nfds = (int)s + 1;
+
+    FD_ZERO(&readfds);
+    FD_SET(s, &readfds);
+#ifdef __linux__
+    if (tfd >= 0) {
+        struct itimerspec its = { 0 };
+
+        its.it_value.tv_sec = (time_t)(wake_time / 1000000000ull);
+        its.it_value.tv_nsec = (long)(wake_time % 1000000000ull);
+        OCTOPING_COUNT_SYSCALL();
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+            FD_SET(tfd, &readfds);
+            if (tfd + 1 > nfds) {
+                nfds = tfd + 1;
+            }
+            ptv = NULL;
+        }
+    }
+#else
+    (void)tfd;
+#endif
+    if (ptv != NULL) {
+        uint64_t delta_t = (wake_time > current_time) ? (wake_time - current_time) / 1000 : 0;
+        tv.tv_sec = (long)(delta_t / 1000000);
+        tv.tv_usec = (long)(delta_t % 1000000);
+    }
+
+    OCTOPING_COUNT_SYSCALL();
+    ret = select(nfds, &readfds, NULL, NULL, ptv);
+    if (ret < 0) {
+        if (errno == EINTR) {
+            ret = 0;
+        }
+        else {
+            network_error();
+            printf("Error: select returns %d\n", ret);
+        }
+    }
+    else {
+#ifdef __linux__
+        if (tfd >= 0 && FD_ISSET(tfd, &readfds)) {
+            uint64_t expirations;
+
+            OCTOPING_COUNT_SYSCALL();
+            (void)read(tfd, &expirations, sizeof(expirations));
+        }
+#endif
+        ret = FD_ISSET(s, &readfds) ? 1 : 0;
+    }
+    return ret;
+}
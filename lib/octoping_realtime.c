@@ -0,0 +1,200 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Real time mode, requested with the option [-r].
+ */
+
+#ifdef __linux__
+/* CPUs on which the process could run before it was pinned */
+static cpu_set_t octoping_realtime_cpus;
+static int octoping_realtime_has_cpus = 0;
+#endif
+
+/*
+ * Measure the wake up jitter, i.e., how late the process wakes up after
+ * sleeping until a deadline, and print the distribution.
+ */
+int octoping_realtime_check(FILE* F, char const* label)
+{
+    int ret = 0;
+#ifdef __linux__
+    octoping_histogram_t* histogram = (octoping_histogram_t*)calloc(1, sizeof(octoping_histogram_t));
+
+    if (histogram == NULL) {
+        ret = -1;
+    }
+    else {
+        uint64_t deadline = current_time_ns();
+
+        for (int i = 0; i < OCTOPING_RT_CHECK_COUNT; i++) {
+            struct timespec ts;
+            uint64_t t;
+
+            deadline += OCTOPING_RT_CHECK_INTERVAL;
+            ts.tv_sec = (time_t)(deadline / 1000000000ull);
+            ts.tv_nsec = (long)(deadline % 1000000000ull);
+            (void)clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL);
+            t = current_time_ns();
+            octoping_histogram_add(histogram, (t > deadline) ? t - deadline : 0);
+            if (t > deadline + OCTOPING_RT_CHECK_INTERVAL) {
+                deadline = t;
+            }
+        }
+        fprintf(F, "Wake up jitter %s: min %.3f, p50 %.3f, p99 %.3f, max %.3f us\n", label,
+            ((double)histogram->min) / 1000.0,
+            ((double)octoping_histogram_percentile(histogram, 0.5)) / 1000.0,
+            ((double)octoping_histogram_percentile(histogram, 0.99)) / 1000.0,
+            ((double)histogram->max) / 1000.0);
+        free(histogram);
+    }
+#else
+    (void)F;
+    (void)label;
+#endif
+    return ret;
+}
+
+/*
+ * Pin the calling thread to the specified CPU.
+ */
+int octoping_realtime_pin(int cpu)
+{
+    int ret = 0;
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    ret = (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0) ? 0 : -1;
+#else
+    (void)cpu;
+    ret = -1;
+#endif
+    return ret;
+}
+
+/*
+ * Let the calling thread, e.g., the output writer, run on the CPUs of the
+ * process before the real time setup, except the CPU to which its creator
+ * was pinned, if any, where the probe loop spins with a real time policy.
+ */
+int octoping_realtime_unpin(void)
+{
+    int ret = 0;
+#ifdef __linux__
+    if (octoping_realtime_has_cpus) {
+        cpu_set_t cpu_set;
+        cpu_set_t inherited;
+
+        memcpy(&cpu_set, &octoping_realtime_cpus, sizeof(cpu_set));
+        if (pthread_getaffinity_np(pthread_self(), sizeof(inherited), &inherited) == 0 && CPU_COUNT(&inherited) == 1 &&
+            CPU_COUNT(&cpu_set) > 1) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &inherited)) {
+                    CPU_CLR(cpu, &cpu_set);
+                    break;
+                }
+            }
+        }
+        if (CPU_COUNT(&cpu_set) > 0) {
+            ret = (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0) ? 0 : -1;
+        }
+    }
+#endif
+    return ret;
+}
+
+/*
+ * Ask the kernel to busy poll the device queue for a while when the
+ * socket has no data, instead of waiting for the interrupt.
+ */
+void octoping_realtime_socket(SOCKET_TYPE s)
+{
+#ifdef SO_BUSY_POLL
+    int busy_poll = OCTOPING_RT_BUSY_POLL_US;
+
+    if (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, (char*)&busy_poll, sizeof(busy_poll)) != 0) {
+        printf("Cannot set SO_BUSY_POLL, error %d\n", errno);
+    }
+#else
+    (void)s;
+#endif
+}
+
+/*
+ * Apply the process wide settings: lock the memory to avoid page faults,
+ * and use a real time scheduling policy. The settings require privileges,
+ * e.g., CAP_SYS_NICE and CAP_IPC_LOCK on Linux. Failures are reported
+ * but not fatal. Threads created later inherit the scheduling policy.
+ */
+int octoping_realtime_setup(octoping_options_t* options)
+{
+    int ret = 0;
+    /* The analyzer, the export and the feed follower keep all the CPUs */
+    int is_offline = options->analyze_file != NULL || options->export_file != NULL || options->follow_name != NULL;
+
+    (void)octoping_realtime_check(stdout, "before real time setup");
+#ifdef _WINDOWS
+    if (!SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS)) {
+        printf("Cannot set the real time priority class, error %d\n", GetLastError());
+    }
+#else
+#ifdef __linux__
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        printf("Cannot lock the process memory, error %d\n", errno);
+    }
+#endif
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = OCTOPING_RT_PRIORITY;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            printf("Cannot set the SCHED_FIFO policy\n");
+        }
+    }
+#endif
+#ifdef __linux__
+    if (sched_getaffinity(0, sizeof(octoping_realtime_cpus), &octoping_realtime_cpus) == 0) {
+        octoping_realtime_has_cpus = 1;
+    }
+    if (!is_offline && !options->is_server &&
+        !(options->nb_threads > 1 && (options->target_file != NULL || options->nb_flows > 0))) {
+        int cpu = (options->first_cpu >= 0) ? options->first_cpu : sched_getcpu();
+
+        if (cpu >= 0 && octoping_realtime_pin(cpu) != 0) {
+            printf("Cannot pin the client to CPU %d\n", cpu);
+        }
+    }
+    else if (!is_offline && options->first_cpu < 0) {
+        /* Server workers and sender threads are pinned from CPU 0 */
+        options->first_cpu = 0;
+    }
+#endif
+    if (options->spin_ns == 0 && !is_offline) {
+        options->spin_ns = OCTOPING_RT_SPIN_NS;
+    }
+    (void)octoping_realtime_check(stdout, "after real time setup");
+    return ret;
+}
@@ -0,0 +1,88 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Single producer, single consumer ring. The producer only writes the
+ * head, the consumer only writes the tail, and each side publishes its
+ * index with release semantics after copying the entry, so no lock is
+ * needed. Each side keeps a copy of the other side's index, and only
+ * reloads it when the ring looks full or empty.
+ */
+
+int octoping_ring_init(octoping_ring_t* ring, size_t entry_size, uint64_t capacity)
+{
+    int ret = 0;
+
+    memset(ring, 0, sizeof(octoping_ring_t));
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        ret = -1;
+    }
+    else if ((ring->entries = (uint8_t*)malloc((size_t)capacity * entry_size)) == NULL) {
+        ret = -1;
+    }
+    else {
+        ring->entry_size = entry_size;
+        ring->mask = capacity - 1;
+    }
+    return ret;
+}
+
+void octoping_ring_release(octoping_ring_t* ring)
+{
+    free(ring->entries);
+    ring->entries = NULL;
+}
+
+/* Called by the producer. Returns -1 if the ring is full. */
+int octoping_ring_push(octoping_ring_t* ring, void const* entry)
+{
+    uint64_t head = ring->head;
+
+    if (head - ring->producer_tail > ring->mask) {
+        ring->producer_tail = OCTOPING_LOAD_ACQUIRE(&ring->tail);
+        if (head - ring->producer_tail > ring->mask) {
+            ring->nb_overflow++;
+            return -1;
+        }
+    }
+    memcpy(ring->entries + (size_t)(head & ring->mask) * ring->entry_size, entry, ring->entry_size);
+    OCTOPING_STORE_RELEASE(&ring->head, head + 1);
+    return 0;
+}
+
+/* Called by the consumer. Returns -1 if the ring is empty. */
+int octoping_ring_pop(octoping_ring_t* ring, void* entry)
+{
+    uint64_t tail = ring->tail;
+
+    if (tail == ring->consumer_head) {
+        ring->consumer_head = OCTOPING_LOAD_ACQUIRE(&ring->head);
+        if (tail == ring->consumer_head) {
+            return -1;
+        }
+    }
+    memcpy(entry, ring->entries + (size_t)(tail & ring->mask) * ring->entry_size, ring->entry_size);
+    OCTOPING_STORE_RELEASE(&ring->tail, tail + 1);
+    return 0;
+}
@@ -0,0 +1,501 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "octoping.h"
+
+/*
+ * Per target probe session.
+ *
+ * The client keeps all times in nanoseconds. The sent time written in
+ * the probes is opaque to the server, which echoes it unchanged. The
+ * server time is in microseconds, unless the echo carries the
+ * OCTOPING_NS_MAGIC marker.
+ *
+ * In timestamp mode, the "sent" and "echo" times are read by the client
+ * process before sending and after receiving, and the "wire" times are
+ * the kernel transmit and receive timestamps. The rtt is the difference
+ * between echo and sent times, as in the default mode. The wire_rtt
+ * is the difference between the wire times, and the stack_t is the
+ * difference between the two, i.e., the time spent in the network
+ * stacks and in scheduling delays on the client. The phase and the
+ * one way delays are computed from the wire times.
+ *
+ * The phase of each echo is the estimate of the clock offset at the
+ * middle of the wire times, see octoping_clock_add. With the wire
+ * format version 2, the echo also carries the server transmit time, and
+ * the dwell time in the server is removed from the down samples.
+ */
+
+int octoping_session_init(octoping_session_t* session, SOCKET_TYPE s, struct sockaddr_in const* addr_to,
+    char const* label, uint32_t target_index, int timestamps, uint64_t start_time)
+{
+    memset(session, 0, sizeof(octoping_session_t));
+    session->s = s;
+    session->target_index = target_index;
+    session->last_rtt = -1;
+    session->addr_to = *addr_to;
+    if (label != NULL) {
+        size_t len = strlen(label);
+        if (len >= OCTOPING_LABEL_MAX) {
+            len = OCTOPING_LABEL_MAX - 1;
+        }
+        memcpy(session->label, label, len);
+    }
+    session->timestamps = timestamps;
+    session->start_time = start_time;
+    session->phase = INT64_MAX;
+    octoping_clock_init(&session->clock);
+    session->train_length = 1;
+    session->timer.app_ctx = session;
+    return octoping_tracker_init(&session->tracker);
+}
+
+/*
+ * Set the probe sizes, used in turn for each train of train_length
+ * probes. Capacity estimates are computed if train_length is 2 or more.
+ */
+void octoping_session_set_probes(octoping_session_t* session, uint16_t const* sizes, int nb_sizes, int train_length)
+{
+    session->sizes = sizes;
+    session->nb_sizes = (sizes != NULL) ? nb_sizes : 0;
+    session->train_length = (train_length > 1) ? train_length : 1;
+}
+
+int octoping_session_probe_length(octoping_session_t const* session, uint64_t seqnum)
+{
+    int min_length = (session->wire_v2) ? OCTOPING_V2_HEADER : ((session->timestamps) ? 32 : 16);
+    int length = min_length;
+
+    if (session->nb_sizes > 0) {
+        length = session->sizes[(seqnum / (uint64_t)session->train_length) % (uint64_t)session->nb_sizes];
+        if (length < min_length) {
+            length = min_length;
+        }
+        else if (length > OCTOPING_PACKET_MAX) {
+            length = OCTOPING_PACKET_MAX;
+        }
+    }
+    return length;
+}
+
+void octoping_session_release(octoping_session_t* session)
+{
+    octoping_tracker_release(&session->tracker);
+}
+
+static int octoping_session_report_lost(octoping_session_t* session, octoping_output_t* output, uint64_t missing, uint64_t sent_at)
+{
+    octoping_result_t result;
+
+    memset(&result, 0, sizeof(result));
+    result.seqnum = missing;
+    result.sent = sent_at - session->start_time;
+    result.flags = OCTOPING_RESULT_LOST;
+    result.target_index = session->target_index;
+    result.length = (uint32_t)octoping_session_probe_length(session, missing);
+    return octoping_output_result(output, session, &result);
+}
+
+#ifdef OCTOPING_HAS_TIMESTAMPING
+/*
+ * Read the transmit timestamps queued on the error queue, and store
+ * them in the tracker. The timestamp key is the count of packets sent
+ * before, which is also the sequence number of the packet, modulo 2^32.
+ */
+void octoping_session_tx_timestamps(octoping_session_t* session)
+{
+    uint64_t next_seq = session->tracker.next_seq;
+
+    for (;;) {
+        struct msghdr msg = { 0 };
+        uint8_t control[OCTOPING_CONTROL_MAX];
+        uint64_t tx_ns;
+        octoping_probe_t* probe = NULL;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        OCTOPING_COUNT_SYSCALL();
+        if (recvmsg(session->s, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        tx_ns = octoping_get_timestamp(&msg);
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    probe = octoping_tracker_find(&session->tracker, next_seq - (uint32_t)((uint32_t)next_seq - err.ee_data));
+                }
+            }
+        }
+        if (tx_ns != 0 && probe != NULL) {
+            probe->tx_at = tx_ns;
+        }
+    }
+}
+#endif
+
+/*
+ * Retire the probes older than the loss timeout, and report as lost
+ * those that were not echoed.
+ */
+static int octoping_session_retire(octoping_session_t* session, uint64_t sent_before, octoping_output_t* output)
+{
+    int ret = 0;
+    uint64_t missing;
+    uint64_t sent_at;
+
+    while (octoping_tracker_next_lost(&session->tracker, sent_before, &missing, &sent_at)) {
+        if (ret == 0 && octoping_session_report_lost(session, output, missing, sent_at) != 0) {
+            printf("Cannot report missing packet #%" PRIu64 "\n", missing);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Prepare the next probe in buffer, after retiring the probes sent more
+ * than OCTOPING_LOSS_TIMEOUT before, and track it. Returns the length of
+ * the probe, or -1 in case of error.
+ */
+int octoping_session_prepare(octoping_session_t* session, uint64_t t, uint8_t* buffer, octoping_output_t* output)
+{
+    uint64_t seqnum = session->tracker.next_seq;
+    int probe_length = octoping_session_probe_length(session, seqnum);
+    int header_length = 16;
+
+    marshall_64(buffer, seqnum);
+    marshall_64(buffer + 8, t);
+    if (session->wire_v2) {
+        marshall_64(buffer + 16, 0);
+        marshall_64(buffer + 24, OCTOPING_V2_MAGIC);
+        memset(buffer + 32, 0, 16);
+        buffer[32] = 2;
+        header_length = OCTOPING_V2_HEADER;
+    }
+    else if (session->timestamps) {
+        marshall_64(buffer + 16, 0);
+        marshall_64(buffer + 24, OCTOPING_NS_MAGIC);
+        header_length = 32;
+    }
+    if (probe_length > header_length) {
+        memset(buffer + header_length, 0, (size_t)(probe_length - header_length));
+    }
+    (void)octoping_session_retire(session, (t > OCTOPING_LOSS_TIMEOUT) ? t - OCTOPING_LOSS_TIMEOUT : 0, output);
+    if (octoping_tracker_insert(&session->tracker, t) != 0) {
+        printf("Cannot track packet #%" PRIu64 "\n", seqnum);
+        probe_length = -1;
+    }
+    return probe_length;
+}
+
+/*
+ * Send a prepared probe on the session socket.
+ */
+int octoping_session_transmit(octoping_session_t* session, uint8_t const* buffer, int length)
+{
+    int ret = 0;
+    int l;
+
+    OCTOPING_COUNT_SYSCALL();
+    l = sendto(session->s, (char const*)buffer, length, 0, (struct sockaddr*)&session->addr_to, sizeof(session->addr_to));
+    if (l <= 0) {
+        network_error();
+        printf("Sendto returns %d\n", l);
+        ret = -1;
+    }
+#ifdef OCTOPING_HAS_TIMESTAMPING
+    else if (session->timestamps) {
+        /* Software transmit timestamps are usually queued before sendto returns. */
+        octoping_session_tx_timestamps(session);
+    }
+#endif
+    return ret;
+}
+
+/*
+ * Send the next probe.
+ */
+int octoping_session_send(octoping_session_t* session, uint64_t t, octoping_output_t* output)
+{
+    int ret = 0;
+    uint8_t buffer[OCTOPING_PACKET_MAX];
+    int probe_length = octoping_session_prepare(session, t, buffer, output);
+
+    if (probe_length < 0) {
+        ret = -1;
+    }
+    else {
+        ret = octoping_session_transmit(session, buffer, probe_length);
+    }
+    return ret;
+}
+
+/*
+ * Capacity estimates. Each train gives one estimate, computed from the
+ * echoes of the first and last probes of the train that were received,
+ * once an echo of a later train arrives or at the end of the session.
+ * The server receive times give the capacity of the path to the server,
+ * and the echo receive times the round trip capacity. Echoes received
+ * out of order or with identical times give no estimate.
+ */
+static void octoping_session_train_end(octoping_session_t* session, octoping_output_t* output)
+{
+    octoping_train_t* train = &session->train;
+
+    if (train->nb_received >= 2 && train->last_pos > train->first_pos) {
+        double bits = 8.0 * (double)(train->last_pos - train->first_pos) * (double)train->length;
+        uint64_t up_bps = 0;
+        uint64_t rt_bps = 0;
+
+        if (train->last_server > train->first_server) {
+            up_bps = (uint64_t)(bits * 1000000000.0 / (double)(train->last_server - train->first_server));
+        }
+        if (train->last_rx > train->first_rx) {
+            rt_bps = (uint64_t)(bits * 1000000000.0 / (double)(train->last_rx - train->first_rx));
+        }
+        octoping_stats_add_train(output->window, up_bps, rt_bps);
+    }
+    train->nb_received = 0;
+}
+
+static void octoping_session_train_add(octoping_session_t* session, uint64_t seqnum, uint64_t server_at, uint64_t rx_at,
+    octoping_output_t* output)
+{
+    octoping_train_t* train = &session->train;
+    uint64_t index = seqnum / (uint64_t)session->train_length;
+    int pos = (int)(seqnum % (uint64_t)session->train_length);
+
+    if (index < train->index) {
+        /* Late echo of a previous train */
+        return;
+    }
+    if (index > train->index) {
+        octoping_session_train_end(session, output);
+        train->index = index;
+    }
+    if (train->nb_received == 0) {
+        train->length = octoping_session_probe_length(session, seqnum);
+        train->first_pos = pos;
+        train->last_pos = pos;
+        train->first_server = server_at;
+        train->last_server = server_at;
+        train->first_rx = rx_at;
+        train->last_rx = rx_at;
+    }
+    else if (pos < train->first_pos) {
+        train->first_pos = pos;
+        train->first_server = server_at;
+        train->first_rx = rx_at;
+    }
+    else if (pos > train->last_pos) {
+        train->last_pos = pos;
+        train->last_server = server_at;
+        train->last_rx = rx_at;
+    }
+    train->nb_received++;
+}
+
+/*
+ * Process an echo: compute the rtt, update the phase estimate, and
+ * write the result line.
+ */
+static int octoping_session_process_echo(octoping_session_t* session, uint8_t* buffer, int l,
+    uint64_t rx_at, uint64_t echo_at, octoping_output_t* output)
+{
+    uint64_t r_seqnum;
+    octoping_reply_class_t reply_class;
+    octoping_probe_t probe = { 0 };
+    octoping_result_t result;
+    uint64_t sent_at;
+    uint64_t recv_at;
+    uint64_t tx_at;
+    uint64_t dwell = 0;
+    int has_dwell = 0;
+
+    r_seqnum = parse_64(buffer);
+    sent_at = parse_64(buffer + 8);
+    recv_at = parse_64(buffer + 16);
+    if (l >= OCTOPING_V2_HEADER && parse_64(buffer + 24) == OCTOPING_V2_MAGIC && (buffer[33] & OCTOPING_V2_RX) != 0) {
+        if ((buffer[33] & OCTOPING_V2_TX) != 0) {
+            uint64_t server_tx = parse_64(buffer + 40);
+
+            if (server_tx >= recv_at) {
+                dwell = server_tx - recv_at;
+                has_dwell = 1;
+            }
+        }
+    }
+    else if (l < 32 || parse_64(buffer + 24) != OCTOPING_NS_MAGIC) {
+        recv_at *= 1000;
+    }
+    reply_class = octoping_tracker_ack(&session->tracker, r_seqnum, &probe);
+    if (reply_class == octoping_reply_invalid) {
+        printf("Received number %" PRIu64 " while next number to send is %" PRIu64 "\n",
+            r_seqnum, session->tracker.next_seq);
+        return -1;
+    }
+    else if (reply_class == octoping_reply_duplicate) {
+        return 0;
+    }
+
+    memset(&result, 0, sizeof(result));
+    result.seqnum = r_seqnum;
+    result.target_index = session->target_index;
+    result.length = (uint32_t)octoping_session_probe_length(session, r_seqnum);
+    if (reply_class == octoping_reply_reordered) {
+        result.flags |= OCTOPING_RESULT_REORDERED;
+    }
+    else if (reply_class == octoping_reply_late) {
+        result.flags |= OCTOPING_RESULT_LATE;
+    }
+    tx_at = (probe.tx_at != 0) ? probe.tx_at : sent_at;
+    if (rx_at == 0 || rx_at < tx_at) {
+        rx_at = echo_at;
+        tx_at = sent_at;
+    }
+    else {
+        result.flags |= OCTOPING_RESULT_KERNEL_TS;
+    }
+    if (has_dwell) {
+        result.flags |= OCTOPING_RESULT_DWELL;
+        result.dwell = (int64_t)dwell;
+    }
+
+    if (sent_at < echo_at && rx_at - tx_at > dwell) {
+        octoping_clock_add(&session->clock, (int64_t)tx_at, (int64_t)recv_at, (int64_t)(recv_at + dwell), (int64_t)rx_at);
+        session->phase = octoping_clock_phase(&session->clock, (int64_t)(tx_at + (rx_at - tx_at) / 2));
+    }
+    result.sent = sent_at - session->start_time;
+    result.wire_sent = tx_at - session->start_time;
+    result.received = recv_at - session->start_time;
+    result.wire_echo = rx_at - session->start_time;
+    result.echo = echo_at - session->start_time;
+    result.phase = session->phase;
+    result.drift = (int64_t)(octoping_clock_drift(&session->clock) * 1000000000.0);
+    octoping_result_derive(&result);
+    if (session->train_length > 1) {
+        octoping_session_train_add(session, r_seqnum, recv_at, rx_at, output);
+    }
+
+    return octoping_output_result(output, session, &result);
+}
+
+/*
+ * Process a packet received on the session socket at echo_at, with the
+ * kernel receive timestamp rx_at if available, 0 otherwise.
+ */
+int octoping_session_process(octoping_session_t* session, uint8_t* buffer, int l, uint64_t rx_at, uint64_t echo_at,
+    octoping_output_t* output)
+{
+    int ret = 0;
+
+    if (l >= 24) {
+        ret = octoping_session_process_echo(session, buffer, l, rx_at, echo_at, output);
+    }
+    return ret;
+}
+
+/*
+ * Receive one packet on the session socket. Returns 1 and the length of
+ * the packet if a packet was received, 0 if no packet was available, -1
+ * in case of error.
+ */
+int octoping_session_recv(octoping_session_t* session, uint8_t* buffer, size_t buffer_size, int flags,
+    int* length, uint64_t* rx_at)
+{
+    int ret = 0;
+    struct sockaddr_in addr_from;
+    int l;
+
+    *rx_at = 0;
+
+#ifdef OCTOPING_HAS_TIMESTAMPING
+    if (session->timestamps) {
+        /* The socket is also reported as readable when the error queue is not empty */
+        octoping_session_tx_timestamps(session);
+        l = octoping_recv_timestamped(session->s, buffer, buffer_size, flags, &addr_from, rx_at);
+    }
+    else
+#endif
+    {
+        SOCKLEN_T from_len = (SOCKLEN_T)sizeof(addr_from);
+        OCTOPING_COUNT_SYSCALL();
+        l = recvfrom(session->s, (char*)buffer, (int)buffer_size, flags, (struct sockaddr*)&addr_from, &from_len);
+    }
+
+    if (l < 0) {
+        if (octoping_is_timeout_error()) {
+            ret = 0;
+        }
+        else {
+            network_error();
+            printf("Error: recvfrom returns %d\n", l);
+            ret = -1;
+        }
+    }
+    else {
+        *length = l;
+        ret = 1;
+    }
+    return ret;
+}
+
+/*
+ * Receive and process one echo. Returns 1 if a packet was received,
+ * 0 if no packet was available, -1 in case of error.
+ */
+int octoping_session_receive(octoping_session_t* session, int flags, octoping_output_t* output)
+{
+    uint8_t buffer[OCTOPING_PACKET_MAX];
+    uint64_t rx_at = 0;
+    int l = 0;
+    int ret = octoping_session_recv(session, buffer, sizeof(buffer), flags, &l, &rx_at);
+
+    if (ret > 0 && octoping_session_process(session, buffer, l, rx_at, current_time_ns(), output) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Notice whatever is not yet echoed */
+int octoping_session_report_missing(octoping_session_t* session, octoping_output_t* output)
+{
+    if (session->train_length > 1) {
+        octoping_session_train_end(session, output);
+    }
+    return octoping_session_retire(session, UINT64_MAX, output);
+}
+
+void octoping_session_print_counts(FILE* F, char const* label, octoping_tracker_t const* tracker)
+{
+    fprintf(F, "%s: %" PRIu64 " sent, %" PRIu64 " on time, %" PRIu64 " reordered, %" PRIu64 " duplicate, %" PRIu64 " late, %" PRIu64 " lost\n",
+        label, tracker->nb_sent, tracker->nb_on_time, tracker->nb_reordered, tracker->nb_duplicate, tracker->nb_late, tracker->nb_lost);
+}
+
+void octoping_session_print_clock(FILE* F, char const* label, octoping_session_t const* session)
+{
+    if (session->phase != INT64_MAX) {
+        fprintf(F, "%s: phase %.3f us, drift %.3f ppm\n", label, ((double)session->phase) / 1000.0,
+            octoping_clock_drift(&session->clock) * 1000000.0);
+    }
+}
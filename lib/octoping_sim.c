@@ -0,0 +1,572 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+#include <math.h>
+
+/*
+ * Simulated network and reflector, in virtual time. When the client
+ * sends a probe, the simulator draws its fate at once: the delay and
+ * loss on the way up, the echo by the reflector code of the server, with
+ * the admission control and the stamp of the server, then the delay,
+ * loss, reordering and duplication on the way down. The echoes wait in
+ * a heap ordered by arrival time, and the virtual clock jumps to the
+ * next arrival or wake time when the client waits. The simulator also
+ * counts what the client should see, to check its results.
+ */
+
+typedef struct st_octoping_sim_packet_t {
+    uint64_t arrival;
+    uint64_t order;
+    uint64_t at_server;
+    int length;
+    int is_copy;
+    uint8_t header[OCTOPING_V2_HEADER];
+} octoping_sim_packet_t;
+
+typedef struct st_octoping_sim_t {
+    octoping_sim_model_t model;
+    uint64_t now;
+    uint64_t random;
+    octoping_sim_packet_t* queue;
+    size_t nb_queued;
+    uint64_t nb_pushed;
+    octoping_server_worker_t reflector;
+    struct sockaddr_in addr_from;
+    uint64_t nb_sent;
+    uint64_t nb_lost;
+    uint64_t nb_limited;
+    uint64_t nb_overflow;
+    uint64_t nb_delivered;
+    uint64_t nb_duplicates;
+    uint64_t nb_reordered;
+    uint64_t highest_delivered;
+    uint64_t min_rtt;
+    uint64_t last_middle;
+} octoping_sim_t;
+
+static int octoping_sim_parse_time(char const* value, int64_t* ns)
+{
+    int ret = 0;
+    int is_negative = (*value == '-');
+    char* end = NULL;
+    uint64_t x = 0;
+
+    if (is_negative) {
+        value++;
+    }
+    if (strtod(value, &end) == 0.0 && end != value) {
+        /* Zero, with or without unit */
+    }
+    else {
+        ret = octoping_parse_interval(value, &x);
+    }
+    *ns = (is_negative) ? -(int64_t)x : (int64_t)x;
+    return ret;
+}
+
+static int octoping_sim_parse_probability(char const* value, double* p)
+{
+    char* end = NULL;
+
+    *p = strtod(value, &end);
+    if (end != value && *end == '%' && end[1] == 0) {
+        *p /= 100.0;
+    }
+    else if (end == value || *end != 0) {
+        return -1;
+    }
+    return (*p >= 0.0 && *p <= 1.0) ? 0 : -1;
+}
+
+int octoping_sim_parse(char const* spec, octoping_sim_model_t* model)
+{
+    int ret = 0;
+    char const* x = spec;
+
+    memset(model, 0, sizeof(octoping_sim_model_t));
+    model->reorder_ns = 1000000;
+    model->seed = 1;
+
+    while (ret == 0 && *x != 0) {
+        char item[128];
+        char* value;
+        char const* comma = strchr(x, ',');
+        size_t l = (comma == NULL) ? strlen(x) : (size_t)(comma - x);
+        int64_t ns = 0;
+
+        if (l >= sizeof(item)) {
+            ret = -1;
+            break;
+        }
+        memcpy(item, x, l);
+        item[l] = 0;
+        x += (comma == NULL) ? l : l + 1;
+        if ((value = strchr(item, '=')) == NULL) {
+            ret = -1;
+            break;
+        }
+        *value++ = 0;
+
+        if (strcmp(item, "delay") == 0 || strcmp(item, "up") == 0 || strcmp(item, "down") == 0 ||
+            strcmp(item, "jitter") == 0 || strcmp(item, "reorder_delay") == 0 || strcmp(item, "dwell") == 0) {
+            if (octoping_sim_parse_time(value, &ns) != 0 || ns < 0) {
+                ret = -1;
+            }
+            else if (strcmp(item, "jitter") == 0) {
+                model->jitter_ns = (uint64_t)ns;
+            }
+            else if (strcmp(item, "reorder_delay") == 0) {
+                model->reorder_ns = (uint64_t)ns;
+            }
+            else if (strcmp(item, "dwell") == 0) {
+                model->dwell_ns = (uint64_t)ns;
+            }
+            else {
+                if (strcmp(item, "down") != 0) {
+                    model->up_ns = (uint64_t)ns;
+                }
+                if (strcmp(item, "up") != 0) {
+                    model->down_ns = (uint64_t)ns;
+                }
+            }
+        }
+        else if (strcmp(item, "offset") == 0) {
+            ret = octoping_sim_parse_time(value, &model->offset_ns);
+        }
+        else if (strcmp(item, "dist") == 0) {
+            if (strcmp(value, "exp") == 0) {
+                model->distribution = octoping_sim_exp;
+            }
+            else if (strcmp(value, "uniform") == 0) {
+                model->distribution = octoping_sim_uniform;
+            }
+            else {
+                ret = -1;
+            }
+        }
+        else if (strcmp(item, "loss") == 0) {
+            ret = octoping_sim_parse_probability(value, &model->loss);
+        }
+        else if (strcmp(item, "reorder") == 0) {
+            ret = octoping_sim_parse_probability(value, &model->reorder);
+        }
+        else if (strcmp(item, "dup") == 0) {
+            ret = octoping_sim_parse_probability(value, &model->duplicate);
+        }
+        else if (strcmp(item, "drift") == 0) {
+            char* end = NULL;
+            model->drift_ppm = strtod(value, &end);
+            if (end == value || (*end != 0 && strcmp(end, "ppm") != 0)) {
+                ret = -1;
+            }
+        }
+        else if (strcmp(item, "seed") == 0) {
+            model->seed = (uint64_t)strtoull(value, NULL, 10);
+        }
+        else {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/* Uniform random number in [0, 1), from a xorshift64* generator */
+static double octoping_sim_random(octoping_sim_t* sim)
+{
+    sim->random ^= sim->random >> 12;
+    sim->random ^= sim->random << 25;
+    sim->random ^= sim->random >> 27;
+    return (double)((sim->random * 0x2545F4914F6CDD1Dull) >> 11) / 9007199254740992.0;
+}
+
+static uint64_t octoping_sim_jitter(octoping_sim_t* sim)
+{
+    double u = octoping_sim_random(sim);
+
+    if (sim->model.distribution == octoping_sim_uniform) {
+        return (uint64_t)(2.0 * u * (double)sim->model.jitter_ns);
+    }
+    return (uint64_t)(-log(1.0 - u) * (double)sim->model.jitter_ns);
+}
+
+/* Clock of the reflector, with its offset and drift from the virtual time */
+static uint64_t octoping_sim_server_clock(octoping_sim_t const* sim, uint64_t t)
+{
+    return t + sim->model.offset_ns + (int64_t)(sim->model.drift_ppm * 1.0e-6 * (double)(t - OCTOPING_SIM_EPOCH));
+}
+
+static int octoping_sim_before(octoping_sim_packet_t const* a, octoping_sim_packet_t const* b)
+{
+    return a->arrival < b->arrival || (a->arrival == b->arrival && a->order < b->order);
+}
+
+static void octoping_sim_push(octoping_sim_t* sim, octoping_sim_packet_t* packet)
+{
+    size_t i = sim->nb_queued;
+
+    if (sim->nb_queued >= OCTOPING_SIM_QUEUE) {
+        if (!packet->is_copy) {
+            sim->nb_overflow++;
+        }
+        return;
+    }
+    packet->order = sim->nb_pushed++;
+    sim->nb_queued++;
+    while (i > 0 && octoping_sim_before(packet, &sim->queue[(i - 1) / 2])) {
+        sim->queue[i] = sim->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim->queue[i] = *packet;
+}
+
+static void octoping_sim_pop(octoping_sim_t* sim, octoping_sim_packet_t* packet)
+{
+    size_t i = 0;
+    octoping_sim_packet_t* last = &sim->queue[--sim->nb_queued];
+
+    *packet = sim->queue[0];
+    while (2 * i + 1 < sim->nb_queued) {
+        size_t child = 2 * i + 1;
+
+        if (child + 1 < sim->nb_queued && octoping_sim_before(&sim->queue[child + 1], &sim->queue[child])) {
+            child++;
+        }
+        if (!octoping_sim_before(&sim->queue[child], last)) {
+            break;
+        }
+        sim->queue[i] = sim->queue[child];
+        i = child;
+    }
+    sim->queue[i] = *last;
+}
+
+static uint64_t octoping_sim_now(void* io_ctx)
+{
+    return ((octoping_sim_t*)io_ctx)->now;
+}
+
+static int octoping_sim_wait(void* io_ctx, uint64_t current_time, uint64_t wake_time)
+{
+    octoping_sim_t* sim = (octoping_sim_t*)io_ctx;
+
+    (void)current_time;
+    if (sim->nb_queued > 0 && sim->queue[0].arrival <= wake_time) {
+        if (sim->queue[0].arrival > sim->now) {
+            sim->now = sim->queue[0].arrival;
+        }
+        return 1;
+    }
+    if (wake_time > sim->now) {
+        sim->now = wake_time;
+    }
+    return 0;
+}
+
+static int octoping_sim_send(void* io_ctx, octoping_session_t* session, uint8_t const* buffer, int length)
+{
+    octoping_sim_t* sim = (octoping_sim_t*)io_ctx;
+    octoping_sim_packet_t packet;
+
+    (void)session;
+    memset(&packet, 0, sizeof(packet));
+    memcpy(packet.header, buffer, (length < OCTOPING_V2_HEADER) ? (size_t)length : OCTOPING_V2_HEADER);
+    packet.at_server = sim->now + sim->model.up_ns + octoping_sim_jitter(sim);
+    sim->nb_sent++;
+
+    if (octoping_sim_random(sim) < sim->model.loss) {
+        sim->nb_lost++;
+        return 0;
+    }
+    octoping_server_count_rx(&sim->reflector, &sim->addr_from, length);
+    if (length < 16 || !octoping_server_admit(&sim->reflector, &sim->addr_from, packet.at_server)) {
+        sim->nb_limited++;
+        return 0;
+    }
+    (void)octoping_server_stamp(packet.header, length, octoping_sim_server_clock(sim, packet.at_server));
+    octoping_server_stamp_tx(packet.header, length,
+        octoping_sim_server_clock(sim, packet.at_server + sim->model.dwell_ns));
+    packet.length = (length > 24) ? length : 24;
+
+    if (octoping_sim_random(sim) < sim->model.loss) {
+        sim->nb_lost++;
+        return 0;
+    }
+    packet.arrival = packet.at_server + sim->model.dwell_ns + sim->model.down_ns + octoping_sim_jitter(sim);
+    if (octoping_sim_random(sim) < sim->model.reorder) {
+        packet.arrival += sim->model.reorder_ns;
+    }
+    octoping_sim_push(sim, &packet);
+    if (octoping_sim_random(sim) < sim->model.duplicate) {
+        /* The copy always arrives after the original */
+        packet.arrival += 1 + octoping_sim_jitter(sim);
+        packet.is_copy = 1;
+        octoping_sim_push(sim, &packet);
+    }
+    return 0;
+}
+
+static int octoping_sim_recv(void* io_ctx, octoping_session_t* session, uint8_t* buffer, size_t buffer_size,
+    int* length, uint64_t* rx_at)
+{
+    octoping_sim_t* sim = (octoping_sim_t*)io_ctx;
+    octoping_sim_packet_t packet;
+
+    if (sim->nb_queued == 0 || sim->queue[0].arrival > sim->now) {
+        return 0;
+    }
+    octoping_sim_pop(sim, &packet);
+    memcpy(buffer, packet.header, (buffer_size < OCTOPING_V2_HEADER) ? buffer_size : OCTOPING_V2_HEADER);
+    *length = packet.length;
+    *rx_at = 0;
+
+    if (packet.is_copy) {
+        sim->nb_duplicates++;
+    }
+    else {
+        uint64_t seqnum = parse_64(packet.header);
+        uint64_t sent = parse_64(packet.header + 8);
+        uint64_t rtt = packet.arrival - sent;
+
+        (void)session;
+        if (sim->nb_delivered > 0 && seqnum < sim->highest_delivered) {
+            sim->nb_reordered++;
+        }
+        else {
+            sim->highest_delivered = seqnum;
+        }
+        sim->nb_delivered++;
+        if (sim->min_rtt == 0 || rtt < sim->min_rtt) {
+            sim->min_rtt = rtt;
+        }
+        /* Same instant as the phase estimate of the session */
+        sim->last_middle = sent + (sim->now - sent) / 2;
+    }
+    return 1;
+}
+
+static int octoping_sim_check_count(char const* name, uint64_t measured, uint64_t expected)
+{
+    int ret = (measured == expected) ? 0 : -1;
+
+    printf("Check %s: %" PRIu64 ", expected %" PRIu64 ", %s\n", name, measured, expected, (ret == 0) ? "OK" : "FAILED");
+    return ret;
+}
+
+/*
+ * Check the counts of the client against those of the network, the
+ * minimum rtt, which the client measures exactly in virtual time, and
+ * the phase and drift estimates. The estimates come from the minimum
+ * delays of each bucket, which exceed the true delays by about the
+ * jitter divided by the number of probes per bucket, so the tolerance is
+ * a multiple of that, plus the resolution of the stamps. The drift is
+ * only checked if the run lasts at least 10 buckets.
+ */
+static int octoping_sim_check(octoping_sim_t const* sim, octoping_session_t const* session, uint64_t resolution,
+    uint64_t interval_ns, uint64_t duration_ns)
+{
+    int ret = 0;
+    octoping_tracker_t const* tracker = &session->tracker;
+    uint64_t in_flight = 0;
+
+    for (size_t i = 0; i < sim->nb_queued; i++) {
+        if (!sim->queue[i].is_copy) {
+            in_flight++;
+        }
+    }
+    printf("Network: %" PRIu64 " probes, %" PRIu64 " lost, %" PRIu64 " not echoed, %" PRIu64 " queue overflows, %" PRIu64
+        " still in flight, %" PRIu64 " duplicated, %" PRIu64 " reordered\n",
+        sim->nb_sent, sim->nb_lost, sim->nb_limited, sim->nb_overflow, in_flight, sim->nb_duplicates, sim->nb_reordered);
+
+    ret |= octoping_sim_check_count("sent", tracker->nb_sent, sim->nb_sent);
+    ret |= octoping_sim_check_count("echoes", tracker->nb_on_time + tracker->nb_reordered + tracker->nb_late, sim->nb_delivered);
+    ret |= octoping_sim_check_count("lost", tracker->nb_lost - tracker->nb_late,
+        sim->nb_lost + sim->nb_limited + sim->nb_overflow + in_flight);
+    ret |= octoping_sim_check_count("duplicates", tracker->nb_duplicate, sim->nb_duplicates);
+    if (tracker->nb_late == 0) {
+        ret |= octoping_sim_check_count("reordered", tracker->nb_reordered, sim->nb_reordered);
+    }
+    if (sim->nb_delivered > 0) {
+        ret |= octoping_sim_check_count("min rtt (ns)", session->flow.rtt_min, sim->min_rtt);
+    }
+    if (sim->nb_delivered > 0) {
+        double drift = sim->model.drift_ppm * 1.0e-6;
+        double per_bucket = (interval_ns > 0 && interval_ns < OCTOPING_CLOCK_BUCKET) ?
+            (double)OCTOPING_CLOCK_BUCKET / (double)interval_ns : 1.0;
+        double asymmetry = (double)sim->model.up_ns - (double)sim->model.down_ns;
+        double tolerance = 2.0 * (double)resolution + 4.0 * (double)sim->model.jitter_ns / per_bucket;
+        double expected;
+        double error;
+
+        if (!session->wire_v2) {
+            /* The version 1 echoes only carry the server receive time */
+            asymmetry -= (double)sim->model.dwell_ns;
+        }
+        /*
+         * The up delays are indexed by client send time and the down delays
+         * by client receive time, so the drift also scales the asymmetry.
+         */
+        expected = (double)sim->model.offset_ns + drift * (double)(sim->last_middle - OCTOPING_SIM_EPOCH) +
+            (1.0 + drift) * asymmetry / 2.0;
+        error = fabs((double)session->phase - expected);
+        printf("Check phase: %.3f us, expected %.3f us, error %.3f us, tolerance %.3f us, %s\n",
+            (double)session->phase / 1000.0, expected / 1000.0, error / 1000.0, tolerance / 1000.0,
+            (error <= tolerance) ? "OK" : "FAILED");
+        if (error > tolerance) {
+            ret = -1;
+        }
+        if (duration_ns >= 10 * OCTOPING_CLOCK_BUCKET) {
+            double span = (double)((duration_ns < OCTOPING_CLOCK_HORIZON) ? duration_ns : OCTOPING_CLOCK_HORIZON);
+            double measured = octoping_clock_drift(&session->clock);
+            double drift_tolerance = 8.0 * tolerance / span;
+
+            error = fabs(measured - drift);
+            printf("Check drift: %.4f ppm, expected %.4f ppm, error %.4f ppm, tolerance %.4f ppm, %s\n",
+                measured * 1.0e6, drift * 1.0e6, error * 1.0e6, drift_tolerance * 1.0e6,
+                (error <= drift_tolerance) ? "OK" : "FAILED");
+            if (error > drift_tolerance) {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+int octoping_simulate(octoping_options_t* options)
+{
+    int ret = 0;
+    octoping_options_t sim_options = *options;
+    octoping_sim_t* sim = NULL;
+    octoping_session_t* session = NULL;
+    octoping_output_t output;
+    struct sockaddr_in addr_to;
+    octoping_io_t io;
+
+    memset(&output, 0, sizeof(output));
+    memset(&addr_to, 0, sizeof(addr_to));
+    /* The client would spin for ever in virtual time */
+    sim_options.spin_ns = 0;
+
+    if (options->duration_us == 0) {
+        printf("The simulation requires a duration\n");
+        ret = -1;
+    }
+    else if ((sim = (octoping_sim_t*)calloc(1, sizeof(octoping_sim_t))) == NULL ||
+        (sim->queue = (octoping_sim_packet_t*)malloc(OCTOPING_SIM_QUEUE * sizeof(octoping_sim_packet_t))) == NULL ||
+        (session = (octoping_session_t*)malloc(sizeof(octoping_session_t))) == NULL) {
+        printf("Cannot allocate the simulation\n");
+        ret = -1;
+    }
+    else if (octoping_sim_parse(options->simulation, &sim->model) != 0) {
+        printf("Invalid network model: %s\n", options->simulation);
+        ret = -1;
+    }
+    else if (options->limit_interval_ns > 0 &&
+        (sim->reflector.limit = octoping_limit_create(options->limit_interval_ns, options->limit_burst)) == NULL) {
+        printf("Cannot allocate the rate limits\n");
+        ret = -1;
+    }
+    else {
+        uint64_t start_time = OCTOPING_SIM_EPOCH;
+        uint64_t end_send_time = start_time + options->duration_us * 1000;
+        uint64_t end_recv_time = end_send_time + OCTOPING_CLIENT_LINGER;
+        uint64_t wall_start = current_time_ns();
+
+        sim->now = start_time;
+        sim->random = (sim->model.seed != 0) ? sim->model.seed : 1;
+        sim->reflector.s = INVALID_SOCKET;
+        sim->addr_from.sin_family = AF_INET;
+        sim->addr_from.sin_addr.s_addr = htonl(0xc0000201);
+        sim->addr_from.sin_port = htons(OCTOPING_PORT);
+        addr_to.sin_family = AF_INET;
+        addr_to.sin_addr.s_addr = htonl(0xc6336401);
+        addr_to.sin_port = htons(OCTOPING_PORT);
+        memset(&io, 0, sizeof(io));
+        io.io_ctx = sim;
+        io.is_virtual = 1;
+        io.now = octoping_sim_now;
+        io.wait = octoping_sim_wait;
+        io.send = octoping_sim_send;
+        io.recv = octoping_sim_recv;
+
+        if (octoping_output_open(&output, options->file_name, options->output_format,
+            options->timestamps, 0, options->nb_sizes > 0, options->summary_interval_ns) != 0) {
+            ret = -1;
+        }
+        else {
+            output.report = options->report;
+            output.flush_interval_ns = options->flush_interval_ns;
+            output.rotate_bytes = options->rotate_bytes;
+            output.rotate_ns = options->rotate_ns;
+            output.with_dwell = (options->wire_version == 2);
+            output.write_in_loop = 1;
+            if (octoping_session_init(session, INVALID_SOCKET, &addr_to, NULL, 0, options->timestamps, start_time) != 0) {
+                printf("Cannot initialize the session\n");
+                ret = -1;
+            }
+            else {
+                octoping_session_set_probes(session, options->sizes, options->nb_sizes, options->train_length);
+                session->wire_v2 = (options->wire_version == 2);
+                octoping_pacer_init(&session->pacer, start_time, options->interval_ns, options->burst_size);
+                if (octoping_output_header(&output, &sim_options, start_time, session, 1) != 0) {
+                    printf("Cannot write first line on %s", options->file_name);
+                    ret = -1;
+                }
+#ifdef OCTOPING_HAS_FEED
+                if (ret == 0 && options->feed_name != NULL &&
+                    (output.feed = octoping_feed_create(options->feed_name, start_time, options->interval_ns, options->timestamps)) == NULL) {
+                    ret = -1;
+                }
+#endif
+                if (ret == 0) {
+                    ret = octoping_client_loop(&sim_options, session, &output, &io, end_send_time, end_recv_time);
+                }
+                if (ret == 0) {
+                    ret = octoping_session_report_missing(session, &output);
+                }
+                printf("Simulated %.3f s in %.3f s\n", ((double)(sim->now - start_time)) / 1000000000.0,
+                    ((double)(current_time_ns() - wall_start)) / 1000000000.0);
+                octoping_session_print_counts(stdout, "simulation", &session->tracker);
+                octoping_session_print_clock(stdout, "simulation", session);
+                if (ret == 0 && octoping_sim_check(sim, session, (options->timestamps || session->wire_v2) ? 1 : 1000,
+                    options->interval_ns, options->duration_us * 1000) != 0) {
+                    printf("Simulation check FAILED\n");
+                    ret = -1;
+                }
+                octoping_session_release(session);
+            }
+            if (octoping_output_close_at(&output, sim->now) != 0 && ret == 0) {
+                printf("Cannot write the results on %s\n",
+                    (options->file_name == NULL) ? "stdout" : options->file_name);
+                ret = -1;
+            }
+        }
+    }
+
+    if (sim != NULL) {
+        free(sim->reflector.limit);
+        free(sim->queue);
+    }
+    free(sim);
+    free(session);
+    return ret;
+}
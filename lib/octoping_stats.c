@@ -0,0 +1,271 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+/*
+ * Online statistics, kept in constant memory whatever the number of
+ * probes. Times are counted in nanoseconds and printed in microseconds.
+ */
+
+static int octoping_histogram_msb(uint64_t value)
+{
+    int msb = 0;
+
+    for (int shift = 32; shift > 0; shift >>= 1) {
+        if ((value >> shift) != 0) {
+            value >>= shift;
+            msb += shift;
+        }
+    }
+    return msb;
+}
+
+static size_t octoping_histogram_index(uint64_t value)
+{
+    size_t index;
+
+    if (value < OCTOPING_HISTOGRAM_SUB) {
+        index = (size_t)value;
+    }
+    else {
+        int msb = octoping_histogram_msb(value);
+        int shift = msb - OCTOPING_HISTOGRAM_SUB_BITS;
+
+        index = ((size_t)(shift + 1) << OCTOPING_HISTOGRAM_SUB_BITS) +
+            (size_t)((value >> shift) - OCTOPING_HISTOGRAM_SUB);
+    }
+    return index;
+}
+
+/* Middle of the range of values counted in the bucket */
+static uint64_t octoping_histogram_value(size_t index)
+{
+    uint64_t value;
+
+    if (index < OCTOPING_HISTOGRAM_SUB) {
+        value = index;
+    }
+    else {
+        int shift = (int)(index >> OCTOPING_HISTOGRAM_SUB_BITS) - 1;
+        uint64_t mantissa = OCTOPING_HISTOGRAM_SUB + (index & (OCTOPING_HISTOGRAM_SUB - 1));
+
+        value = (mantissa << shift) + (((uint64_t)1 << shift) >> 1);
+    }
+    return value;
+}
+
+void octoping_histogram_add(octoping_histogram_t* histogram, uint64_t value)
+{
+    if (histogram->count == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->count++;
+    histogram->sum += (double)value;
+    histogram->buckets[octoping_histogram_index(value)]++;
+}
+
+uint64_t octoping_histogram_percentile(octoping_histogram_t const* histogram, double fraction)
+{
+    uint64_t value = 0;
+
+    if (histogram->count > 0) {
+        uint64_t rank = (uint64_t)(fraction * (double)histogram->count);
+        uint64_t cumulated = 0;
+
+        if (rank >= histogram->count) {
+            rank = histogram->count - 1;
+        }
+        for (size_t i = 0; i < OCTOPING_HISTOGRAM_BUCKETS; i++) {
+            cumulated += histogram->buckets[i];
+            if (cumulated > rank) {
+                value = octoping_histogram_value(i);
+                break;
+            }
+        }
+        if (value < histogram->min) {
+            value = histogram->min;
+        }
+        else if (value > histogram->max) {
+            value = histogram->max;
+        }
+    }
+    return value;
+}
+
+void octoping_histogram_merge(octoping_histogram_t* total, octoping_histogram_t const* histogram)
+{
+    if (histogram->count > 0) {
+        if (total->count == 0 || histogram->min < total->min) {
+            total->min = histogram->min;
+        }
+        if (histogram->max > total->max) {
+            total->max = histogram->max;
+        }
+        total->count += histogram->count;
+        total->sum += histogram->sum;
+        for (size_t i = 0; i < OCTOPING_HISTOGRAM_BUCKETS; i++) {
+            total->buckets[i] += histogram->buckets[i];
+        }
+    }
+}
+
+static int octoping_histogram_print(FILE* F, char const* name, octoping_histogram_t const* histogram)
+{
+    double mean = (histogram->count > 0) ? histogram->sum / (double)histogram->count : 0;
+
+    return (fprintf(F, "    %-7s min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f, mean %.3f us\n", name,
+        ((double)histogram->min) / 1000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.5)) / 1000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.9)) / 1000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.99)) / 1000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.999)) / 1000.0,
+        ((double)histogram->max) / 1000.0, mean / 1000.0) < 0) ? -1 : 0;
+}
+
+/* Capacity estimates are kept in bits per second, and printed in Mbps */
+static int octoping_capacity_print(FILE* F, char const* name, octoping_histogram_t const* histogram)
+{
+    return (fprintf(F, "    %-7s %" PRIu64 " trains, min %.3f, p10 %.3f, p50 %.3f, p90 %.3f, max %.3f Mbps\n", name,
+        histogram->count, ((double)histogram->min) / 1000000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.1)) / 1000000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.5)) / 1000000.0,
+        ((double)octoping_histogram_percentile(histogram, 0.9)) / 1000000.0,
+        ((double)histogram->max) / 1000000.0) < 0) ? -1 : 0;
+}
+
+void octoping_stats_reset(octoping_stats_t* stats)
+{
+    memset(stats, 0, sizeof(octoping_stats_t));
+}
+
+/*
+ * Count a result. Negative delays, which can only come from clock
+ * adjustments, are counted as zero. The last rtt of the target is kept
+ * to compute the jitter, and set to -1 after a loss.
+ */
+void octoping_stats_add(octoping_stats_t* stats, octoping_result_t const* result, int64_t* last_rtt)
+{
+    if ((result->flags & OCTOPING_RESULT_LOST) != 0) {
+        stats->nb_lost++;
+        *last_rtt = -1;
+    }
+    else {
+        stats->nb_echoes++;
+        if ((result->flags & OCTOPING_RESULT_REORDERED) != 0) {
+            stats->nb_reordered++;
+        }
+        if ((result->flags & OCTOPING_RESULT_LATE) != 0) {
+            stats->nb_late++;
+        }
+        if (result->rtt > 0) {
+            octoping_histogram_add(&stats->rtt, (uint64_t)result->rtt);
+            octoping_histogram_add(&stats->up_t, (result->up_t > 0) ? (uint64_t)result->up_t : 0);
+            octoping_histogram_add(&stats->down_t, (result->down_t > 0) ? (uint64_t)result->down_t : 0);
+            if (*last_rtt >= 0) {
+                octoping_histogram_add(&stats->jitter, (uint64_t)((result->rtt > *last_rtt) ?
+                    result->rtt - *last_rtt : *last_rtt - result->rtt));
+            }
+            *last_rtt = result->rtt;
+            if ((result->flags & OCTOPING_RESULT_KERNEL_TS) != 0) {
+                octoping_histogram_add(&stats->stack_t, (result->rtt > result->wire_rtt) ?
+                    (uint64_t)(result->rtt - result->wire_rtt) : 0);
+            }
+            if ((result->flags & OCTOPING_RESULT_DWELL) != 0) {
+                octoping_histogram_add(&stats->dwell, (result->dwell > 0) ? (uint64_t)result->dwell : 0);
+                octoping_histogram_add(&stats->net_rtt, (result->net_rtt > 0) ? (uint64_t)result->net_rtt : 0);
+            }
+        }
+    }
+}
+
+void octoping_flow_stats_add(octoping_flow_stats_t* flow, octoping_result_t const* result)
+{
+    if ((result->flags & OCTOPING_RESULT_LOST) != 0) {
+        flow->nb_lost++;
+    }
+    else {
+        flow->nb_echoes++;
+        if (result->rtt > 0) {
+            if (flow->rtt_min == 0 || (uint64_t)result->rtt < flow->rtt_min) {
+                flow->rtt_min = (uint64_t)result->rtt;
+            }
+            if ((uint64_t)result->rtt > flow->rtt_max) {
+                flow->rtt_max = (uint64_t)result->rtt;
+            }
+            flow->rtt_sum += (double)result->rtt;
+        }
+    }
+}
+
+/* Count the capacity estimates of a packet train, 0 if not available */
+void octoping_stats_add_train(octoping_stats_t* stats, uint64_t up_bps, uint64_t rt_bps)
+{
+    if (up_bps > 0) {
+        octoping_histogram_add(&stats->capacity_up, up_bps);
+    }
+    if (rt_bps > 0) {
+        octoping_histogram_add(&stats->capacity_rt, rt_bps);
+    }
+}
+
+void octoping_stats_merge(octoping_stats_t* total, octoping_stats_t const* stats)
+{
+    total->nb_echoes += stats->nb_echoes;
+    total->nb_lost += stats->nb_lost;
+    total->nb_reordered += stats->nb_reordered;
+    total->nb_late += stats->nb_late;
+    octoping_histogram_merge(&total->rtt, &stats->rtt);
+    octoping_histogram_merge(&total->up_t, &stats->up_t);
+    octoping_histogram_merge(&total->down_t, &stats->down_t);
+    octoping_histogram_merge(&total->jitter, &stats->jitter);
+    octoping_histogram_merge(&total->stack_t, &stats->stack_t);
+    octoping_histogram_merge(&total->dwell, &stats->dwell);
+    octoping_histogram_merge(&total->net_rtt, &stats->net_rtt);
+    octoping_histogram_merge(&total->capacity_up, &stats->capacity_up);
+    octoping_histogram_merge(&total->capacity_rt, &stats->capacity_rt);
+}
+
+int octoping_stats_print(FILE* F, char const* label, octoping_stats_t const* stats)
+{
+    int ret = 0;
+    uint64_t nb_probes = stats->nb_echoes + stats->nb_lost;
+    double loss_rate = (nb_probes > 0) ? 100.0 * ((double)stats->nb_lost) / ((double)nb_probes) : 0;
+
+    if (fprintf(F, "%s: %" PRIu64 " echoes, %" PRIu64 " lost (%.3f%%), %" PRIu64 " reordered, %" PRIu64 " late\n",
+        label, stats->nb_echoes, stats->nb_lost, loss_rate, stats->nb_reordered, stats->nb_late) < 0 ||
+        octoping_histogram_print(F, "rtt", &stats->rtt) != 0 ||
+        octoping_histogram_print(F, "up_t", &stats->up_t) != 0 ||
+        octoping_histogram_print(F, "down_t", &stats->down_t) != 0 ||
+        octoping_histogram_print(F, "jitter", &stats->jitter) != 0 ||
+        (stats->stack_t.count > 0 && octoping_histogram_print(F, "stack_t", &stats->stack_t) != 0) ||
+        (stats->dwell.count > 0 && octoping_histogram_print(F, "dwell", &stats->dwell) != 0) ||
+        (stats->net_rtt.count > 0 && octoping_histogram_print(F, "net_rtt", &stats->net_rtt) != 0) ||
+        (stats->capacity_up.count > 0 && octoping_capacity_print(F, "cap_up", &stats->capacity_up) != 0) ||
+        (stats->capacity_rt.count > 0 && octoping_capacity_print(F, "cap_rt", &stats->capacity_rt) != 0)) {
+        ret = -1;
+    }
+    return ret;
+}
@@ -0,0 +1,161 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "octoping.h"
+
+/*
+ * In-flight tracker. The ring capacity is a power of 2, so the slot
+ * of a probe is its sequence number modulo the capacity. The ring holds
+ * the probes from base to next_seq - 1.
+ */
+
+int octoping_tracker_init(octoping_tracker_t* tracker)
+{
+    memset(tracker, 0, sizeof(octoping_tracker_t));
+    tracker->probes = (octoping_probe_t*)calloc(OCTOPING_TRACKER_MIN, sizeof(octoping_probe_t));
+    if (tracker->probes == NULL) {
+        return -1;
+    }
+    tracker->capacity = OCTOPING_TRACKER_MIN;
+    return 0;
+}
+
+void octoping_tracker_release(octoping_tracker_t* tracker)
+{
+    free(tracker->probes);
+    tracker->probes = NULL;
+    tracker->capacity = 0;
+}
+
+static int octoping_tracker_grow(octoping_tracker_t* tracker)
+{
+    uint64_t new_capacity = 2 * tracker->capacity;
+    octoping_probe_t* new_probes;
+
+    if (new_capacity > OCTOPING_TRACKER_MAX ||
+        (new_probes = (octoping_probe_t*)malloc((size_t)new_capacity * sizeof(octoping_probe_t))) == NULL) {
+        return -1;
+    }
+    for (uint64_t seqnum = tracker->base; seqnum < tracker->next_seq; seqnum++) {
+        new_probes[seqnum & (new_capacity - 1)] = tracker->probes[seqnum & (tracker->capacity - 1)];
+    }
+    free(tracker->probes);
+    tracker->probes = new_probes;
+    tracker->capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Record a new probe, numbered next_seq. If the ring is full and cannot
+ * grow, the caller must first retire the oldest probe.
+ */
+int octoping_tracker_insert(octoping_tracker_t* tracker, uint64_t sent_at)
+{
+    octoping_probe_t* probe;
+
+    if (tracker->next_seq - tracker->base >= tracker->capacity && octoping_tracker_grow(tracker) != 0) {
+        return -1;
+    }
+    probe = &tracker->probes[tracker->next_seq & (tracker->capacity - 1)];
+    probe->sent_at = sent_at;
+    probe->tx_at = 0;
+    probe->is_acked = 0;
+    tracker->next_seq++;
+    tracker->nb_sent++;
+    return 0;
+}
+
+octoping_probe_t* octoping_tracker_find(octoping_tracker_t* tracker, uint64_t seqnum)
+{
+    if (seqnum < tracker->base || seqnum >= tracker->next_seq) {
+        return NULL;
+    }
+    return &tracker->probes[seqnum & (tracker->capacity - 1)];
+}
+
+/*
+ * Classify an echo and mark the probe as acknowledged. For on time
+ * and reordered echoes, a copy of the probe is returned in *probe.
+ */
+octoping_reply_class_t octoping_tracker_ack(octoping_tracker_t* tracker, uint64_t seqnum, octoping_probe_t* probe)
+{
+    octoping_reply_class_t reply_class;
+    octoping_probe_t* tracked;
+
+    if (seqnum >= tracker->next_seq) {
+        reply_class = octoping_reply_invalid;
+    }
+    else if ((tracked = octoping_tracker_find(tracker, seqnum)) == NULL) {
+        reply_class = octoping_reply_late;
+        tracker->nb_late++;
+    }
+    else if (tracked->is_acked) {
+        reply_class = octoping_reply_duplicate;
+        tracker->nb_duplicate++;
+    }
+    else {
+        tracked->is_acked = 1;
+        *probe = *tracked;
+        if (tracker->nb_on_time + tracker->nb_reordered > 0 && seqnum < tracker->highest_acked) {
+            reply_class = octoping_reply_reordered;
+            tracker->nb_reordered++;
+        }
+        else {
+            reply_class = octoping_reply_on_time;
+            tracker->nb_on_time++;
+            tracker->highest_acked = seqnum;
+        }
+    }
+    return reply_class;
+}
+
+/* Number of probes neither acknowledged nor reported lost */
+uint64_t octoping_tracker_nb_pending(octoping_tracker_t const* tracker)
+{
+    return tracker->nb_sent - tracker->nb_on_time - tracker->nb_reordered - tracker->nb_lost;
+}
+
+/*
+ * Retire the probes sent before sent_before, and the oldest probe if the
+ * ring is full and at maximum capacity. Returns 1 and the probe number
+ * and sent time if a probe that was not acknowledged is retired, 0 if
+ * there is no more probe to retire. Callers loop until the function
+ * returns 0.
+ */
+int octoping_tracker_next_lost(octoping_tracker_t* tracker, uint64_t sent_before, uint64_t* seqnum, uint64_t* sent_at)
+{
+    while (tracker->base < tracker->next_seq) {
+        octoping_probe_t* probe = &tracker->probes[tracker->base & (tracker->capacity - 1)];
+
+        if (probe->sent_at >= sent_before &&
+            (tracker->next_seq - tracker->base < tracker->capacity || tracker->capacity < OCTOPING_TRACKER_MAX)) {
+            break;
+        }
+        tracker->base++;
+        if (!probe->is_acked) {
+            tracker->nb_lost++;
+            *seqnum = tracker->base - 1;
+            *sent_at = probe->sent_at;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,678 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "octoping.h"
+
+#ifdef OCTOPING_HAS_URING
+#include <sys/syscall.h>
+
+/*
+ * io_uring engine. The ring is set up and driven with the raw system
+ * calls, so that octoping does not depend on liburing.
+ */
+
+static int octoping_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+    void* arg, size_t arg_size)
+{
+    OCTOPING_COUNT_SYSCALL();
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static void octoping_uring_add_buffer(octoping_uring_t* uring, unsigned int bid)
+{
+    struct io_uring_buf* buf = &uring->buf_ring->bufs[uring->buf_tail & (uring->nb_buffers - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->buffers + (size_t)bid * uring->buffer_size);
+    buf->len = uring->buffer_size;
+    buf->bid = (uint16_t)bid;
+    uring->buf_tail++;
+}
+
+/*
+ * Create the ring, map the submission and completion queues, and register
+ * nb_buffers receive buffers of buffer_size bytes. The number of buffers
+ * must be a power of 2.
+ */
+int octoping_uring_init(octoping_uring_t* uring, unsigned int entries, unsigned int nb_buffers, unsigned int buffer_size)
+{
+    int ret = 0;
+    struct io_uring_params params;
+
+    memset(uring, 0, sizeof(octoping_uring_t));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4 * entries;
+
+    uring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (uring->fd < 0) {
+        printf("Cannot create the io_uring, error %d\n", errno);
+        return -1;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        printf("The kernel io_uring version is too old\n");
+        ret = -1;
+    }
+    else {
+        uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (uring->cq_ring_size > uring->sq_ring_size) {
+            uring->sq_ring_size = uring->cq_ring_size;
+        }
+        uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        uring->sq_ring = (uint8_t*)mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            uring->fd, IORING_OFF_SQ_RING);
+        uring->sqes = (struct io_uring_sqe*)mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            uring->fd, IORING_OFF_SQES);
+        if (uring->sq_ring == MAP_FAILED || uring->sqes == MAP_FAILED) {
+            printf("Cannot map the io_uring queues, error %d\n", errno);
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        unsigned int* sq_array = (unsigned int*)(uring->sq_ring + params.sq_off.array);
+
+        uring->cq_ring = uring->sq_ring;
+        uring->sq_entries = params.sq_entries;
+        uring->sq_mask = *(unsigned int*)(uring->sq_ring + params.sq_off.ring_mask);
+        uring->sq_head = (unsigned int*)(uring->sq_ring + params.sq_off.head);
+        uring->sq_tail = (unsigned int*)(uring->sq_ring + params.sq_off.tail);
+        for (unsigned int i = 0; i < params.sq_entries; i++) {
+            sq_array[i] = i;
+        }
+        uring->sq_local_tail = *uring->sq_tail;
+        uring->sq_submitted = uring->sq_local_tail;
+        uring->cq_mask = *(unsigned int*)(uring->cq_ring + params.cq_off.ring_mask);
+        uring->cq_head = (unsigned int*)(uring->cq_ring + params.cq_off.head);
+        uring->cq_tail = (unsigned int*)(uring->cq_ring + params.cq_off.tail);
+        uring->cqes = (struct io_uring_cqe*)(uring->cq_ring + params.cq_off.cqes);
+
+        /* Provided buffers, in a page aligned ring shared with the kernel */
+        uring->nb_buffers = nb_buffers;
+        uring->buffer_size = buffer_size;
+        uring->buf_ring_size = (nb_buffers * sizeof(struct io_uring_buf) + 4095) & ~((size_t)4095);
+        uring->buf_ring = (struct io_uring_buf_ring*)mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        uring->buffers = (uint8_t*)malloc((size_t)nb_buffers * buffer_size);
+        if (uring->buf_ring == MAP_FAILED || uring->buffers == NULL) {
+            printf("Cannot allocate the io_uring buffers\n");
+            ret = -1;
+        }
+        else {
+            struct io_uring_buf_reg reg;
+
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+            reg.ring_entries = nb_buffers;
+            reg.bgid = 0;
+            if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                printf("Cannot register the io_uring buffers, error %d\n", errno);
+                ret = -1;
+            }
+            else {
+                for (unsigned int i = 0; i < nb_buffers; i++) {
+                    octoping_uring_add_buffer(uring, i);
+                }
+                OCTOPING_STORE_RELEASE(&uring->buf_ring->tail, uring->buf_tail);
+            }
+        }
+    }
+    if (ret != 0) {
+        octoping_uring_release(uring);
+    }
+    return ret;
+}
+
+void octoping_uring_release(octoping_uring_t* uring)
+{
+    if (uring->fd >= 0) {
+        close(uring->fd);
+        uring->fd = -1;
+    }
+    if (uring->sq_ring != NULL && uring->sq_ring != MAP_FAILED) {
+        (void)munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->sqes != NULL && uring->sqes != MAP_FAILED) {
+        (void)munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->buf_ring != NULL && uring->buf_ring != MAP_FAILED) {
+        (void)munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    free(uring->buffers);
+    uring->sq_ring = NULL;
+    uring->sqes = NULL;
+    uring->buf_ring = NULL;
+    uring->buffers = NULL;
+}
+
+/*
+ * Get a free submission entry. If the queue is full, the pending entries
+ * are submitted first. Returns NULL if that fails.
+ */
+struct io_uring_sqe* octoping_uring_get_sqe(octoping_uring_t* uring)
+{
+    struct io_uring_sqe* sqe = NULL;
+
+    if (uring->sq_local_tail - OCTOPING_LOAD_ACQUIRE(uring->sq_head) >= uring->sq_entries) {
+        (void)octoping_uring_submit(uring, 0, 0);
+    }
+    if (uring->sq_local_tail - OCTOPING_LOAD_ACQUIRE(uring->sq_head) < uring->sq_entries) {
+        sqe = &uring->sqes[uring->sq_local_tail & uring->sq_mask];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        uring->sq_local_tail++;
+    }
+    return sqe;
+}
+
+/*
+ * Submit the pending entries, and wait for at least wait_nr completions,
+ * for at most timeout_ns nanoseconds if timeout_ns is not 0. This is a
+ * single system call. Returns -1 in case of error, 0 otherwise.
+ */
+int octoping_uring_submit(octoping_uring_t* uring, unsigned int wait_nr, uint64_t timeout_ns)
+{
+    int ret = 0;
+    unsigned int to_submit = uring->sq_local_tail - uring->sq_submitted;
+    unsigned int flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void* arg_ptr = NULL;
+    size_t arg_size = 0;
+
+    OCTOPING_STORE_RELEASE(uring->sq_tail, uring->sq_local_tail);
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ns > 0) {
+            ts.tv_sec = (long long)(timeout_ns / 1000000000ull);
+            ts.tv_nsec = (long long)(timeout_ns % 1000000000ull);
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            arg_ptr = &arg;
+            arg_size = sizeof(arg);
+        }
+    }
+    if (to_submit > 0 || wait_nr > 0) {
+        if (octoping_uring_enter(uring->fd, to_submit, wait_nr, flags, arg_ptr, arg_size) < 0 &&
+            errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            printf("io_uring_enter fails, error %d\n", errno);
+            ret = -1;
+        }
+        uring->sq_submitted = OCTOPING_LOAD_ACQUIRE(uring->sq_head);
+    }
+    return ret;
+}
+
+struct io_uring_cqe* octoping_uring_peek(octoping_uring_t* uring)
+{
+    unsigned int head = *uring->cq_head;
+
+    return (head == OCTOPING_LOAD_ACQUIRE(uring->cq_tail)) ? NULL : &uring->cqes[head & uring->cq_mask];
+}
+
+void octoping_uring_advance(octoping_uring_t* uring)
+{
+    OCTOPING_STORE_RELEASE(uring->cq_head, *uring->cq_head + 1);
+}
+
+/*
+ * Arm a multishot receive on the socket. Each packet is placed in one
+ * of the provided buffers, after a header, the source address, and
+ * control_size bytes of control data.
+ */
+int octoping_uring_arm_recv(octoping_uring_t* uring, SOCKET_TYPE s, size_t control_size)
+{
+    int ret = 0;
+    struct io_uring_sqe* sqe = octoping_uring_get_sqe(uring);
+
+    if (sqe == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(&uring->recv_msg, 0, sizeof(uring->recv_msg));
+        uring->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+        uring->recv_msg.msg_controllen = control_size;
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = s;
+        sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = OCTOPING_URING_TAG_RECV;
+    }
+    return ret;
+}
+
+/*
+ * Find the payload of a packet received by the multishot receive.
+ * Returns NULL if the completion carries no packet. The kernel drop
+ * count is updated if drops is not NULL.
+ */
+uint8_t* octoping_uring_parse_recv(octoping_uring_t* uring, struct io_uring_cqe const* cqe, int* length,
+    struct sockaddr_in* addr_from, uint64_t* rx_ns, uint64_t* drops)
+{
+    uint8_t* payload = NULL;
+
+    *rx_ns = 0;
+    if (cqe->res >= (int)sizeof(struct io_uring_recvmsg_out) && (cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+        uint8_t* buffer = uring->buffers + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * uring->buffer_size;
+        struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buffer;
+        uint8_t* name = buffer + sizeof(struct io_uring_recvmsg_out);
+        uint8_t* control = name + uring->recv_msg.msg_namelen;
+        int available;
+
+        payload = control + uring->recv_msg.msg_controllen;
+        available = (int)((buffer + cqe->res) - payload);
+        *length = ((int)out->payloadlen > available) ? available : (int)out->payloadlen;
+        if (*length < 0) {
+            payload = NULL;
+        }
+        else {
+            if (addr_from != NULL) {
+                memset(addr_from, 0, sizeof(struct sockaddr_in));
+                memcpy(addr_from, name, (out->namelen < sizeof(struct sockaddr_in)) ? out->namelen : sizeof(struct sockaddr_in));
+            }
+            if (out->controllen > 0) {
+                struct msghdr msg;
+
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = control;
+                msg.msg_controllen = out->controllen;
+#ifdef OCTOPING_HAS_TIMESTAMPING
+                *rx_ns = octoping_get_timestamp(&msg);
+#endif
+#ifdef OCTOPING_HAS_RXQ_OVFL
+                if (drops != NULL) {
+                    octoping_get_drops(&msg, drops);
+                }
+#else
+                (void)drops;
+#endif
+            }
+        }
+    }
+    return payload;
+}
+
+/* Give the buffer used by a received packet back to the kernel */
+void octoping_uring_recycle(octoping_uring_t* uring, struct io_uring_cqe const* cqe)
+{
+    if ((cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+        octoping_uring_add_buffer(uring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        OCTOPING_STORE_RELEASE(&uring->buf_ring->tail, uring->buf_tail);
+    }
+}
+
+int octoping_uring_sendmsg(octoping_uring_t* uring, SOCKET_TYPE s, struct msghdr* msg, uint64_t user_data)
+{
+    int ret = 0;
+    struct io_uring_sqe* sqe = octoping_uring_get_sqe(uring);
+
+    if (sqe == NULL) {
+        ret = -1;
+    }
+    else {
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = s;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->user_data = user_data;
+    }
+    return ret;
+}
+
+/* Arm a timeout that expires at wake_time, in nanoseconds of the real time clock */
+int octoping_uring_timeout(octoping_uring_t* uring, uint64_t wake_time)
+{
+    int ret = 0;
+    struct io_uring_sqe* sqe = octoping_uring_get_sqe(uring);
+
+    if (sqe == NULL) {
+        ret = -1;
+    }
+    else {
+        uring->timeout_ts.tv_sec = (long long)(wake_time / 1000000000ull);
+        uring->timeout_ts.tv_nsec = (long long)(wake_time % 1000000000ull);
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)&uring->timeout_ts;
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS | IORING_TIMEOUT_REALTIME;
+        sqe->user_data = OCTOPING_URING_TAG_TIMEOUT;
+    }
+    return ret;
+}
+
+static void octoping_uring_init_slots(uint32_t* free_slots, int* nb_free)
+{
+    for (int i = 0; i < OCTOPING_URING_SLOTS; i++) {
+        free_slots[i] = (uint32_t)(OCTOPING_URING_SLOTS - 1 - i);
+    }
+    *nb_free = OCTOPING_URING_SLOTS;
+}
+
+/*
+ * Server worker loop. Each call to octoping_uring_submit sends the echoes
+ * prepared since the previous call and waits for the next packets. Packets
+ * are copied to a send slot and the receive buffer is given back at once.
+ * If all the slots are in use, the packet is not echoed, and counted as a
+ * send error.
+ */
+int octoping_server_uring(octoping_server_worker_t* worker)
+{
+    int ret = 0;
+    octoping_uring_t uring;
+    octoping_uring_slot_t* slots = (octoping_uring_slot_t*)calloc(OCTOPING_URING_SLOTS, sizeof(octoping_uring_slot_t));
+    uint32_t* free_slots = (uint32_t*)malloc(OCTOPING_URING_SLOTS * sizeof(uint32_t));
+    size_t control_size = OCTOPING_CONTROL_MAX;
+    unsigned int buffer_size = (unsigned int)(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+        control_size + OCTOPING_PACKET_MAX);
+    int nb_free = 0;
+
+    if (slots == NULL || free_slots == NULL) {
+        printf("Cannot allocate the io_uring send slots\n");
+        ret = -1;
+    }
+    else if (octoping_uring_init(&uring, OCTOPING_URING_ENTRIES, OCTOPING_URING_BUFFERS, buffer_size) != 0) {
+        ret = -1;
+    }
+    else {
+        octoping_uring_init_slots(free_slots, &nb_free);
+        ret = octoping_uring_arm_recv(&uring, worker->s, control_size);
+
+        while (ret == 0 && !octoping_server_is_stopping()) {
+            struct io_uring_cqe* cqe;
+            int rearm = 0;
+            int nb_rx = 0;
+            uint64_t now;
+
+            if (octoping_uring_submit(&uring, 1, OCTOPING_SERVER_TIMEOUT_MS * 1000000ull) != 0) {
+                ret = -1;
+                break;
+            }
+            now = current_time_ns();
+            while ((cqe = octoping_uring_peek(&uring)) != NULL) {
+                if (cqe->user_data == OCTOPING_URING_TAG_RECV) {
+                    if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                        printf("Multishot receive returns %d\n", cqe->res);
+                        ret = -1;
+                    }
+                    else {
+                        struct sockaddr_in addr_from;
+                        uint64_t rx_ns;
+                        int l = 0;
+                        uint8_t* payload = octoping_uring_parse_recv(&uring, cqe, &l, &addr_from, &rx_ns,
+                            &worker->counters.rx_drops);
+
+                        if (payload != NULL) {
+                            octoping_server_count_rx(worker, &addr_from, l);
+                            nb_rx++;
+                            if (l < 16 || !octoping_server_admit(worker, &addr_from, now)) {
+                                /* Not echoed */
+                            }
+                            else if (nb_free == 0) {
+                                OCTOPING_COUNTER_ADD(worker->counters.send_errors, 1);
+                            }
+                            else {
+                                uint32_t slot_index = free_slots[--nb_free];
+                                octoping_uring_slot_t* slot = &slots[slot_index];
+
+                                memcpy(slot->buffer, payload, (l > OCTOPING_PACKET_MAX) ? OCTOPING_PACKET_MAX : l);
+                                slot->addr = addr_from;
+                                memset(&slot->msg, 0, sizeof(slot->msg));
+                                slot->iov.iov_base = slot->buffer;
+                                slot->iov.iov_len = octoping_server_stamp(slot->buffer, l, (rx_ns == 0) ? now : rx_ns);
+                                octoping_server_stamp_tx(slot->buffer, (int)slot->iov.iov_len, current_time_ns());
+                                slot->msg.msg_name = &slot->addr;
+                                slot->msg.msg_namelen = sizeof(struct sockaddr_in);
+                                slot->msg.msg_iov = &slot->iov;
+                                slot->msg.msg_iovlen = 1;
+                                if (octoping_uring_sendmsg(&uring, worker->s, &slot->msg, slot_index) != 0) {
+                                    free_slots[nb_free++] = slot_index;
+                                    OCTOPING_COUNTER_ADD(worker->counters.send_errors, 1);
+                                }
+                            }
+                        }
+                    }
+                    octoping_uring_recycle(&uring, cqe);
+                    if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                        rearm = 1;
+                    }
+                }
+                else if (cqe->user_data < OCTOPING_URING_SLOTS) {
+                    free_slots[nb_free++] = (uint32_t)cqe->user_data;
+                    if (cqe->res < 0) {
+                        OCTOPING_COUNTER_ADD(worker->counters.send_errors, 1);
+                    }
+                    else {
+                        OCTOPING_COUNTER_ADD(worker->counters.tx_packets, 1);
+                        OCTOPING_COUNTER_ADD(worker->counters.tx_bytes, (uint64_t)cqe->res);
+                    }
+                }
+                octoping_uring_advance(&uring);
+            }
+            if (nb_rx > 0) {
+                OCTOPING_COUNTER_ADD(worker->counters.rx_calls, 1);
+            }
+            if (ret == 0 && rearm) {
+                ret = octoping_uring_arm_recv(&uring, worker->s, control_size);
+            }
+        }
+        octoping_uring_release(&uring);
+    }
+    free(slots);
+    free(free_slots);
+
+    return ret;
+}
+
+/*
+ * Client state for the io_uring engine
+ */
+typedef struct st_octoping_uring_client_t {
+    octoping_uring_t uring;
+    octoping_uring_slot_t* slots;
+    uint32_t* free_slots;
+    int nb_free;
+    size_t control_size;
+    uint64_t timeout_at;
+    octoping_session_t* session;
+    octoping_output_t* output;
+} octoping_uring_client_t;
+
+static int octoping_client_uring_reap(octoping_uring_client_t* client)
+{
+    int ret = 0;
+    int rearm = 0;
+    int nb_sent = 0;
+    struct io_uring_cqe* cqe;
+
+    while ((cqe = octoping_uring_peek(&client->uring)) != NULL) {
+        if (cqe->user_data == OCTOPING_URING_TAG_RECV) {
+            if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                printf("Multishot receive returns %d\n", cqe->res);
+                ret = -1;
+            }
+            else {
+                uint64_t rx_ns;
+                int l = 0;
+                uint8_t* payload = octoping_uring_parse_recv(&client->uring, cqe, &l, NULL, &rx_ns, NULL);
+
+                if (payload != NULL) {
+#ifdef OCTOPING_HAS_TIMESTAMPING
+                    if (client->session->timestamps) {
+                        octoping_session_tx_timestamps(client->session);
+                    }
+#endif
+                    if (octoping_session_process(client->session, payload, l, rx_ns, current_time_ns(), client->output) != 0) {
+                        printf("Error while processing echo\n");
+                        ret = -1;
+                    }
+                }
+            }
+            octoping_uring_recycle(&client->uring, cqe);
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                rearm = 1;
+            }
+        }
+        else if (cqe->user_data == OCTOPING_URING_TAG_TIMEOUT) {
+            client->timeout_at = UINT64_MAX;
+        }
+        else if (cqe->user_data < OCTOPING_URING_SLOTS) {
+            client->free_slots[client->nb_free++] = (uint32_t)cqe->user_data;
+            if (cqe->res < 0) {
+                printf("Sendmsg returns %d\n", cqe->res);
+                ret = -1;
+            }
+            nb_sent++;
+        }
+        octoping_uring_advance(&client->uring);
+    }
+#ifdef OCTOPING_HAS_TIMESTAMPING
+    if (nb_sent > 0 && client->session->timestamps) {
+        octoping_session_tx_timestamps(client->session);
+    }
+#endif
+    if (ret == 0 && rearm) {
+        ret = octoping_uring_arm_recv(&client->uring, client->session->s, client->control_size);
+    }
+    return ret;
+}
+
+/*
+ * Client loop. The probes of a burst are queued, then submitted together
+ * with a timeout set at the next send time, minus the spin time, in a
+ * single call that also waits for the echoes.
+ */
+int octoping_client_uring(octoping_options_t* options, octoping_session_t* session, octoping_output_t* output,
+    uint64_t end_send_time, uint64_t end_recv_time)
+{
+    int ret = 0;
+    octoping_uring_client_t client;
+
+    memset(&client, 0, sizeof(client));
+    client.session = session;
+    client.output = output;
+    client.timeout_at = UINT64_MAX;
+    client.control_size = (session->timestamps) ? OCTOPING_CONTROL_MAX : 0;
+    client.slots = (octoping_uring_slot_t*)calloc(OCTOPING_URING_SLOTS, sizeof(octoping_uring_slot_t));
+    client.free_slots = (uint32_t*)malloc(OCTOPING_URING_SLOTS * sizeof(uint32_t));
+
+    if (client.slots == NULL || client.free_slots == NULL) {
+        printf("Cannot allocate the io_uring send slots\n");
+        ret = -1;
+    }
+    else if (octoping_uring_init(&client.uring, OCTOPING_URING_ENTRIES, OCTOPING_URING_BUFFERS,
+        (unsigned int)(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + client.control_size +
+            OCTOPING_PACKET_MAX)) != 0) {
+        ret = -1;
+    }
+    else {
+        uint64_t t = current_time_ns();
+        uint64_t r_t = session->start_time + 1000000000ull;
+        int is_sending = 1;
+
+        octoping_uring_init_slots(client.free_slots, &client.nb_free);
+        ret = octoping_uring_arm_recv(&client.uring, session->s, client.control_size);
+
+        while (ret == 0 && t < end_recv_time && (is_sending || octoping_tracker_nb_pending(&session->tracker) > 0)) {
+            uint64_t wake_time;
+
+            octoping_client_check_stop(t, &end_send_time, &end_recv_time);
+            if (t >= r_t) {
+                if (options->file_name != NULL && options->duration_us > 0) {
+                    printf(".");
+                    fflush(stdout);
+                }
+                if (octoping_output_periodic(output, t) != 0) {
+                    ret = -1;
+                }
+                r_t += 1000000000ull;
+            }
+            if (is_sending && t >= session->pacer.next_time) {
+                /* Queue the whole burst */
+                do {
+                    while (ret == 0 && client.nb_free == 0) {
+                        ret = octoping_uring_submit(&client.uring, 1, 0);
+                        if (ret == 0) {
+                            ret = octoping_client_uring_reap(&client);
+                        }
+                    }
+                    if (ret == 0) {
+                        uint32_t slot_index = client.free_slots[--client.nb_free];
+                        octoping_uring_slot_t* slot = &client.slots[slot_index];
+                        int l = octoping_session_prepare(session, t, slot->buffer, output);
+
+                        if (l < 0) {
+                            ret = -1;
+                        }
+                        else {
+                            memset(&slot->msg, 0, sizeof(slot->msg));
+                            slot->addr = session->addr_to;
+                            slot->iov.iov_base = slot->buffer;
+                            slot->iov.iov_len = l;
+                            slot->msg.msg_name = &slot->addr;
+                            slot->msg.msg_namelen = sizeof(struct sockaddr_in);
+                            slot->msg.msg_iov = &slot->iov;
+                            slot->msg.msg_iovlen = 1;
+                            ret = octoping_uring_sendmsg(&client.uring, session->s, &slot->msg, slot_index);
+                        }
+                    }
+                    octoping_pacer_on_send(&session->pacer, t);
+                    t = current_time_ns();
+                } while (ret == 0 && session->pacer.burst_sent != 0);
+                if (session->pacer.next_time > end_send_time) {
+                    is_sending = 0;
+                }
+            }
+
+            wake_time = (is_sending) ? session->pacer.next_time : end_recv_time;
+            if (wake_time > r_t) {
+                wake_time = r_t;
+            }
+            if (ret == 0) {
+                if (wake_time > t + options->spin_ns) {
+                    if (wake_time - options->spin_ns < client.timeout_at) {
+                        client.timeout_at = wake_time - options->spin_ns;
+                        ret = octoping_uring_timeout(&client.uring, client.timeout_at);
+                    }
+                    if (ret == 0) {
+                        ret = octoping_uring_submit(&client.uring, 1, 0);
+                    }
+                }
+                else {
+                    ret = octoping_uring_submit(&client.uring, 0, 0);
+                }
+            }
+            if (ret == 0) {
+                ret = octoping_client_uring_reap(&client);
+            }
+            t = current_time_ns();
+        }
+        octoping_uring_release(&client.uring);
+    }
+    free(client.slots);
+    free(client.free_slots);
+
+    return ret;
+}
+#endif
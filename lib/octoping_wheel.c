@@ -0,0 +1,174 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "octoping.h"
+
+#ifdef _WINDOWS
+static int octoping_ctz64(uint64_t x)
+{
+    int n = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+#else
+#define octoping_ctz64(x) __builtin_ctzll(x)
+#endif
+
+/*
+ * Timer wheel. Each slot holds a doubly linked list of timers. The
+ * slot of a timer is its expire tick modulo the number of slots. The
+ * current tick is the first tick that was not entirely processed:
+ * timers that expire before it are inserted in the current slot.
+ */
+
+void octoping_wheel_init(octoping_wheel_t* wheel, uint64_t tick_ns, uint64_t current_time)
+{
+    memset(wheel, 0, sizeof(octoping_wheel_t));
+    wheel->tick_ns = (tick_ns < OCTOPING_WHEEL_MIN_TICK) ? OCTOPING_WHEEL_MIN_TICK : tick_ns;
+    wheel->current_tick = current_time / wheel->tick_ns;
+}
+
+void octoping_wheel_insert(octoping_wheel_t* wheel, octoping_timer_t* timer, uint64_t expire_time)
+{
+    uint64_t tick = expire_time / wheel->tick_ns;
+    size_t slot;
+
+    if (tick < wheel->current_tick) {
+        tick = wheel->current_tick;
+    }
+    slot = (size_t)(tick % OCTOPING_WHEEL_SLOTS);
+    timer->expire_time = expire_time;
+    timer->slot = slot;
+    timer->previous = NULL;
+    timer->next = wheel->slots[slot];
+    if (timer->next != NULL) {
+        timer->next->previous = timer;
+    }
+    wheel->slots[slot] = timer;
+    wheel->busy[slot / 64] |= (1ull << (slot % 64));
+    wheel->nb_timers++;
+}
+
+void octoping_wheel_remove(octoping_wheel_t* wheel, octoping_timer_t* timer)
+{
+    size_t slot = timer->slot;
+
+    if (timer->previous == NULL) {
+        wheel->slots[slot] = timer->next;
+        if (timer->next == NULL) {
+            wheel->busy[slot / 64] &= ~(1ull << (slot % 64));
+        }
+    }
+    else {
+        timer->previous->next = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->previous = timer->previous;
+    }
+    timer->next = NULL;
+    timer->previous = NULL;
+    wheel->nb_timers--;
+}
+
+/*
+ * Number of ticks between the current tick and the next non empty
+ * slot, or OCTOPING_WHEEL_SLOTS if the wheel is empty.
+ */
+static uint64_t octoping_wheel_next_busy(octoping_wheel_t* wheel)
+{
+    size_t first = (size_t)(wheel->current_tick % OCTOPING_WHEEL_SLOTS);
+
+    if (wheel->nb_timers > 0) {
+        for (size_t checked = 0; checked <= OCTOPING_WHEEL_SLOTS; ) {
+            size_t slot = (first + checked) % OCTOPING_WHEEL_SLOTS;
+            uint64_t bits = wheel->busy[slot / 64] >> (slot % 64);
+
+            if (bits != 0) {
+                size_t delta = checked + (size_t)octoping_ctz64(bits);
+                if (delta < OCTOPING_WHEEL_SLOTS) {
+                    return delta;
+                }
+                break;
+            }
+            checked += 64 - (slot % 64);
+        }
+    }
+    return OCTOPING_WHEEL_SLOTS;
+}
+
+/*
+ * Remove and return the next timer that expired at the current
+ * time, or NULL if there is none. The cursor skips the empty slots.
+ */
+octoping_timer_t* octoping_wheel_next_expired(octoping_wheel_t* wheel, uint64_t current_time)
+{
+    uint64_t now_tick = current_time / wheel->tick_ns;
+
+    while (wheel->current_tick <= now_tick) {
+        uint64_t delta = octoping_wheel_next_busy(wheel);
+
+        if (delta >= OCTOPING_WHEEL_SLOTS || wheel->current_tick + delta > now_tick) {
+            wheel->current_tick = now_tick;
+            break;
+        }
+        wheel->current_tick += delta;
+        for (octoping_timer_t* timer = wheel->slots[wheel->current_tick % OCTOPING_WHEEL_SLOTS];
+            timer != NULL; timer = timer->next) {
+            if (timer->expire_time <= current_time) {
+                octoping_wheel_remove(wheel, timer);
+                return timer;
+            }
+        }
+        if (wheel->current_tick == now_tick) {
+            break;
+        }
+        wheel->current_tick++;
+    }
+    return NULL;
+}
+
+/*
+ * Time at which the application should next call
+ * octoping_wheel_next_expired, or UINT64_MAX if the wheel is
+ * empty. If the next non empty slot only holds timers expiring in a
+ * later rotation, this is the end of that slot.
+ */
+uint64_t octoping_wheel_next_time(octoping_wheel_t* wheel)
+{
+    uint64_t next_time = UINT64_MAX;
+    uint64_t delta = octoping_wheel_next_busy(wheel);
+
+    if (delta < OCTOPING_WHEEL_SLOTS) {
+        uint64_t tick = wheel->current_tick + delta;
+
+        next_time = (tick + 1) * wheel->tick_ns;
+        for (octoping_timer_t* timer = wheel->slots[tick % OCTOPING_WHEEL_SLOTS];
+            timer != NULL; timer = timer->next) {
+            if (timer->expire_time < next_time) {
+                next_time = timer->expire_time;
+            }
+        }
+    }
+    return next_time;
+}
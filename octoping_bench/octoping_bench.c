@@ -0,0 +1,314 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <fcntl.h>
+#include "octoping.h"
+
+/*
+ * Loopback benchmark. Runs an octoping server and one or several
+ * octoping clients in the same process, over the loopback interface,
+ * and sweeps the I/O engines, the probe sizes, and the probe rates with
+ * and without kernel timestamps. The server is restarted for each
+ * engine. For
+ * each run, prints the sustained echo rate, the number of socket and
+ * wait calls per probe, the CPU time per probe, and the rtt, which on
+ * loopback is essentially the time added by octoping and the stack.
+ * The output of the server and the clients is discarded.
+ */
+
+#define OCTOPING_BENCH_PORT (OCTOPING_PORT + 100)
+#define OCTOPING_BENCH_MAX_RATES 32
+#define OCTOPING_BENCH_MAX_CLIENTS 64
+
+typedef struct st_octoping_bench_client_t {
+    octoping_options_t options;
+    octoping_stats_t stats;
+    int ret;
+    pthread_t thread;
+} octoping_bench_client_t;
+
+static void usage(char const* sample_name)
+{
+    fprintf(stderr, "Usage: %s [-p port] [-d seconds] [-n clients] [-b batch_size] [-w workers] [-e engine] [-z size[,size...]] [-r rate[,rate...]]\n", sample_name);
+    fprintf(stderr, "use -p to set the server port, default %d.\n", OCTOPING_BENCH_PORT);
+    fprintf(stderr, "use -d to set the duration of each run in seconds, default 2.\n");
+    fprintf(stderr, "use -n to run several clients in parallel, sharing the rate.\n");
+    fprintf(stderr, "use -b and -w to set the batch size and number of workers of the server.\n");
+    fprintf(stderr, "use -e to only run the socket or the io_uring engine.\n");
+    fprintf(stderr, "use -z to list the probe sizes in bytes, default the smallest probes.\n");
+    fprintf(stderr, "use -r to list the probe rates in packets per second, default 1000,10000,100000.\n");
+    exit(1);
+}
+
+static void* octoping_bench_server_thread(void* arg)
+{
+    (void)octoping_server((octoping_options_t*)arg);
+    return NULL;
+}
+
+static void* octoping_bench_client_thread(void* arg)
+{
+    octoping_bench_client_t* client = (octoping_bench_client_t*)arg;
+
+    client->ret = octoping_client(&client->options);
+    return NULL;
+}
+
+static double octoping_bench_cpu_us()
+{
+    struct rusage usage;
+
+    (void)getrusage(RUSAGE_SELF, &usage);
+    return ((double)usage.ru_utime.tv_sec + (double)usage.ru_stime.tv_sec) * 1000000.0 +
+        (double)usage.ru_utime.tv_usec + (double)usage.ru_stime.tv_usec;
+}
+
+static char const* octoping_bench_engine_name(int engine)
+{
+    return (engine == octoping_engine_uring) ? "io_uring" : "socket";
+}
+
+static int octoping_bench_run(FILE* F, octoping_bench_client_t* clients, int nb_clients, int port,
+    int engine, int size, uint64_t rate, int timestamps, int seconds)
+{
+    int ret = 0;
+    int nb_started = 0;
+    octoping_stats_t* total = (octoping_stats_t*)calloc(1, sizeof(octoping_stats_t));
+    uint64_t syscalls_before = OCTOPING_LOAD_ACQUIRE(&octoping_nb_syscalls);
+    double cpu_before = octoping_bench_cpu_us();
+    uint64_t start_time = current_time_ns();
+    double elapsed;
+    double nb_probes;
+
+    if (total == NULL) {
+        return -1;
+    }
+
+    for (; nb_started < nb_clients; nb_started++) {
+        octoping_bench_client_t* client = &clients[nb_started];
+
+        memset(client, 0, sizeof(octoping_bench_client_t));
+        client->options.server_name = "127.0.0.1";
+        client->options.server_port = (uint16_t)port;
+        client->options.first_cpu = -1;
+        client->options.timestamps = timestamps;
+        client->options.engine = engine;
+        if (size > 0) {
+            client->options.sizes[0] = (uint16_t)size;
+            client->options.nb_sizes = 1;
+        }
+        client->options.interval_ns = (1000000000ull * (uint64_t)nb_clients) / rate;
+        client->options.duration_us = ((uint64_t)seconds) * 1000000;
+        client->options.output_format = octoping_format_summary;
+        client->options.file_name = "/dev/null";
+        client->options.report = &client->stats;
+        if (pthread_create(&client->thread, NULL, octoping_bench_client_thread, client) != 0) {
+            fprintf(F, "Cannot start client %d\n", nb_started);
+            ret = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < nb_started; i++) {
+        (void)pthread_join(clients[i].thread, NULL);
+        if (clients[i].ret != 0) {
+            ret = -1;
+        }
+        octoping_stats_merge(total, &clients[i].stats);
+    }
+
+    elapsed = ((double)(current_time_ns() - start_time)) / 1000000000.0;
+    nb_probes = (double)(total->nb_echoes + total->nb_lost);
+    if (nb_probes < 1) {
+        nb_probes = 1;
+    }
+    fprintf(F, "%-8s %-4s %5d %9" PRIu64 " %7d %10" PRIu64 " %8" PRIu64 " %10.0f %9.2f %9.2f %9.3f %9.3f %9.3f\n",
+        octoping_bench_engine_name(engine), (timestamps) ? "ns" : "us",
+        (size > ((timestamps) ? 32 : 16)) ? size : ((timestamps) ? 32 : 16), rate, nb_clients, total->nb_echoes, total->nb_lost,
+        ((double)total->nb_echoes) / ((elapsed > seconds) ? (double)seconds : elapsed),
+        ((double)(OCTOPING_LOAD_ACQUIRE(&octoping_nb_syscalls) - syscalls_before)) / nb_probes,
+        (octoping_bench_cpu_us() - cpu_before) / nb_probes,
+        ((double)octoping_histogram_percentile(&total->rtt, 0.5)) / 1000.0,
+        ((double)octoping_histogram_percentile(&total->rtt, 0.99)) / 1000.0,
+        ((double)octoping_histogram_percentile(&total->stack_t, 0.5)) / 1000.0);
+    fflush(F);
+    free(total);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    int port = OCTOPING_BENCH_PORT;
+    int seconds = 2;
+    int nb_clients = 1;
+    uint64_t rates[OCTOPING_BENCH_MAX_RATES] = { 1000, 10000, 100000 };
+    int nb_rates = 3;
+    int sizes[OCTOPING_MAX_SIZES] = { 0 };
+    int nb_sizes = 1;
+    int engines[2] = { octoping_engine_socket, octoping_engine_uring };
+#ifdef OCTOPING_HAS_URING
+    int nb_engines = 2;
+#else
+    int nb_engines = 1;
+#endif
+    octoping_options_t server_options;
+    octoping_bench_client_t* clients = NULL;
+    pthread_t server_thread;
+    FILE* F = NULL;
+    int null_fd;
+    int opt;
+
+    memset(&server_options, 0, sizeof(server_options));
+    server_options.is_server = 1;
+    server_options.first_cpu = -1;
+
+    while ((opt = getopt(argc, argv, "p:d:n:b:w:e:z:r:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            if (port <= 0 || port > 0xffff) {
+                usage(argv[0]);
+            }
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            if (seconds <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'n':
+            nb_clients = atoi(optarg);
+            if (nb_clients <= 0 || nb_clients > OCTOPING_BENCH_MAX_CLIENTS) {
+                usage(argv[0]);
+            }
+            break;
+        case 'b':
+            server_options.batch_size = atoi(optarg);
+            if (server_options.batch_size <= 0 || server_options.batch_size > OCTOPING_MAX_BATCH) {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            server_options.nb_workers = atoi(optarg);
+            if (server_options.nb_workers <= 0 || server_options.nb_workers > OCTOPING_MAX_WORKERS) {
+                usage(argv[0]);
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "socket") == 0) {
+                nb_engines = 1;
+            }
+#ifdef OCTOPING_HAS_URING
+            else if (strcmp(optarg, "io_uring") == 0) {
+                engines[0] = octoping_engine_uring;
+                nb_engines = 1;
+            }
+#endif
+            else {
+                usage(argv[0]);
+            }
+            break;
+        case 'z': {
+            char* next = optarg;
+            nb_sizes = 0;
+            while (*next != 0 && nb_sizes < OCTOPING_MAX_SIZES) {
+                char* end;
+                sizes[nb_sizes] = (int)strtol(next, &end, 10);
+                if (end == next || sizes[nb_sizes] < 16 || sizes[nb_sizes] > OCTOPING_PACKET_MAX ||
+                    (*end != ',' && *end != 0)) {
+                    usage(argv[0]);
+                }
+                nb_sizes++;
+                next = (*end == ',') ? end + 1 : end;
+            }
+            break;
+        }
+        case 'r': {
+            char* next = optarg;
+            nb_rates = 0;
+            while (*next != 0 && nb_rates < OCTOPING_BENCH_MAX_RATES) {
+                char* end;
+                rates[nb_rates] = strtoull(next, &end, 10);
+                if (end == next || rates[nb_rates] == 0 || (*end != ',' && *end != 0)) {
+                    usage(argv[0]);
+                }
+                nb_rates++;
+                next = (*end == ',') ? end + 1 : end;
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+    server_options.source_port = (uint16_t)port;
+
+    /* Keep the original stdout for the results, and discard the output of the server and clients */
+    fflush(stdout);
+    if ((F = fdopen(dup(STDOUT_FILENO), "w")) == NULL || (null_fd = open("/dev/null", O_WRONLY)) < 0 ||
+        dup2(null_fd, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Cannot redirect the standard output\n");
+        exit(1);
+    }
+    close(null_fd);
+
+    if ((clients = (octoping_bench_client_t*)calloc((size_t)nb_clients, sizeof(octoping_bench_client_t))) == NULL) {
+        fprintf(F, "Cannot allocate %d clients\n", nb_clients);
+        ret = -1;
+    }
+    else {
+        fprintf(F, "Loopback benchmark, %d s per run, server batch size %d, %d workers\n", seconds,
+            (server_options.batch_size > 1) ? server_options.batch_size : 1,
+            (server_options.nb_workers > 1) ? server_options.nb_workers : 1);
+        fprintf(F, "%-8s %-4s %5s %9s %7s %10s %8s %10s %9s %9s %9s %9s %9s\n", "engine", "mode", "size", "rate", "clients",
+            "echoes", "lost", "pps", "calls/pkt", "cpu_us", "rtt_p50", "rtt_p99", "stack_p50");
+        for (int e = 0; ret == 0 && e < nb_engines; e++) {
+            server_options.engine = engines[e];
+            if (pthread_create(&server_thread, NULL, octoping_bench_server_thread, &server_options) != 0) {
+                fprintf(F, "Cannot start the server\n");
+                ret = -1;
+                break;
+            }
+            /* Let the server bind its sockets */
+            usleep(200000);
+            for (int timestamps = 0; timestamps <= 1; timestamps++) {
+                for (int j = 0; j < nb_sizes; j++) {
+                    for (int i = 0; i < nb_rates; i++) {
+                        if (octoping_bench_run(F, clients, nb_clients, port, engines[e], sizes[j], rates[i],
+                            timestamps, seconds) != 0) {
+                            ret = -1;
+                        }
+                    }
+                }
+            }
+            octoping_server_request_stop();
+            (void)pthread_join(server_thread, NULL);
+        }
+    }
+    free(clients);
+    fclose(F);
+    return (ret == 0) ? 0 : 1;
+}